@@ -30,7 +30,8 @@ public:
     // Files:
     std::string currencyPath() const { return dir_ + "sync/Currency.json"; }
     std::string namePath() const { return dir_ + "sync/WalletName.json"; }
-    std::string cachePath() const { return dir_ + "Cache.json"; }
+    std::string cachePath() const { return dir_ + "Cache.bin"; }
+    std::string cachePathJson() const { return dir_ + "Cache.json"; }
     std::string cachePathOld() const { return dir_ + "watcher.ser"; }
 
 private:
@@ -29,9 +29,9 @@ Account::create(std::shared_ptr<Account> &result, Login &login)
 }
 
 Status
-Account::sync(bool &dirty)
+Account::sync(bool &dirty, SyncStats *stats)
 {
-    ABC_CHECK(syncRepo(dir(), syncKey_, dirty));
+    ABC_CHECK(syncRepo(dir(), syncKey_, dirty, stats));
     if (dirty)
         ABC_CHECK(load());
 
@@ -14,6 +14,7 @@
 namespace abcd {
 
 class Login;
+struct SyncStats;
 
 /**
  * Manages the account sync directory.
@@ -33,9 +34,10 @@ public:
     /**
      * Syncs the account with the file server.
      * This is a blocking network operation.
+     * @param stats receives timing and change counts, if provided.
      */
     Status
-    sync(bool &dirty);
+    sync(bool &dirty, SyncStats *stats=nullptr);
 
 private:
     const std::shared_ptr<Login> parent_;
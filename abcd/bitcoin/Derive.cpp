@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "Derive.hpp"
+#include "../util/Parallel.hpp"
+#include <algorithm>
+
+namespace abcd {
+
+/**
+ * Each thread takes this many children at a time,
+ * which keeps the scheduling overhead small next to the EC math.
+ */
+constexpr size_t DERIVE_BLOCK_SIZE = 256;
+
+std::vector<std::string>
+deriveAddresses(const bc::hd_private_key &parent,
+                const std::vector<uint32_t> &indices)
+{
+    std::vector<std::string> out(indices.size());
+
+    const size_t blocks = (indices.size() + DERIVE_BLOCK_SIZE - 1) /
+                          DERIVE_BLOCK_SIZE;
+    parallelFor(blocks, [&parent, &indices, &out](size_t block)
+    {
+        const size_t end = std::min(indices.size(),
+                                    (block + 1) * DERIVE_BLOCK_SIZE);
+        for (size_t i = block * DERIVE_BLOCK_SIZE; i < end; ++i)
+        {
+            const auto child = parent.generate_private_key(indices[i]);
+            if (child.valid())
+                out[i] = child.address().encoded();
+        }
+    });
+
+    return out;
+}
+
+std::vector<std::string>
+deriveAddresses(const bc::hd_private_key &parent,
+                uint32_t start, size_t count)
+{
+    std::vector<uint32_t> indices(count);
+    for (size_t i = 0; i < count; ++i)
+        indices[i] = start + i;
+
+    return deriveAddresses(parent, indices);
+}
+
+} // namespace abcd
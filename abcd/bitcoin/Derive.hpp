@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#ifndef ABCD_BITCOIN_DERIVE_HPP
+#define ABCD_BITCOIN_DERIVE_HPP
+
+#include <bitcoin/bitcoin.hpp>
+#include <string>
+#include <vector>
+
+namespace abcd {
+
+/**
+ * Derives the addresses for a batch of child indices.
+ * Every child comes from the same parent node,
+ * and the work is spread across threads using `parallelFor`.
+ * @return one address per index, in the same order.
+ * Indices that do not produce a valid key get an empty string.
+ */
+std::vector<std::string>
+deriveAddresses(const bc::hd_private_key &parent,
+                const std::vector<uint32_t> &indices);
+
+/**
+ * Derives the addresses for the children from `start` up to `start + count`.
+ */
+std::vector<std::string>
+deriveAddresses(const bc::hd_private_key &parent,
+                uint32_t start, size_t count);
+
+} // namespace abcd
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "KeyCache.hpp"
+#include "../util/Debug.hpp"
+#include "../util/Util.hpp"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <new>
+
+namespace abcd {
+
+constexpr size_t slotSize = sizeof(bc::ec_secret);
+
+static size_t
+pageSize()
+{
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+KeyCache::~KeyCache()
+{
+    clear();
+}
+
+bool
+KeyCache::find(bc::ec_secret &result, const std::string &address) const
+{
+    auto i = slots_.find(address);
+    if (slots_.end() == i)
+        return false;
+
+    const auto data = slot(i->second);
+    std::copy(data, data + slotSize, result.begin());
+    return true;
+}
+
+void
+KeyCache::insert(const std::string &address, const bc::ec_secret &secret)
+{
+    auto i = slots_.find(address);
+    size_t n = slots_.end() != i ? i->second : slots_.size();
+
+    // Grab a fresh page once the current ones fill up:
+    if (pages_.size() * (pageSize() / slotSize) <= n)
+    {
+        void *page = mmap(nullptr, pageSize(), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == page)
+            throw std::bad_alloc();
+
+        // Keeping the keys out of swap is nice, but not essential:
+        if (mlock(page, pageSize()))
+            ABC_DebugLog("Cannot lock key cache memory");
+#ifdef MADV_DONTDUMP
+        madvise(page, pageSize(), MADV_DONTDUMP);
+#endif
+        pages_.push_back(static_cast<uint8_t *>(page));
+    }
+
+    std::copy(secret.begin(), secret.end(), slot(n));
+    slots_[address] = n;
+}
+
+void
+KeyCache::clear()
+{
+    for (auto page: pages_)
+    {
+        ABC_UtilGuaranteedMemset(page, 0, pageSize());
+        munlock(page, pageSize());
+        munmap(page, pageSize());
+    }
+    pages_.clear();
+    slots_.clear();
+}
+
+uint8_t *
+KeyCache::slot(size_t n) const
+{
+    const size_t perPage = pageSize() / slotSize;
+    return pages_[n / perPage] + (n % perPage) * slotSize;
+}
+
+} // namespace abcd
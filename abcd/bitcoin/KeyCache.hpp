@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#ifndef ABCD_BITCOIN_KEY_CACHE_HPP
+#define ABCD_BITCOIN_KEY_CACHE_HPP
+
+#include <bitcoin/bitcoin.hpp>
+#include <map>
+#include <vector>
+
+namespace abcd {
+
+/**
+ * Remembers private keys by address.
+ * The keys live in pages that are locked out of swap (where allowed),
+ * and are wiped once the cache goes away.
+ * This class is not thread-safe, so the owner needs to lock it.
+ */
+class KeyCache
+{
+public:
+    ~KeyCache();
+    KeyCache() = default;
+    KeyCache(const KeyCache &) = delete;
+    KeyCache &operator=(const KeyCache &) = delete;
+
+    /**
+     * Looks up the key for an address.
+     * @return false if the key is not in the cache.
+     */
+    bool
+    find(bc::ec_secret &result, const std::string &address) const;
+
+    /**
+     * Adds a key to the cache.
+     */
+    void
+    insert(const std::string &address, const bc::ec_secret &secret);
+
+    /**
+     * Wipes all the keys.
+     */
+    void
+    clear();
+
+private:
+    std::vector<uint8_t *> pages_;
+    std::map<std::string, size_t> slots_;
+
+    uint8_t *
+    slot(size_t n) const;
+};
+
+} // namespace abcd
+
+#endif
@@ -8,6 +8,7 @@
 #include "Watcher.hpp"
 #include "../util/Debug.hpp"
 #include <bitcoin/bitcoin.hpp>
+#include <future>
 #include <sstream>
 
 namespace abcd {
@@ -20,15 +21,25 @@ static unsigned watcher_id = 0;
 enum
 {
     msg_quit,
+    msg_add,
+    msg_remove,
     msg_wakeup,
     msg_disconnect,
     msg_connect,
     msg_send
 };
 
-Watcher::Watcher(Cache &cache):
+Watcher::~Watcher()
+{
+    uint8_t req = msg_quit;
+    send(DataChunk(&req, &req + 1));
+    thread_.join();
+}
+
+Watcher::Watcher(BlockCache &blockCache):
     socket_(ctx_, ZMQ_PAIR),
-    txu_(cache, ctx_)
+    loopSocket_(ctx_, ZMQ_PAIR),
+    txu_(blockCache, ctx_)
 {
     std::stringstream name;
     name << "inproc://watcher-" << watcher_id++;
@@ -36,57 +47,79 @@ Watcher::Watcher(Cache &cache):
     socket_.bind(socket_name_.c_str());
     int linger = 0;
     socket_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+
+    // Connect before the thread starts, so nothing can be sent too early:
+    loopSocket_.connect(socket_name_.c_str());
+    loopSocket_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+    thread_ = std::thread(&Watcher::loop, this);
 }
 
-void
-Watcher::sendWakeup()
+unsigned
+Watcher::add(Cache &cache)
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
+    unsigned id;
+    {
+        std::lock_guard<std::mutex> lock(socket_mutex_);
+        id = ++lastId_;
+    }
 
-    uint8_t req = msg_wakeup;
-    socket_.send(&req, 1);
+    auto cacheInt = reinterpret_cast<uintptr_t>(&cache);
+    send(buildData({bc::to_byte(msg_add), bc::to_little_endian(id),
+                    bc::to_little_endian(cacheInt)
+                   }));
+    return id;
 }
 
-void Watcher::disconnect()
+void
+Watcher::remove(unsigned id)
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
+    // The thread cannot wait on itself:
+    if (std::this_thread::get_id() == thread_.get_id())
+    {
+        txu_.cacheRemove(id);
+        return;
+    }
 
-    uint8_t req = msg_disconnect;
-    socket_.send(&req, 1);
+    std::promise<void> done;
+    auto doneInt = reinterpret_cast<uintptr_t>(&done);
+    send(buildData({bc::to_byte(msg_remove), bc::to_little_endian(id),
+                    bc::to_little_endian(doneInt)
+                   }));
+    done.get_future().wait();
 }
 
-void Watcher::connect()
+void
+Watcher::sendWakeup(unsigned id)
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
+    send(buildData({bc::to_byte(msg_wakeup), bc::to_little_endian(id)}));
+}
+
+void Watcher::disconnect(unsigned id)
+{
+    send(buildData({bc::to_byte(msg_disconnect), bc::to_little_endian(id)}));
+}
 
-    uint8_t req = msg_connect;
-    socket_.send(&req, 1);
+void Watcher::connect(unsigned id)
+{
+    send(buildData({bc::to_byte(msg_connect), bc::to_little_endian(id)}));
 }
 
 void
 Watcher::sendTx(StatusCallback status, DataSlice tx)
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
-
     auto statusCopy = new StatusCallback(std::move(status));
     auto statusInt = reinterpret_cast<uintptr_t>(statusCopy);
 
-    auto data = buildData({bc::to_byte(msg_send),
-                           bc::to_little_endian(statusInt), tx
-                          });
-    socket_.send(data.data(), data.size());
+    send(buildData({bc::to_byte(msg_send),
+                    bc::to_little_endian(statusInt), tx
+                   }));
 }
 
-void Watcher::stop()
+void
+Watcher::send(const DataChunk &data)
 {
     std::lock_guard<std::mutex> lock(socket_mutex_);
-
-    uint8_t req = msg_quit;
-    socket_.send(&req, 1);
-
-    // Log time to start logout
-    ABC_DebugLog("Watcher::stop() %lu", this);
-
+    socket_.send(data.data(), data.size());
 }
 
 void throw_term()
@@ -104,10 +137,7 @@ void throw_intr()
 
 void Watcher::loop()
 {
-    zmq::socket_t socket(ctx_, ZMQ_PAIR);
-    socket.connect(socket_name_.c_str());
-    int linger = 0;
-    socket.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+    auto &socket = loopSocket_;
 
     bool done = false;
     while (!done)
@@ -155,15 +185,33 @@ bool Watcher::command(uint8_t *data, size_t size)
         ABC_DebugLog("Watcher Successfully Quit %lu", this);
         return false;
 
+    case msg_add:
+    {
+        auto id = serial.read_little_endian<unsigned>();
+        auto cacheInt = serial.read_little_endian<uintptr_t>();
+        txu_.cacheAdd(id, *reinterpret_cast<Cache *>(cacheInt));
+    }
+    return true;
+
+    case msg_remove:
+    {
+        auto id = serial.read_little_endian<unsigned>();
+        auto doneInt = serial.read_little_endian<uintptr_t>();
+        txu_.cacheRemove(id);
+        reinterpret_cast<std::promise<void> *>(doneInt)->set_value();
+    }
+    return true;
+
     case msg_wakeup:
+        txu_.cacheWakeup(serial.read_little_endian<unsigned>());
         return true;
 
     case msg_disconnect:
-        txu_.disconnect();
+        txu_.disconnect(serial.read_little_endian<unsigned>());
         return true;
 
     case msg_connect:
-        txu_.connect().log();
+        txu_.connect(serial.read_little_endian<unsigned>()).log();
         return true;
 
     case msg_send:
@@ -11,37 +11,39 @@
 #include "network/TxUpdater.hpp"
 #include <zmq.hpp>
 #include <mutex>
+#include <thread>
 
 namespace abcd {
 
 /**
- * Provides threading support for the TxUpdater object.
+ * Runs a single TxUpdater on a background thread,
+ * shared between all the wallets being watched.
+ * The wallets talk to the thread through an inproc socket.
  */
 class Watcher
 {
 public:
-    Watcher(Cache &cache);
+    ~Watcher();
+    Watcher(BlockCache &blockCache);
 
     // - Updater messages: -------------
-    void sendWakeup();
-    void disconnect();
-    void connect();
-    void sendTx(StatusCallback status, DataSlice tx);
-
-    // - Thread implementation: --------
 
     /**
-     * Tells the loop() method to return.
+     * Begins syncing a wallet's cache.
+     * @return An id to pass to the other per-wallet methods.
      */
-    void stop();
+    unsigned add(Cache &cache);
 
     /**
-     * Call this function from a separate thread. It will run for an
-     * unlimited amount of time as it works to keep the transactions
-     * in the watcher up-to-date with the network. The function will
-     * eventually return when the watcher object is destroyed.
+     * Stops syncing a wallet's cache.
+     * Once this returns, the thread will no longer touch the cache.
      */
-    void loop();
+    void remove(unsigned id);
+
+    void sendWakeup(unsigned id);
+    void disconnect(unsigned id);
+    void connect(unsigned id);
+    void sendTx(StatusCallback status, DataSlice tx);
 
     Watcher(const Watcher &copy) = delete;
     Watcher &operator=(const Watcher &copy) = delete;
@@ -53,12 +55,20 @@ private:
     std::mutex socket_mutex_;
     std::string socket_name_;
     zmq::socket_t socket_;
+    unsigned lastId_ = 0;
+
+    void send(const DataChunk &data);
 
     // Everything below this point is only touched by the thread:
+    zmq::socket_t loopSocket_;
+    void loop();
     bool command(uint8_t *data, size_t size);
 
-    // This needs to be constructed last, since it uses everything else:
+    // This needs to be constructed after everything it uses:
     TxUpdater txu_;
+
+    // This needs to be constructed last, since it starts the loop:
+    std::thread thread_;
 };
 
 } // namespace abcd
@@ -15,12 +15,26 @@
 #include "../wallet/Receive.hpp"
 #include "../wallet/Wallet.hpp"
 #include <algorithm>
+#include <condition_variable>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 namespace abcd {
 
+/**
+ * A copy of an event, which outlives the callback that produced it.
+ */
+struct QueuedEvent
+{
+    tABC_AsyncBitCoinInfo info;
+    std::string walletId;
+    std::string txid;
+    std::vector<std::string> txids;
+};
+
 struct WatcherInfo
 {
 private:
@@ -30,19 +44,80 @@ private:
 public:
     WatcherInfo(Wallet &wallet):
         parent_(wallet.shared_from_this()),
-        watcher(wallet.cache),
         wallet(wallet)
     {
     }
 
-    Watcher watcher;
     Wallet &wallet;
     std::map<std::string, std::string> sweeping; // address to key
 
+    // The id the shared watcher knows us by, or zero if we aren't running:
+    unsigned id = 0;
+    bool wantConnection = false;
+
+    // Set by `bridgeWatcherBatchEvents` for GUIs that handle batch events:
+    bool batchEvents = false;
+
+    // Once stopped, a wallet needs a fresh `bridgeWatcherStart` to go again:
+    bool stopped = false;
+    std::condition_variable_any onStop;
+
+    tABC_BitCoin_Event_Callback fCallback = nullptr;
+    void *pData = nullptr;
+
+    // Events waiting for the `bridgeWatcherLoop` thread to deliver them:
+    std::list<QueuedEvent> events;
+};
+
+/**
+ * Every wallet shares one watcher, which lives as long as any wallet needs it.
+ */
+static std::recursive_mutex mutex_;
+static std::unique_ptr<Watcher> watcher_;
+// Shared, so a `bridgeWatcherLoop` thread can keep its entry alive
+// while a `bridgeWatcherDelete` removes it from the map:
+static std::map<std::string, std::shared_ptr<WatcherInfo>> watchers_;
+
+struct WatcherCallback
+{
     tABC_BitCoin_Event_Callback fCallback;
     void *pData;
+    std::string walletId;
 };
-static std::map<std::string, std::unique_ptr<WatcherInfo>> watchers_;
+
+/**
+ * Gathers the callbacks for every running wallet,
+ * so they can be invoked without holding the lock.
+ */
+static std::list<WatcherCallback>
+watcherCallbacks()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::list<WatcherCallback> out;
+    for (auto &watcher: watchers_)
+        if (watcher.second->fCallback)
+            out.push_back(WatcherCallback
+        {
+            watcher.second->fCallback, watcher.second->pData,
+            watcher.second->wallet.id()
+        });
+    return out;
+}
+
+static void
+watcherNotify(const WatcherCallback &callback, tABC_AsyncEventType type)
+{
+    tABC_AsyncBitCoinInfo info;
+    info.pData = callback.pData;
+    info.eventType = type;
+    Status().toError(info.status, ABC_HERE());
+    info.szWalletUUID = callback.walletId.c_str();
+    info.szTxID = nullptr;
+    info.aszTxIDs = nullptr;
+    info.countTxIDs = 0;
+    info.sweepSatoshi = 0;
+    callback.fCallback(&info);
+}
 
 /**
  * Tells all running watchers that height has changed.
@@ -51,21 +126,11 @@ static std::map<std::string, std::unique_ptr<WatcherInfo>> watchers_;
 static void
 onHeight(size_t height)
 {
-    for (auto &watcher: watchers_)
+    for (const auto &callback: watcherCallbacks())
     {
-        if (watcher.second->fCallback)
-        {
-            ABC_DebugLog("BlockHeightChange callback: wallet %s",
-                         watcher.second->wallet.id().c_str());
-            tABC_AsyncBitCoinInfo info;
-            info.pData = watcher.second->pData;
-            info.eventType = ABC_AsyncEventType_BlockHeightChange;
-            Status().toError(info.status, ABC_HERE());
-            info.szWalletUUID = watcher.second->wallet.id().c_str();
-            info.szTxID = nullptr;
-            info.sweepSatoshi = 0;
-            watcher.second->fCallback(&info);
-        }
+        ABC_DebugLog("BlockHeightChange callback: wallet %s",
+                     callback.walletId.c_str());
+        watcherNotify(callback, ABC_AsyncEventType_BlockHeightChange);
     }
 }
 
@@ -76,27 +141,15 @@ onHeight(size_t height)
 static void
 onHeader(void)
 {
-    for (auto &watcher: watchers_)
+    // XXX Todo: Look up TxIDs that actually have a matching height and
+    // send a notification for each one OR send one notification with all
+    // affected TxIDs in a std::set.
+    for (const auto &callback: watcherCallbacks())
     {
-        if (watcher.second->fCallback)
-        {
-            ABC_DebugLog("BlockHeader callback: wallet %s",
-                         watcher.second->wallet.id().c_str());
-            tABC_AsyncBitCoinInfo info;
-            info.pData = watcher.second->pData;
-            info.eventType = ABC_AsyncEventType_TransactionUpdate;
-            Status().toError(info.status, ABC_HERE());
-            info.szWalletUUID = watcher.second->wallet.id().c_str();
-
-            // XXX Todo: Look up TxIDs that actually have a matching height and
-            // send a notification for each one OR send one notification with all
-            // affected TxIDs in a std::set.
-            info.szTxID = nullptr;
-            info.sweepSatoshi = 0;
-            watcher.second->fCallback(&info);
-
-            break;
-        }
+        ABC_DebugLog("BlockHeader callback: wallet %s",
+                     callback.walletId.c_str());
+        watcherNotify(callback, ABC_AsyncEventType_TransactionUpdate);
+        break;
     }
 }
 
@@ -110,6 +163,7 @@ bridgeOnComplete(WatcherInfo *watcherInfo, const std::string &address,
     auto &wallet = watcherInfo->wallet;
 
     // If we are sweeping this address, do that now:
+    std::unique_lock<std::recursive_mutex> lock(mutex_);
     auto i = watcherInfo->sweeping.find(address);
     if (watcherInfo->sweeping.end() != i)
     {
@@ -117,9 +171,14 @@ bridgeOnComplete(WatcherInfo *watcherInfo, const std::string &address,
         // triggers another `onComplete` callback for the sweep address:
         auto sweep = *i;
         watcherInfo->sweeping.erase(i);
+        lock.unlock();
 
         sweepOnComplete(wallet, sweep.first, sweep.second, fCallback, pData);
     }
+    else
+    {
+        lock.unlock();
+    }
 
     // Send the AddressCheckDone callback if its time:
     const auto p = wallet.cache.addresses.progress();
@@ -133,6 +192,8 @@ bridgeOnComplete(WatcherInfo *watcherInfo, const std::string &address,
         Status().toError(info.status, ABC_HERE());
         info.szWalletUUID = wallet.id().c_str();
         info.szTxID = nullptr;
+        info.aszTxIDs = nullptr;
+        info.countTxIDs = 0;
         info.sweepSatoshi = 0;
         wallet.cache.addressCheckDoneSet();
         wallet.cache.save();
@@ -140,25 +201,18 @@ bridgeOnComplete(WatcherInfo *watcherInfo, const std::string &address,
     }
 }
 
+/**
+ * Looks up a wallet's watcher. The caller must hold the lock.
+ */
 static Status
-watcherFind(WatcherInfo *&result, const Wallet &self)
+watcherFind(std::shared_ptr<WatcherInfo> &result, const Wallet &self)
 {
     std::string id = self.id();
     auto row = watchers_.find(id);
     if (row == watchers_.end())
         return ABC_ERROR(ABC_CC_Synchronizing, "Cannot find watcher for " + id);
 
-    result = row->second.get();
-    return Status();
-}
-
-static Status
-watcherFind(Watcher *&result, const Wallet &self)
-{
-    WatcherInfo *watcherInfo = nullptr;
-    ABC_CHECK(watcherFind(watcherInfo, self));
-
-    result = &watcherInfo->watcher;
+    result = row->second;
     return Status();
 }
 
@@ -166,11 +220,17 @@ Status
 bridgeSweepKey(Wallet &self, const std::string &wif,
                const std::string &address)
 {
-    WatcherInfo *watcherInfo = nullptr;
-    ABC_CHECK(watcherFind(watcherInfo, self));
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        std::shared_ptr<WatcherInfo> watcherInfo;
+        ABC_CHECK(watcherFind(watcherInfo, self));
 
-    // Start the sweep:
-    watcherInfo->sweeping[address] = wif;
+        // Start the sweep:
+        watcherInfo->sweeping[address] = wif;
+    }
+
+    // The cache calls back into us with its own lock held,
+    // so never touch it while holding ours:
     self.cache.addresses.insert(address, true);
 
     return Status();
@@ -179,78 +239,198 @@ bridgeSweepKey(Wallet &self, const std::string &wif,
 Status
 bridgeWatcherStart(Wallet &self)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (watchers_.end() != watchers_.find(self.id()))
         return ABC_ERROR(ABC_CC_Error,
                          "Watcher already exists for " + self.id());
 
+    if (!watcher_)
+        watcher_.reset(new Watcher(gContext->blockCache));
     watchers_[self.id()].reset(new WatcherInfo(self));
 
     return Status();
 }
 
 Status
-bridgeWatcherLoop(Wallet &self,
-                  tABC_BitCoin_Event_Callback fCallback,
-                  void *pData)
+bridgeWatcherListen(Wallet &self,
+                    tABC_BitCoin_Event_Callback fCallback,
+                    void *pData)
 {
-    WatcherInfo *watcherInfo = nullptr;
-    ABC_CHECK(watcherFind(watcherInfo, self));
+    std::shared_ptr<WatcherInfo> watcherInfo;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        ABC_CHECK(watcherFind(watcherInfo, self));
+        if (watcherInfo->stopped)
+            return Status();
+        if (watcherInfo->id || watcherInfo->fCallback)
+            return ABC_ERROR(ABC_CC_Error,
+                             "Watcher already running for " + self.id());
+
+        watcherInfo->fCallback = fCallback;
+        watcherInfo->pData = pData;
+    }
 
     // Set up new-block callback:
-    watcherInfo->fCallback = fCallback;
-    watcherInfo->pData = pData;
     gContext->blockCache.onHeightSet(onHeight);
     gContext->blockCache.onHeaderSet(onHeader);
 
-    // Set up the address-changed callback:
-    auto wakeupCallback = [watcherInfo]()
-    {
-        watcherInfo->watcher.sendWakeup();
-    };
-    self.cache.addresses.wakeupCallbackSet(wakeupCallback);
+    // These callbacks go away in `bridgeWatcherStop`,
+    // before the entry can be deleted:
+    WatcherInfo *info = watcherInfo.get();
 
     // Set up the new-transaction callback:
-    auto onTx = [watcherInfo, fCallback, pData]
-                (const std::string &txid)
+    auto onTx = [info, fCallback, pData]
+                (const TxidSet &txids)
     {
-        ABC_DebugLog("**************************************************************");
-        ABC_DebugLog("**** GUI Notified of NEW TRANSACTION txid %s", txid.c_str());
-        ABC_DebugLog("**************************************************************\n");
+        std::list<TxInfo> infos;
+        for (const auto &txid: txids)
+        {
+            ABC_DebugLog("**************************************************************");
+            ABC_DebugLog("**** GUI Notified of NEW TRANSACTION txid %s", txid.c_str());
+            ABC_DebugLog("**************************************************************\n");
 
-        TxInfo info;
-        if (watcherInfo->wallet.cache.txs.info(info, txid).log())
-            onReceive(watcherInfo->wallet, info, fCallback, pData).log();
+            TxInfo txInfo;
+            if (info->wallet.cache.txs.info(txInfo, txid).log())
+                infos.push_back(txInfo);
+        }
+
+        bool batch;
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+            batch = info->batchEvents;
+        }
+        onReceive(info->wallet, infos, batch, fCallback, pData).log();
     };
     self.cache.addresses.onTxSet(onTx);
 
     // Set up the address-completed callback:
-    auto onComplete = [watcherInfo, fCallback, pData]
+    auto onComplete = [info, fCallback, pData]
                       (const std::string &address)
     {
-        bridgeOnComplete(watcherInfo, address, fCallback, pData);
+        bridgeOnComplete(info, address, fCallback, pData);
     };
     self.cache.addresses.onCompleteSet(onComplete);
 
-    // Do the loop:
-    watcherInfo->watcher.loop();
+    // Join the shared watcher:
+    Watcher *watcher = nullptr;
+    unsigned id = 0;
+    {
+        std::unique_lock<std::recursive_mutex> lock(mutex_);
+        if (watcherInfo->stopped)
+        {
+            // We lost a race with `bridgeWatcherStop`:
+            lock.unlock();
+            self.cache.addresses.onTxSet(nullptr);
+            self.cache.addresses.onCompleteSet(nullptr);
+            return Status();
+        }
 
-    // Cancel all callbacks:
-    self.cache.addresses.wakeupCallbackSet(nullptr);
-    self.cache.addresses.onTxSet(nullptr);
-    self.cache.addresses.onCompleteSet(nullptr);
-    watcherInfo->fCallback = nullptr;
-    watcherInfo->pData = nullptr;
+        watcher = watcher_.get();
+        id = watcher->add(self.cache);
+        watcherInfo->id = id;
+        if (watcherInfo->wantConnection)
+            watcher->connect(id);
+    }
+
+    // Set up the address-changed callback:
+    auto wakeupCallback = [watcher, id]()
+    {
+        watcher->sendWakeup(id);
+    };
+    self.cache.addresses.wakeupCallbackSet(wakeupCallback);
+
+    return Status();
+}
+
+/**
+ * Stands in for the caller's callback in `bridgeWatcherLoop`,
+ * queueing events so the loop thread can deliver them.
+ */
+static void
+watcherQueueEvent(const tABC_AsyncBitCoinInfo *pInfo)
+{
+    QueuedEvent event;
+    event.info = *pInfo;
+    if (pInfo->szWalletUUID)
+        event.walletId = pInfo->szWalletUUID;
+    if (pInfo->szTxID)
+        event.txid = pInfo->szTxID;
+    for (unsigned i = 0; i < pInfo->countTxIDs; ++i)
+        event.txids.push_back(pInfo->aszTxIDs[i]);
+
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    auto *watcherInfo = static_cast<WatcherInfo *>(pInfo->pData);
+    watcherInfo->events.push_back(std::move(event));
+    watcherInfo->onStop.notify_all();
+}
+
+Status
+bridgeWatcherLoop(Wallet &self,
+                  tABC_BitCoin_Event_Callback fCallback,
+                  void *pData)
+{
+    std::shared_ptr<WatcherInfo> watcherInfo;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        ABC_CHECK(watcherFind(watcherInfo, self));
+    }
+
+    // The shared watcher does the real work,
+    // but its events come back to this thread, as the GUI expects.
+    // Our reference keeps the queue and condition variable alive,
+    // even if the wallet gets deleted before we wake up:
+    ABC_CHECK(bridgeWatcherListen(self, watcherQueueEvent, watcherInfo.get()));
+
+    std::unique_lock<std::recursive_mutex> lock(mutex_);
+    while (true)
+    {
+        watcherInfo->onStop.wait(lock, [&watcherInfo]()
+        {
+            return watcherInfo->stopped || !watcherInfo->events.empty();
+        });
+        if (watcherInfo->events.empty())
+            break;
+
+        auto event = std::move(watcherInfo->events.front());
+        watcherInfo->events.pop_front();
+        lock.unlock();
+
+        std::vector<const char *> txids;
+        for (const auto &txid: event.txids)
+            txids.push_back(txid.c_str());
+        event.info.pData = pData;
+        event.info.szWalletUUID = event.walletId.c_str();
+        event.info.szTxID = event.info.szTxID ? event.txid.c_str() : nullptr;
+        event.info.aszTxIDs = txids.empty() ? nullptr : txids.data();
+        fCallback(&event.info);
+
+        lock.lock();
+    }
 
     return Status();
 }
 
+Status
+bridgeWatcherBatchEvents(Wallet &self, bool batch)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::shared_ptr<WatcherInfo> watcherInfo;
+    ABC_CHECK(watcherFind(watcherInfo, self));
+
+    watcherInfo->batchEvents = batch;
+    return Status();
+}
+
 Status
 bridgeWatcherConnect(Wallet &self)
 {
-    Watcher *watcher = nullptr;
-    ABC_CHECK(watcherFind(watcher, self));
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::shared_ptr<WatcherInfo> watcherInfo;
+    ABC_CHECK(watcherFind(watcherInfo, self));
 
-    watcher->connect();
+    watcherInfo->wantConnection = true;
+    if (watcherInfo->id)
+        watcher_->connect(watcherInfo->id);
 
     return Status();
 }
@@ -258,10 +438,11 @@ bridgeWatcherConnect(Wallet &self)
 Status
 watcherSend(Wallet &self, StatusCallback status, DataSlice tx)
 {
-    Watcher *watcher = nullptr;
-    ABC_CHECK(watcherFind(watcher, self));
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::shared_ptr<WatcherInfo> watcherInfo;
+    ABC_CHECK(watcherFind(watcherInfo, self));
 
-    watcher->sendTx(status, tx);
+    watcher_->sendTx(status, tx);
 
     return Status();
 }
@@ -269,10 +450,13 @@ watcherSend(Wallet &self, StatusCallback status, DataSlice tx)
 Status
 bridgeWatcherDisconnect(Wallet &self)
 {
-    Watcher *watcher = nullptr;
-    ABC_CHECK(watcherFind(watcher, self));
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::shared_ptr<WatcherInfo> watcherInfo;
+    ABC_CHECK(watcherFind(watcherInfo, self));
 
-    watcher->disconnect();
+    watcherInfo->wantConnection = false;
+    if (watcherInfo->id)
+        watcher_->disconnect(watcherInfo->id);
 
     return Status();
 }
@@ -280,19 +464,55 @@ bridgeWatcherDisconnect(Wallet &self)
 Status
 bridgeWatcherStop(Wallet &self)
 {
+    std::shared_ptr<WatcherInfo> watcherInfo;
     Watcher *watcher = nullptr;
-    ABC_CHECK(watcherFind(watcher, self));
+    unsigned id = 0;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        ABC_CHECK(watcherFind(watcherInfo, self));
+
+        watcher = watcher_.get();
+        id = watcherInfo->id;
+        watcherInfo->id = 0;
+        watcherInfo->stopped = true;
+        watcherInfo->fCallback = nullptr;
+        watcherInfo->pData = nullptr;
+    }
+
+    // Once this returns, the watcher thread is done with the wallet:
+    if (id)
+        watcher->remove(id);
+
+    // Cancel all callbacks:
+    self.cache.addresses.wakeupCallbackSet(nullptr);
+    self.cache.addresses.onTxSet(nullptr);
+    self.cache.addresses.onCompleteSet(nullptr);
 
-    watcher->stop();
+    // Release anybody blocked in the loop:
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        watcherInfo->onStop.notify_all();
+    }
 
+    ABC_DebugLog("Watcher stopped for wallet %s", self.id().c_str());
     return Status();
 }
 
 Status
 bridgeWatcherDelete(Wallet &self)
 {
+    bridgeWatcherStop(self).log();
     self.cache.save().log(); // Failure is fine
-    watchers_.erase(self.id());
+
+    // The last wallet out shuts down the watcher thread,
+    // which must happen without holding the lock:
+    std::unique_ptr<Watcher> watcher;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        watchers_.erase(self.id());
+        if (watchers_.empty())
+            watcher = std::move(watcher_);
+    }
 
     return Status();
 }
@@ -31,11 +31,31 @@ bridgeSweepKey(Wallet &self, const std::string &wif,
 Status
 bridgeWatcherStart(Wallet &self);
 
+/**
+ * Hooks the wallet's callbacks up to the shared watcher,
+ * which keeps the wallet in sync until `bridgeWatcherStop` is called.
+ */
+Status
+bridgeWatcherListen(Wallet &self,
+                    tABC_BitCoin_Event_Callback fCallback,
+                    void *pData);
+
+/**
+ * Same as `bridgeWatcherListen`,
+ * but blocks the calling thread until the wallet is stopped,
+ * delivering the wallet's events on that thread.
+ */
 Status
 bridgeWatcherLoop(Wallet &self,
                   tABC_BitCoin_Event_Callback fCallback,
                   void *pData);
 
+/**
+ * Turns on or off the IncomingBitCoinBatch event for the wallet.
+ */
+Status
+bridgeWatcherBatchEvents(Wallet &self, bool batch);
+
 Status
 bridgeWatcherConnect(Wallet &self);
 
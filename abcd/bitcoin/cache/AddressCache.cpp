@@ -6,6 +6,7 @@
  */
 
 #include "AddressCache.hpp"
+#include "CacheFile.hpp"
 #include "TxCache.hpp"
 #include "../../json/JsonArray.hpp"
 #include "../../json/JsonObject.hpp"
@@ -36,6 +37,22 @@ struct AddressJson:
     ABC_JSON_STRING(stratumHash, "stratumHash", 0)
 };
 
+/**
+ * Removes an address from one entry in a txid index,
+ * dropping the entry once it is empty.
+ */
+static void
+indexErase(std::map<std::string, AddressSet> &index, const std::string &txid,
+           const std::string &address)
+{
+    auto i = index.find(txid);
+    if (index.end() == i)
+        return;
+    i->second.erase(address);
+    if (i->second.empty())
+        index.erase(i);
+}
+
 bool
 operator <(const AddressStatus &a, const AddressStatus &b)
 {
@@ -62,9 +79,56 @@ AddressCache::clear()
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
     priorityAddress_ = "";
+    knownTxids_.clear();
+    txidRows_.clear();
+    waiting_.clear();
+    schedule_.clear();
+    due_.clear();
     for (auto &row: rows_)
+    {
         row.second = AddressRow();
-    knownTxids_.clear();
+        changedRows_.insert(row.first);
+        rowSchedule(row.first, row.second);
+    }
+}
+
+Status
+AddressCache::load(CacheReader &reader)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    uint64_t size;
+    ABC_CHECK(reader.readSize(size));
+    for (uint64_t i = 0; i < size; i++)
+        ABC_CHECK(rowLoad(reader));
+    updateInternal();
+
+    return Status();
+}
+
+Status
+AddressCache::replay(uint8_t type, CacheReader &record)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    if (CacheJournal::addressRow == type)
+        return rowLoad(record);
+
+    std::string address;
+    uint8_t dirty;
+    uint64_t lastCheck;
+    ABC_CHECK(record.readString(address));
+    ABC_CHECK(record.readByte(dirty));
+    ABC_CHECK(record.readNumber(lastCheck));
+
+    auto i = rows_.find(address);
+    if (rows_.end() != i)
+    {
+        i->second.dirty = dirty;
+        i->second.lastCheck = lastCheck;
+        rowSchedule(i->first, i->second);
+    }
+    return Status();
 }
 
 Status
@@ -90,7 +154,7 @@ AddressCache::load(JsonObject &json)
             {
                 auto stringJson = arrayJson[i];
                 if (json_is_string(stringJson.get()))
-                    row.insertTxid(json_string_value(stringJson.get()));
+                    row.txids.insert(json_string_value(stringJson.get()));
             }
 
             row.dirty = addressJson.dirty();
@@ -101,7 +165,7 @@ AddressCache::load(JsonObject &json)
             if (addressJson.stratumHashOk())
                 row.stratumHash = addressJson.stratumHash();
 
-            rows_[address] = row;
+            rowReplace(address, row);
         }
     }
     updateInternal();
@@ -109,35 +173,27 @@ AddressCache::load(JsonObject &json)
     return Status();
 }
 
-Status
-AddressCache::save(JsonObject &json)
+void
+AddressCache::save(CacheWriter &writer)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
-    CacheJson cacheJson(json);
 
-    JsonArray addressesJson;
+    size_t count = 0;
     for (const auto &row: rows_)
-    {
-        if (row.second.sweep)
-            continue;
+        if (!row.second.sweep)
+            ++count;
 
-        JsonArray txidsJson;
-        for (const auto &txid: row.second.txids)
-            ABC_CHECK(txidsJson.append(json_string(txid.c_str())));
-
-        AddressJson address;
-        ABC_CHECK(address.addressSet(row.first));
-        if (row.second.dirty)
-            ABC_CHECK(address.dirtySet(row.second.dirty));
-        ABC_CHECK(address.txidsSet(txidsJson));
-        ABC_CHECK(address.lastCheckSet(row.second.lastCheck));
-        if (!row.second.stratumHash.empty())
-            ABC_CHECK(address.stratumHashSet(row.second.stratumHash));
-        ABC_CHECK(addressesJson.append(address));
-    }
-    cacheJson.addressesSet(addressesJson);
+    writer.writeSize(count);
+    for (const auto &row: rows_)
+        if (!row.second.sweep)
+            rowSave(writer, row.first, row.second);
+}
 
-    return Status();
+void
+AddressCache::journalSet(CacheJournal *journal)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    journal_ = journal;
 }
 
 std::pair<size_t, size_t>
@@ -159,20 +215,26 @@ AddressCache::statuses(time_t &sleep) const
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     std::list<AddressStatus> out;
 
-    time_t now = time(nullptr);
-    time_t nextCheck = now;
-    for (auto &row: rows_)
+    // Pull the checks that have come due off the front of the schedule:
+    const time_t now = time(nullptr);
+    while (!schedule_.empty() && schedule_.begin()->first <= now)
+    {
+        due_.insert(schedule_.begin()->second);
+        schedule_.erase(schedule_.begin());
+    }
+    sleep = schedule_.empty() ? 0 : schedule_.begin()->first - now;
+
+    // Everything else is up to date:
+    AddressSet work(dirty_);
+    work.insert(due_.begin(), due_.end());
+    work.insert(incomplete_.begin(), incomplete_.end());
+    for (const auto &address: work)
     {
-        const auto s = status(row.first, row.second, now);
+        const auto s = status(address, rows_.at(address), now);
         if (s.dirty || s.needsCheck || s.missingTxids.size())
             out.push_back(std::move(s));
-
-        if (now < s.nextCheck
-                && (s.nextCheck < nextCheck || now == nextCheck))
-            nextCheck = s.nextCheck;
     }
 
-    sleep = nextCheck - now;
     out.sort();
     return out;
 }
@@ -184,6 +246,21 @@ AddressCache::txids() const
     return knownTxids_;
 }
 
+AddressSet
+AddressCache::txidAddresses(const TxidSet &txids) const
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    AddressSet out;
+    for (const auto &txid: txids)
+    {
+        auto i = txidRows_.find(txid);
+        if (txidRows_.end() != i)
+            out.insert(i->second.begin(), i->second.end());
+    }
+    return out;
+}
+
 void
 AddressCache::insert(const std::string &address, bool sweep)
 {
@@ -193,6 +270,8 @@ AddressCache::insert(const std::string &address, bool sweep)
     {
         auto &row = rows_[address];
         row.sweep = sweep;
+        changedRows_.insert(address);
+        rowSchedule(address, row);
 
         if (wakeupCallback_)
             wakeupCallback_();
@@ -203,6 +282,7 @@ AddressCache::insert(const std::string &address, bool sweep)
         {
             // We are re-sweeping a key, so re-arm the callback:
             rows_[address].knownComplete = false;
+            changedRows_.insert(address);
             updateInternal();
         }
     }
@@ -213,7 +293,14 @@ AddressCache::prioritize(const std::string &address)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
+    // Both the old and new priority addresses change periods:
+    const auto old = rows_.find(priorityAddress_);
     priorityAddress_ = address;
+    if (rows_.end() != old)
+        rowSchedule(old->first, old->second);
+    const auto i = rows_.find(address);
+    if (rows_.end() != i)
+        rowSchedule(i->first, i->second);
 
     if (wakeupCallback_)
         wakeupCallback_();
@@ -223,6 +310,22 @@ void
 AddressCache::update()
 {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
+    for (const auto &row: rows_)
+        changedRows_.insert(row.first);
+    updateInternal();
+}
+
+void
+AddressCache::updateTx(const TxidSet &txids)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    for (const auto &txid: txids)
+    {
+        auto i = waiting_.find(txid);
+        if (waiting_.end() != i)
+            changedRows_.insert(i->second.begin(), i->second.end());
+    }
     updateInternal();
 }
 
@@ -243,20 +346,43 @@ AddressCache::update(const std::string &address, const TxidSet &txids)
         }
     }
 
-    // Remove the dropped txids from all addresses:
+    // Remove the dropped txids from the addresses that list them:
     for (const auto &txid: drops)
-        for (auto &row: rows_)
-            row.second.txids.erase(txid);
+    {
+        auto i = txidRows_.find(txid);
+        if (txidRows_.end() == i)
+            continue;
 
-    // Look for new txids:
+        const auto others = i->second;
+        for (const auto &other: others)
+        {
+            auto &otherRow = rows_[other];
+            if (rowEraseTxid(other, otherRow, txid) && address != other)
+                journalRow(other, otherRow);
+        }
+    }
+
+    // Look for new txids, or a row that has never been saved:
+    bool changed = !drops.empty() || !row.lastCheck;
     for (const auto &txid: txids)
+    {
         if (!row.txids.count(txid))
-            row.insertTxid(txid);
+        {
+            rowInsertTxid(address, row, txid);
+            changed = true;
+        }
+    }
 
     // Update timestamp:
     row.dirty = false;
     row.lastCheck = time(nullptr);
     row.checkedOnce = true;
+    changedRows_.insert(address);
+    rowSchedule(address, row);
+    if (changed)
+        journalRow(address, row);
+    else
+        journalCheck(address, row);
 
     // Fire callbacks:
     updateInternal();
@@ -271,9 +397,17 @@ AddressCache::updateSpend(TxInfo &info)
     {
         const auto i = rows_.find(io.address);
         if (rows_.end() != i)
-            i->second.insertTxid(info.txid);
+        {
+            if (rowInsertTxid(i->first, i->second, info.txid))
+                journalRow(i->first, i->second);
+        }
     }
 
+    // The transaction might also be an input someone is waiting on:
+    auto waiting = waiting_.find(info.txid);
+    if (waiting_.end() != waiting)
+        changedRows_.insert(waiting->second.begin(), waiting->second.end());
+
     // Fire callbacks:
     updateInternal();
 }
@@ -285,7 +419,11 @@ AddressCache::updateSubscribe(const std::string &address)
     auto &row = rows_[address];
 
     if (row.checkedOnce)
+    {
         row.lastCheck = time(nullptr);
+        journalCheck(address, row);
+    }
+    rowSchedule(address, row);
 }
 
 std::string
@@ -313,12 +451,31 @@ AddressCache::updateStratumHash(const std::string &address,
         return true;
     auto &row = i->second;
 
-    row.dirty |= (row.stratumHash.empty() || hash != row.stratumHash);
+    const bool changed = hash != row.stratumHash;
+    const bool wasDirty = row.dirty;
+
+    // If our own history produces the same hash, there is nothing to fetch:
+    std::string local;
+    if (txCache_.stratumHash(local, row.txids) && local == hash)
+        row.dirty = false;
+    else
+        row.dirty |= (row.stratumHash.empty() || changed);
     if (!hash.empty())
         row.stratumHash = hash;
     if (!row.dirty)
+    {
         row.checkedOnce = true;
-    return row.dirty;
+        changedRows_.insert(address);
+    }
+    rowSchedule(address, row);
+    if (changed || wasDirty != row.dirty)
+        journalRow(address, row);
+
+    // Clean addresses may never see a fetch, so check for completion here:
+    const bool dirty = row.dirty;
+    if (!dirty)
+        updateInternal();
+    return dirty;
 }
 
 void
@@ -362,24 +519,190 @@ AddressCache::status(const std::string &address, const AddressRow &row,
     out.needsCheck = out.nextCheck <= now;
     out.count = row.txids.size();
 
+    // `updateInternal` keeps the waiting list current,
+    // except for rows it has yet to look at:
     if (!row.complete)
-        out.missingTxids = txCache_.missingTxids(row.txids);
+    {
+        if (changedRows_.count(address))
+            out.missingTxids = txCache_.missingTxids(row.txids);
+        else
+            out.missingTxids = row.waiting;
+    }
 
     return out;
 }
 
+Status
+AddressCache::rowLoad(CacheReader &reader)
+{
+    std::string address;
+    uint8_t dirty;
+    uint64_t lastCheck;
+    AddressRow row;
+    ABC_CHECK(reader.readString(address));
+    ABC_CHECK(reader.readByte(dirty));
+    ABC_CHECK(reader.readNumber(lastCheck));
+    ABC_CHECK(reader.readString(row.stratumHash));
+
+    uint64_t txidsSize;
+    ABC_CHECK(reader.readSize(txidsSize));
+    for (uint64_t i = 0; i < txidsSize; i++)
+    {
+        bc::hash_digest txid;
+        ABC_CHECK(reader.readHash(txid));
+        row.txids.insert(bc::encode_hash(txid));
+    }
+
+    row.dirty = dirty;
+    row.lastCheck = lastCheck;
+    if (time(nullptr) < nextCheck(address, row))
+        row.checkedOnce = true;
+
+    rowReplace(address, row);
+    return Status();
+}
+
+void
+AddressCache::rowReplace(const std::string &address, const AddressRow &row)
+{
+    auto i = rows_.find(address);
+    if (rows_.end() != i)
+    {
+        rowUnwait(address, i->second);
+        for (const auto &txid: i->second.txids)
+            indexErase(txidRows_, txid, address);
+        schedule_.erase(std::make_pair(i->second.scheduled, address));
+    }
+
+    auto &out = rows_[address];
+    out = row;
+    out.waiting.clear();
+    for (const auto &txid: out.txids)
+        txidRows_[txid].insert(address);
+    changedRows_.insert(address);
+    rowSchedule(address, out);
+}
+
+bool
+AddressCache::rowInsertTxid(const std::string &address, AddressRow &row,
+                            const std::string &txid)
+{
+    // Even a known txid re-arms the row, so `onComplete` fires again:
+    const bool inserted = row.txids.insert(txid).second;
+    if (inserted)
+        txidRows_[txid].insert(address);
+    row.complete = false;
+    row.knownComplete = false;
+    changedRows_.insert(address);
+    incomplete_.insert(address);
+    return inserted;
+}
+
+bool
+AddressCache::rowEraseTxid(const std::string &address, AddressRow &row,
+                           const std::string &txid)
+{
+    if (!row.txids.erase(txid))
+        return false;
+    indexErase(txidRows_, txid, address);
+    changedRows_.insert(address);
+    return true;
+}
+
+void
+AddressCache::rowUnwait(const std::string &address, AddressRow &row)
+{
+    for (const auto &txid: row.waiting)
+        indexErase(waiting_, txid, address);
+    row.waiting.clear();
+}
+
+void
+AddressCache::rowSchedule(const std::string &address, AddressRow &row)
+{
+    if (row.dirty)
+        dirty_.insert(address);
+    else
+        dirty_.erase(address);
+
+    if (row.complete)
+        incomplete_.erase(address);
+    else
+        incomplete_.insert(address);
+
+    // Re-key the row, taking it out of the due set if it was there:
+    schedule_.erase(std::make_pair(row.scheduled, address));
+    due_.erase(address);
+    row.scheduled = nextCheck(address, row);
+    schedule_.insert(std::make_pair(row.scheduled, address));
+}
+
+void
+AddressCache::rowSave(CacheWriter &writer, const std::string &address,
+                      const AddressRow &row)
+{
+    std::vector<bc::hash_digest> txids;
+    for (const auto &txid: row.txids)
+    {
+        bc::hash_digest hash;
+        if (bc::decode_hash(hash, txid))
+            txids.push_back(hash);
+    }
+
+    writer.writeData(address);
+    writer.writeByte(row.dirty);
+    writer.writeNumber(row.lastCheck);
+    writer.writeData(row.stratumHash);
+    writer.writeSize(txids.size());
+    for (const auto &txid: txids)
+        writer.writeHash(txid);
+}
+
+void
+AddressCache::journalRow(const std::string &address, const AddressRow &row)
+{
+    if (!journal_ || row.sweep)
+        return;
+
+    CacheWriter record;
+    record.writeByte(CacheJournal::addressRow);
+    rowSave(record, address, row);
+    journal_->append(record);
+}
+
+void
+AddressCache::journalCheck(const std::string &address, const AddressRow &row)
+{
+    if (!journal_ || row.sweep)
+        return;
+
+    CacheWriter record;
+    record.writeByte(CacheJournal::addressCheck);
+    record.writeData(address);
+    record.writeByte(row.dirty);
+    record.writeNumber(row.lastCheck);
+    journal_->append(record);
+}
+
 void
 AddressCache::updateInternal()
 {
+    // The callbacks can re-enter, so take the work list up front:
+    AddressSet changed;
+    changed.swap(changedRows_);
+
     // Check for newly-completed transactions:
-    for (auto &row: rows_)
+    TxidSet completeTxids;
+    for (const auto &address: changed)
     {
         // Skip rows that are already complete:
-        if (row.second.complete)
+        auto &row = rows_[address];
+        if (row.complete)
             continue;
 
-        row.second.complete = true;
-        for (const auto &txid: row.second.txids)
+        rowUnwait(address, row);
+        row.complete = true;
+        for (const auto &txid: row.txids)
         {
             // Skip transactions we already know about:
             if (knownTxids_.count(txid))
@@ -387,29 +710,39 @@ AddressCache::updateInternal()
 
             if (txCache_.missing(txid))
             {
-                row.second.complete = false;
+                // Note what we need, so its arrival can wake us up:
+                auto needed = txCache_.missingTxids(TxidSet{txid});
+                if (needed.empty())
+                    needed.insert(txid);
+                for (const auto &need: needed)
+                    waiting_[need].insert(address);
+                row.waiting.insert(needed.begin(), needed.end());
+                row.complete = false;
                 continue;
             }
 
             // Don't notify the GUI about sweep transactions:
-            if (!row.second.sweep)
+            if (!row.sweep)
             {
                 knownTxids_.insert(txid);
-                if (onTx_)
-                    onTx_(txid);
+                completeTxids.insert(txid);
             }
         }
+        if (row.complete)
+            incomplete_.erase(address);
     }
+    if (onTx_ && !completeTxids.empty())
+        onTx_(completeTxids);
 
     // Check for newly-completed addresses:
-    for (auto &row: rows_)
+    for (const auto &address: changed)
     {
-        if (row.second.checkedOnce && row.second.complete
-                && !row.second.knownComplete)
+        auto &row = rows_[address];
+        if (row.checkedOnce && row.complete && !row.knownComplete)
         {
-            row.second.knownComplete = true;
+            row.knownComplete = true;
             if (onComplete_)
-                onComplete_(row.first);
+                onComplete_(address);
         }
     }
 }
@@ -13,9 +13,13 @@
 #include <time.h>
 #include <map>
 #include <mutex>
+#include <set>
 
 namespace abcd {
 
+class CacheJournal;
+class CacheReader;
+class CacheWriter;
 class JsonObject;
 class TxCache;
 struct TxInfo;
@@ -66,7 +70,7 @@ class AddressCache
 {
 public:
     typedef std::function<void ()> Callback;
-    typedef std::function<void (const std::string &txid)> TxidCallback;
+    typedef std::function<void (const TxidSet &txids)> TxidCallback;
     typedef std::function<void (const std::string &address)> CompleteCallback;
 
     // Lifetime ------------------------------------------------------------
@@ -80,16 +84,35 @@ public:
     clear();
 
     /**
-     * Reads the database contents from the provided cache JSON object.
+     * Reads the database contents from a binary cache file.
+     */
+    Status
+    load(CacheReader &reader);
+
+    /**
+     * Reads the database contents from the old cache JSON object.
      */
     Status
     load(JsonObject &json);
 
     /**
-     * Saves the database contents to the provided cache JSON object.
+     * Saves the database contents to a binary cache file.
+     */
+    void
+    save(CacheWriter &writer);
+
+    /**
+     * Applies an address record from the journal.
+     * Call `update` once all the records are in.
      */
     Status
-    save(JsonObject &json);
+    replay(uint8_t type, CacheReader &record);
+
+    /**
+     * Sets up a journal to record each change as it happens.
+     */
+    void
+    journalSet(CacheJournal *journal);
 
     // Queries -------------------------------------------------------------
 
@@ -101,8 +124,12 @@ public:
 
     /**
      * Returns the status of all unsynced addresses.
-     * @param sleep If there is no work to be performed,
-     * the number of seconds until the next time work will be available.
+     * Only dirty, incomplete, and due addresses are visited,
+     * so this does not slow down as the wallet grows.
+     * The missing transactions come from each row's waiting list,
+     * rather than a fresh pass over the transaction cache.
+     * @param sleep The number of seconds until the next check comes due,
+     * or zero if there are no future checks.
      */
     std::list<AddressStatus>
     statuses(time_t &sleep) const;
@@ -113,6 +140,12 @@ public:
     TxidSet
     txids() const;
 
+    /**
+     * Lists the addresses whose transaction lists include any of these.
+     */
+    AddressSet
+    txidAddresses(const TxidSet &txids) const;
+
     // Updates -------------------------------------------------------------
 
     /**
@@ -130,10 +163,20 @@ public:
 
     /**
      * Indicates that the transaction cache has been updated.
+     * This re-checks every incomplete address,
+     * so prefer `updateTx` when the new transaction is known.
      */
     void
     update();
 
+    /**
+     * Indicates that some transactions have arrived in the transaction cache.
+     * Only the addresses waiting on those transactions get re-checked,
+     * in a single pass no matter how many transactions there are.
+     */
+    void
+    updateTx(const TxidSet &txids);
+
     /**
      * Updates an address with a new list of relevant transactions.
      */
@@ -162,7 +205,10 @@ public:
 
     /**
      * Updates the state hash stored with the address.
-     * Returns true if the new hash differs from the old hash.
+     * A hash matching the one computed from our own history
+     * marks the address clean, even if the stored hash was different.
+     * A blank hash means the server has no history for the address.
+     * Returns true if the address needs to be fetched.
      */
     bool
     updateStratumHash(const std::string &address, const std::string &hash="");
@@ -176,6 +222,7 @@ public:
 
     /**
      * Provides a callback to be notified when new transactions are complete.
+     * Transactions that complete in the same pass arrive in a single call.
      */
     void
     onTxSet(const TxidCallback &onTx);
@@ -204,17 +251,41 @@ private:
         bool complete = false; // True if all txids are known to the GUI.
         bool knownComplete = false; // True if `onComplete` has been called.
         bool sweep = false; // True if we don't own this address
-
-        void
-        insertTxid(const std::string &txid)
-        {
-            txids.insert(txid);
-            complete = false;
-            knownComplete = false;
-        }
+        TxidSet waiting; // Missing txids holding up completion.
+        time_t scheduled = 0; // Our key in `schedule_`.
     };
     std::map<std::string, AddressRow> rows_;
 
+    /**
+     * Maps each txid to the addresses whose rows list it.
+     */
+    std::map<std::string, AddressSet> txidRows_;
+
+    /**
+     * Maps each missing txid, or missing input, to the incomplete rows
+     * waiting for it to show up in the transaction cache.
+     */
+    std::map<std::string, AddressSet> waiting_;
+
+    /**
+     * Rows whose completion state might have changed
+     * since the last `updateInternal`.
+     */
+    AddressSet changedRows_;
+
+    /**
+     * Upcoming checks, ordered by deadline.
+     * Once a check comes due, `statuses` moves its address to `due_`,
+     * where it stays until the check happens,
+     * so the front of the schedule is always the next deadline.
+     */
+    mutable std::set<std::pair<time_t, std::string>> schedule_;
+    mutable AddressSet due_;
+
+    /** Rows needing a fetch, or with transactions left to complete. */
+    AddressSet dirty_;
+    AddressSet incomplete_;
+
     /**
      * Transactions that are relevant, in the cache,
      * and that the GUI knows about.
@@ -224,6 +295,65 @@ private:
     Callback wakeupCallback_;
     TxidCallback onTx_;
     CompleteCallback onComplete_;
+    CacheJournal *journal_ = nullptr;
+
+    /**
+     * Reads a single address row, replacing any existing one.
+     */
+    Status
+    rowLoad(CacheReader &reader);
+
+    /**
+     * Installs a row, replacing any existing one and keeping the indexes
+     * up to date.
+     */
+    void
+    rowReplace(const std::string &address, const AddressRow &row);
+
+    /**
+     * Adds a txid to a row, marking the row as incomplete.
+     * @return false if the row already had the txid.
+     */
+    bool
+    rowInsertTxid(const std::string &address, AddressRow &row,
+                  const std::string &txid);
+
+    /**
+     * Removes a txid from a row.
+     * @return false if the row did not have the txid.
+     */
+    bool
+    rowEraseTxid(const std::string &address, AddressRow &row,
+                 const std::string &txid);
+
+    /**
+     * Forgets what a row was waiting on.
+     */
+    void
+    rowUnwait(const std::string &address, AddressRow &row);
+
+    /**
+     * Brings the scheduler up to date after a row's check time,
+     * dirty flag, or completion state changes.
+     */
+    void
+    rowSchedule(const std::string &address, AddressRow &row);
+
+    static void
+    rowSave(CacheWriter &writer, const std::string &address,
+            const AddressRow &row);
+
+    /**
+     * Records the new state of a row in the journal, if there is one.
+     */
+    void
+    journalRow(const std::string &address, const AddressRow &row);
+
+    /**
+     * Records a check that found nothing new, which is much smaller.
+     */
+    void
+    journalCheck(const std::string &address, const AddressRow &row);
 
     time_t
     nextCheck(const std::string &address, const AddressRow &row) const;
@@ -232,6 +362,10 @@ private:
     status(const std::string &address, const AddressRow &row,
            time_t now) const;
 
+    /**
+     * Checks the changed rows for newly-complete transactions and addresses,
+     * firing the callbacks.
+     */
     void
     updateInternal();
 };
@@ -6,44 +6,118 @@
  */
 
 #include "Cache.hpp"
+#include "CacheFile.hpp"
+#include "../Utility.hpp"
 #include "../../json/JsonObject.hpp"
 #include "../../util/FileIO.hpp"
+#include <algorithm>
+#include <limits>
 
 namespace abcd {
 
+constexpr uint64_t cacheMagic = 0x6568636163636261; // "abccache"
+constexpr uint64_t cacheVersion = 2;
+
+/**
+ * The journal is folded into a new snapshot once it grows larger than
+ * the snapshot itself, or this many bytes, whichever is bigger.
+ */
+constexpr size_t journalMinimum = 256 * 1024;
+
 Cache::Cache(const std::string &path, BlockCache &blockCache):
     txs(blockCache),
     blocks(blockCache),
     addresses(txs),
     path_(path),
-    addressCheckDone_(false)
+    addressCheckDone_(false),
+    journal_(path + ".journal"),
+    snapshotId_(0),
+    snapshotSize_(0)
 {
+    txs.journalSet(&journal_);
+    addresses.journalSet(&journal_);
 }
 
 void
 Cache::clear()
 {
+    std::lock_guard<std::mutex> lock(mutex_);
+
     blocks.clear();
     blocks.save();
     txs.clear();
-    save();
+    snapshot().log(); // Failure is fine
 }
 
 Status
 Cache::load()
+{
+    FileMap file;
+    ABC_CHECK(file.open(path_));
+    CacheReader reader(file.data());
+
+    uint64_t magic, version;
+    ABC_CHECK(reader.readNumber(magic));
+    if (cacheMagic != magic)
+        return ABC_ERROR(ABC_CC_ParseError, "Unknown cache file header");
+    ABC_CHECK(reader.readSize(version));
+    if (cacheVersion != version)
+        return ABC_ERROR(ABC_CC_ParseError, "Unknown cache file version");
+
+    uint64_t snapshotId;
+    uint8_t addressCheckDone;
+    ABC_CHECK(reader.readNumber(snapshotId));
+    ABC_CHECK(reader.readByte(addressCheckDone));
+    ABC_CHECK(txs.load(reader));
+    ABC_CHECK(addresses.load(reader));
+    if (!reader.done())
+        return ABC_ERROR(ABC_CC_ParseError, "Extra data in cache file");
+    addressCheckDone_ = addressCheckDone;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshotId_ = snapshotId;
+    snapshotSize_ = file.data().size();
+
+    // Apply the changes made since the snapshot:
+    auto onRecord = [this](CacheReader &record)
+    {
+        return replay(record);
+    };
+    Status s = journal_.load(snapshotId, onRecord);
+    addresses.update();
+
+    // Replaying adds its own records, which are already on disk:
+    journal_.discard();
+    if (!s.log())
+        ABC_CHECK(snapshot());
+
+    return Status();
+}
+
+Status
+Cache::loadJson(const std::string &path)
 {
     JsonObject cacheJson;
-    ABC_CHECK(cacheJson.load(path_));
+    ABC_CHECK(cacheJson.load(path));
     ABC_CHECK(txs.load(cacheJson));
     ABC_CHECK(addresses.load(cacheJson));
     addressCheckDoneLoad(cacheJson);
+
+    // The first save will write a snapshot with everything:
+    journal_.discard();
     return Status();
 }
 
 void
 Cache::addressCheckDoneSet()
 {
+    if (addressCheckDone_)
+        return;
     addressCheckDone_ = true;
+
+    CacheWriter record;
+    record.writeByte(CacheJournal::addressCheckDone);
+    journal_.append(record);
 }
 
 bool
@@ -58,12 +132,6 @@ Cache::addressCheckDoneLoad(JsonObject &json)
     addressCheckDone_ = json.getBoolean("addressCheckDone", false);
 }
 
-Status
-Cache::addressCheckDoneSave(JsonObject &json)
-{
-    return json.set("addressCheckDone", addressCheckDone_);
-}
-
 Status
 Cache::loadLegacy(const std::string &path)
 {
@@ -138,18 +206,106 @@ Cache::loadLegacy(const std::string &path)
             addresses.updateSpend(info);
     }
 
+    // The first save will write a snapshot with everything:
+    journal_.discard();
     return Status();
 }
 
 Status
 Cache::save()
 {
-    JsonObject cacheJson;
-    ABC_CHECK(txs.save(cacheJson));
-    ABC_CHECK(addresses.save(cacheJson));
-    ABC_CHECK(addressCheckDoneSave(cacheJson));
-    ABC_CHECK(cacheJson.save(path_));
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // The journal only makes sense on top of a snapshot:
+    if (!journal_.ready())
+        return snapshot();
+
+    ABC_CHECK(journal_.flush());
+    if (std::max(snapshotSize_, journalMinimum) < journal_.size())
+        return snapshot();
+
     return Status();
 }
 
+Status
+Cache::snapshot()
+{
+    const uint64_t snapshotId = snapshotId_ ? snapshotId_ + 1 : time(nullptr);
+
+    // Everything queued so far will be in the snapshot:
+    DataChunk covered = journal_.take();
+
+    CacheWriter writer;
+    writer.writeNumber(cacheMagic);
+    writer.writeSize(cacheVersion);
+    writer.writeNumber(snapshotId);
+    writer.writeByte(addressCheckDone_);
+    txs.save(writer);
+    addresses.save(writer);
+    // The old journal stays valid until the new snapshot is safely on disk,
+    // so if the write fails, the covered records go back in its queue:
+    Status s = fileSaveSync(writer.data(), path_);
+    if (!s)
+    {
+        journal_.restore(std::move(covered));
+        return s;
+    }
+    snapshotId_ = snapshotId;
+    snapshotSize_ = writer.data().size();
+
+    // Changes made while we were writing stay queued for the new journal:
+    return journal_.reset(snapshotId);
+}
+
+Status
+Cache::replay(CacheReader &record)
+{
+    uint8_t type;
+    ABC_CHECK(record.readByte(type));
+
+    switch (type)
+    {
+    case CacheJournal::txInsert:
+    {
+        DataSlice rawTx;
+        bc::transaction_type tx;
+        ABC_CHECK(record.readData(rawTx));
+        ABC_CHECK(decodeTx(tx, rawTx));
+        txs.insert(tx);
+        return Status();
+    }
+
+    case CacheJournal::txHeight:
+    {
+        bc::hash_digest txid;
+        uint64_t height, firstSeen;
+        ABC_CHECK(record.readHash(txid));
+        ABC_CHECK(record.readNumber(height));
+        ABC_CHECK(record.readNumber(firstSeen));
+        txs.confirmed(bc::encode_hash(txid), height, firstSeen);
+        return Status();
+    }
+
+    case CacheJournal::txDrop:
+    {
+        // The drop already passed its age check when it was recorded:
+        bc::hash_digest txid;
+        ABC_CHECK(record.readHash(txid));
+        txs.drop(bc::encode_hash(txid), std::numeric_limits<time_t>::max());
+        return Status();
+    }
+
+    case CacheJournal::addressRow:
+    case CacheJournal::addressCheck:
+        return addresses.replay(type, record);
+
+    case CacheJournal::addressCheckDone:
+        addressCheckDone_ = true;
+        return Status();
+
+    default:
+        return ABC_ERROR(ABC_CC_ParseError, "Unknown journal record");
+    }
+}
+
 } // namespace abcd
@@ -10,6 +10,7 @@
 
 #include "AddressCache.hpp"
 #include "BlockCache.hpp"
+#include "CacheFile.hpp"
 #include "TxCache.hpp"
 
 namespace abcd {
@@ -51,6 +52,12 @@ public:
     Status
     load();
 
+    /**
+     * Loads the cache from the older JSON format.
+     */
+    Status
+    loadJson(const std::string &path);
+
     /**
      * Loads the cache from the legacy format.
      */
@@ -58,7 +65,9 @@ public:
     loadLegacy(const std::string &path);
 
     /**
-     * Saves the cache to disk.
+     * Writes any changes to disk.
+     * This normally just appends to the journal,
+     * but rewrites the full snapshot once the journal gets too big.
      */
     Status
     save();
@@ -66,19 +75,31 @@ public:
 private:
 
     /**
-     * Save the status of addressCheckDone in the cache
+     * Load the status of addressCheckDone from the cache
+     */
+    void
+    addressCheckDoneLoad(JsonObject &json);
+
+    /**
+     * Writes a full snapshot of the cache and starts a new journal.
+     * Call with the mutex held.
      */
     Status
-    addressCheckDoneSave(JsonObject &json);
+    snapshot();
 
     /**
-     * Load the status of addressCheckDone from the cache
+     * Applies a change record from the journal.
      */
-    void
-    addressCheckDoneLoad(JsonObject &json);
+    Status
+    replay(CacheReader &record);
 
     const std::string path_;
     bool addressCheckDone_;
+
+    std::mutex mutex_;
+    CacheJournal journal_;
+    uint64_t snapshotId_;
+    size_t snapshotSize_;
 };
 
 } // namespace abcd
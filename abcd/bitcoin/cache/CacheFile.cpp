@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "CacheFile.hpp"
+#include "../../util/Debug.hpp"
+#include "../../util/FileIO.hpp"
+
+namespace abcd {
+
+constexpr uint64_t journalMagic = 0x6c6e726a63636261; // "abccjrnl"
+
+/**
+ * Guards each journal record against torn writes.
+ */
+static uint64_t
+recordChecksum(DataSlice record)
+{
+    const auto hash = bc::sha256_hash(bc::data_chunk(record.begin(),
+                                      record.end()));
+    return bc::from_little_endian_unsafe<uint64_t>(hash.begin());
+}
+
+void
+CacheWriter::writeByte(uint8_t value)
+{
+    data_.push_back(value);
+}
+
+void
+CacheWriter::writeNumber(uint64_t value)
+{
+    for (size_t i = 0; i < 8; ++i)
+        data_.push_back(static_cast<uint8_t>(value >> 8 * i));
+}
+
+void
+CacheWriter::writeSize(uint64_t value)
+{
+    if (value < 0xfd)
+    {
+        writeByte(value);
+    }
+    else if (value <= 0xffff)
+    {
+        writeByte(0xfd);
+        writeByte(value);
+        writeByte(value >> 8);
+    }
+    else if (value <= 0xffffffff)
+    {
+        writeByte(0xfe);
+        for (size_t i = 0; i < 4; ++i)
+            writeByte(value >> 8 * i);
+    }
+    else
+    {
+        writeByte(0xff);
+        writeNumber(value);
+    }
+}
+
+void
+CacheWriter::writeHash(const bc::hash_digest &value)
+{
+    data_.insert(data_.end(), value.begin(), value.end());
+}
+
+void
+CacheWriter::writeData(DataSlice value)
+{
+    writeSize(value.size());
+    data_.insert(data_.end(), value.begin(), value.end());
+}
+
+CacheReader::CacheReader(DataSlice data):
+    i_(data.begin()),
+    end_(data.end())
+{
+}
+
+bool
+CacheReader::done() const
+{
+    return end_ == i_;
+}
+
+size_t
+CacheReader::remaining() const
+{
+    return end_ - i_;
+}
+
+Status
+CacheReader::readByte(uint8_t &result)
+{
+    DataSlice bytes;
+    ABC_CHECK(readBytes(bytes, 1));
+    result = bytes.data()[0];
+    return Status();
+}
+
+Status
+CacheReader::readNumber(uint32_t &result)
+{
+    DataSlice bytes;
+    ABC_CHECK(readBytes(bytes, 4));
+    result = bc::from_little_endian_unsafe<uint32_t>(bytes.begin());
+    return Status();
+}
+
+Status
+CacheReader::readNumber(uint64_t &result)
+{
+    DataSlice bytes;
+    ABC_CHECK(readBytes(bytes, 8));
+    result = bc::from_little_endian_unsafe<uint64_t>(bytes.begin());
+    return Status();
+}
+
+Status
+CacheReader::readSize(uint64_t &result)
+{
+    uint8_t prefix;
+    ABC_CHECK(readByte(prefix));
+
+    size_t width = 0;
+    switch (prefix)
+    {
+    case 0xfd:
+        width = 2;
+        break;
+    case 0xfe:
+        width = 4;
+        break;
+    case 0xff:
+        width = 8;
+        break;
+    default:
+        result = prefix;
+        return Status();
+    }
+
+    DataSlice bytes;
+    ABC_CHECK(readBytes(bytes, width));
+    result = 0;
+    for (size_t i = 0; i < width; ++i)
+        result |= static_cast<uint64_t>(bytes.data()[i]) << 8 * i;
+    return Status();
+}
+
+Status
+CacheReader::readHash(bc::hash_digest &result)
+{
+    DataSlice bytes;
+    ABC_CHECK(readBytes(bytes, result.size()));
+    std::copy(bytes.begin(), bytes.end(), result.begin());
+    return Status();
+}
+
+Status
+CacheReader::readBytes(DataSlice &result, size_t size)
+{
+    if (remaining() < size)
+        return ABC_ERROR(ABC_CC_ParseError, "Truncated cache file");
+
+    result = DataSlice(i_, i_ + size);
+    i_ += size;
+    return Status();
+}
+
+Status
+CacheReader::readData(DataSlice &result)
+{
+    uint64_t size;
+    ABC_CHECK(readSize(size));
+    return readBytes(result, size);
+}
+
+Status
+CacheReader::readString(std::string &result)
+{
+    DataSlice data;
+    ABC_CHECK(readData(data));
+    result = toString(data);
+    return Status();
+}
+
+CacheJournal::CacheJournal(const std::string &path):
+    path_(path)
+{
+}
+
+void
+CacheJournal::append(const CacheWriter &record)
+{
+    CacheWriter frame;
+    frame.writeData(record.data());
+    frame.writeNumber(recordChecksum(record.data()));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.insert(pending_.end(), frame.data().begin(), frame.data().end());
+}
+
+void
+CacheJournal::discard()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.clear();
+}
+
+DataChunk
+CacheJournal::take()
+{
+    DataChunk out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.swap(pending_);
+    return out;
+}
+
+void
+CacheJournal::restore(DataChunk records)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    records.insert(records.end(), pending_.begin(), pending_.end());
+    pending_.swap(records);
+}
+
+size_t
+CacheJournal::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+}
+
+bool
+CacheJournal::ready() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return snapshotId_;
+}
+
+Status
+CacheJournal::load(uint64_t snapshotId, const RecordCallback &onRecord)
+{
+    FileMap file;
+    ABC_CHECK(file.open(path_));
+    CacheReader reader(file.data());
+
+    uint64_t magic, id;
+    ABC_CHECK(reader.readNumber(magic));
+    ABC_CHECK(reader.readNumber(id));
+    if (journalMagic != magic)
+        return ABC_ERROR(ABC_CC_ParseError, "Unknown journal header");
+    if (snapshotId != id)
+        return ABC_ERROR(ABC_CC_ParseError, "Journal is for a different snapshot");
+
+    // Replay records until the end, or until one is incomplete:
+    auto end = file.data().end() - reader.remaining();
+    while (!reader.done())
+    {
+        DataSlice record;
+        uint64_t checksum;
+        if (!reader.readData(record) || !reader.readNumber(checksum) ||
+                recordChecksum(record) != checksum)
+            break;
+
+        CacheReader recordReader(record);
+        ABC_CHECK(onRecord(recordReader));
+        end = file.data().end() - reader.remaining();
+    }
+
+    // Cut off any damage so new records stay reachable:
+    const auto valid = DataSlice(file.data().begin(), end);
+    if (valid.size() != file.data().size())
+    {
+        ABC_DebugLog("Dropping %zu damaged bytes from %s",
+                     file.data().size() - valid.size(), path_.c_str());
+        ABC_CHECK(fileSaveSync(valid, path_));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshotId_ = snapshotId;
+    size_ = valid.size();
+    return Status();
+}
+
+Status
+CacheJournal::flush()
+{
+    DataChunk data;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!snapshotId_)
+            return ABC_ERROR(ABC_CC_Error, "The journal has no snapshot");
+        data.swap(pending_);
+    }
+    if (data.empty())
+        return Status();
+
+    // Put the records back if the write fails, so nothing is lost:
+    Status s = fileAppend(data, path_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!s)
+    {
+        data.insert(data.end(), pending_.begin(), pending_.end());
+        pending_.swap(data);
+        return s;
+    }
+    size_ += data.size();
+    return Status();
+}
+
+Status
+CacheJournal::reset(uint64_t snapshotId)
+{
+    CacheWriter header;
+    header.writeNumber(journalMagic);
+    header.writeNumber(snapshotId);
+    ABC_CHECK(fileSaveSync(header.data(), path_));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshotId_ = snapshotId;
+        size_ = header.data().size();
+    }
+
+    return flush();
+}
+
+} // namespace abcd
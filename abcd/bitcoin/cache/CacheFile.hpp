@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * Helpers for the binary on-disk cache format.
+ */
+
+#ifndef ABCD_BITCOIN_CACHE_CACHE_FILE_HPP
+#define ABCD_BITCOIN_CACHE_CACHE_FILE_HPP
+
+#include "../../util/Data.hpp"
+#include "../../util/Status.hpp"
+#include <bitcoin/bitcoin.hpp>
+#include <functional>
+#include <mutex>
+
+namespace abcd {
+
+/**
+ * Builds a binary cache file in memory.
+ * Integers are little-endian, and sizes use the Bitcoin variable-length
+ * encoding, so the file can be read back in place without any decoding.
+ */
+class CacheWriter
+{
+public:
+    const DataChunk &data() const { return data_; }
+
+    void
+    writeByte(uint8_t value);
+
+    void
+    writeNumber(uint64_t value);
+
+    void
+    writeSize(uint64_t value);
+
+    void
+    writeHash(const bc::hash_digest &value);
+
+    /**
+     * Writes a length-prefixed blob of data.
+     */
+    void
+    writeData(DataSlice value);
+
+private:
+    DataChunk data_;
+};
+
+/**
+ * Reads fields out of a binary cache file.
+ * The returned data slices point into the original buffer,
+ * so it must outlive the reader and its results.
+ */
+class CacheReader
+{
+public:
+    CacheReader(DataSlice data);
+
+    /**
+     * Returns true once the entire buffer has been consumed.
+     */
+    bool
+    done() const;
+
+    /**
+     * Returns the number of bytes left to read.
+     */
+    size_t
+    remaining() const;
+
+    Status
+    readByte(uint8_t &result);
+
+    Status
+    readNumber(uint32_t &result);
+
+    Status
+    readNumber(uint64_t &result);
+
+    Status
+    readSize(uint64_t &result);
+
+    Status
+    readHash(bc::hash_digest &result);
+
+    /**
+     * Reads a fixed-size blob of data.
+     */
+    Status
+    readBytes(DataSlice &result, size_t size);
+
+    /**
+     * Reads a length-prefixed blob of data.
+     */
+    Status
+    readData(DataSlice &result);
+
+    /**
+     * Reads a length-prefixed blob of data as a string.
+     */
+    Status
+    readString(std::string &result);
+
+private:
+    const uint8_t *i_;
+    const uint8_t *end_;
+};
+
+/**
+ * An append-only log of changes made since the last cache snapshot.
+ * Records are queued in memory as the caches change,
+ * and reach the disk in batches when the journal is flushed.
+ */
+class CacheJournal
+{
+public:
+    enum RecordType: uint8_t
+    {
+        txInsert = 1,
+        txHeight = 2,
+        txDrop = 3,
+        addressRow = 4,
+        addressCheck = 5,
+        addressCheckDone = 6
+    };
+
+    typedef std::function<Status (CacheReader &record)> RecordCallback;
+
+    CacheJournal(const std::string &path);
+
+    /**
+     * Queues a change record for the next flush.
+     */
+    void
+    append(const CacheWriter &record);
+
+    /**
+     * Drops any queued records, such as the ones produced while loading.
+     */
+    void
+    discard();
+
+    /**
+     * Removes the queued records and hands them to the caller,
+     * such as when a snapshot is about to cover them.
+     */
+    DataChunk
+    take();
+
+    /**
+     * Puts records from `take` back in the queue,
+     * ahead of any queued since, such as when a snapshot fails.
+     */
+    void
+    restore(DataChunk records);
+
+    /**
+     * Returns the number of bytes the journal occupies on disk.
+     */
+    size_t
+    size() const;
+
+    /**
+     * Returns true if the journal follows a snapshot on disk.
+     */
+    bool
+    ready() const;
+
+    /**
+     * Reads the journal written after the given snapshot,
+     * passing each record to the callback in order.
+     * A torn record at the end, left by a crash, is cut off.
+     */
+    Status
+    load(uint64_t snapshotId, const RecordCallback &onRecord);
+
+    /**
+     * Appends the queued records to the disk and waits for them to land.
+     */
+    Status
+    flush();
+
+    /**
+     * Starts an empty journal following the given snapshot.
+     * Any records queued in the meantime are carried over.
+     */
+    Status
+    reset(uint64_t snapshotId);
+
+private:
+    mutable std::mutex mutex_;
+    const std::string path_;
+    uint64_t snapshotId_ = 0;
+    size_t size_ = 0;
+    DataChunk pending_;
+};
+
+} // namespace abcd
+
+#endif
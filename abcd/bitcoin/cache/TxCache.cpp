@@ -7,33 +7,13 @@
 
 #include "TxCache.hpp"
 #include "BlockCache.hpp"
+#include "CacheFile.hpp"
 #include "../Utility.hpp"
 #include "../../crypto/Encoding.hpp"
 #include "../../json/JsonArray.hpp"
 #include "../../json/JsonObject.hpp"
 #include "../../util/Debug.hpp"
-#include <unordered_set>
-
-namespace std {
-
-/**
- * Allows `bc::point_type` to be used with `std::unordered_set`.
- */
-template<> struct hash<bc::point_type>
-{
-    typedef bc::point_type argument_type;
-    typedef std::size_t result_type;
-
-    result_type
-    operator()(argument_type const &p) const
-    {
-        auto h = libbitcoin::from_little_endian_unsafe<result_type>(
-                     p.hash.begin());
-        return h ^ p.index;
-    }
-};
-
-} // namespace std
+#include <algorithm>
 
 namespace abcd {
 
@@ -55,84 +35,183 @@ filterOutputs(const TxOutputList &utxos, bool filter)
     return out;
 }
 
-typedef std::unordered_set<bc::point_type> PointSet;
+constexpr unsigned problemDoubleSpent = 1 << 0;
+constexpr unsigned problemReplaceByFee = 1 << 1;
+
+constexpr size_t decodedLimitDefault = 256;
+constexpr size_t arenaGarbageMinimum = 1024 * 1024;
 
 /**
- * Knows how to check a transaction for double-spends and other problems.
- * This uses a memoized recursive function to do the graph search,
- * so the more checks this object performs,
- * the faster those checks can potentially become (for a fixed graph).
+ * Returns the address an output script pays to,
+ * or an invalid address if it has none.
+ * Nothing gets base58-encoded here.
  */
-class TxGraph
+static bc::payment_address
+scriptAddress(DataSlice script)
 {
-public:
-    static constexpr unsigned doubleSpent = 1 << 0;
-    static constexpr unsigned replaceByFee = 1 << 1;
+    const uint8_t *s = script.data();
+    bc::payment_address address;
+    bc::short_hash hash;
 
-    TxGraph(const TxCache &cache):
-        cache_(cache)
+    // The standard templates are simple enough to match directly:
+    if (25 == script.size() && 0x76 == s[0] && 0xa9 == s[1] &&
+            20 == s[2] && 0x88 == s[23] && 0xac == s[24])
     {
-        for (auto &row: cache_.txs_)
-        {
-            for (auto &input: row.second.inputs)
-            {
-                if (!spends_.insert(input.previous_output).second)
-                    doubleSpends_.insert(input.previous_output);
-            }
-        }
+        std::copy(s + 3, s + 23, hash.begin());
+        bc::set_public_key_hash(address, hash);
+        return address;
+    }
+    if (23 == script.size() && 0xa9 == s[0] && 20 == s[1] && 0x87 == s[22])
+    {
+        std::copy(s + 2, s + 22, hash.begin());
+        bc::set_script_hash(address, hash);
+        return address;
     }
 
-    /**
-     * Returns true if the output point has been spent from.
-     */
-    bool isSpent(bc::output_point point)
+    // Anything else goes through the full script parser:
+    if (!bc::extract(address, bc::parse_script(bc::to_data_chunk(script))))
+        return bc::payment_address();
+    return address;
+}
+
+static bool
+addressValid(const AddressKey &address)
+{
+    return bc::payment_address::invalid_version != address.version;
+}
+
+/**
+ * Returns the base58 form of an address, or a blank string if it has none.
+ */
+static std::string
+addressEncode(const AddressKey &address)
+{
+    if (!addressValid(address))
+        return std::string();
+    return bc::payment_address(address.version, address.hash).encoded();
+}
+
+/**
+ * Returns the binary form of an address, or an invalid key if it is bad.
+ */
+static AddressKey
+addressDecode(const std::string &address)
+{
+    AddressKey out;
+    bc::payment_address decoded;
+    if (decoded.set_encoded(address))
     {
-        return spends_.count(point);
+        out.version = decoded.version();
+        out.hash = decoded.hash();
     }
+    return out;
+}
 
-    /**
-     * Recursively checks the transaction graph for problems.
-     * @return A bitfield containing problem flags.
-     */
-    unsigned
-    problems(const std::string &txid)
+/**
+ * The parts of a serialized transaction that the indexes care about.
+ * The scripts point into the serialized data, so nothing gets decoded.
+ */
+struct RawOutput
+{
+    uint64_t value;
+    DataSlice script;
+};
+
+struct RawTx
+{
+    std::vector<bc::output_point> inputs;
+    std::vector<RawOutput> outputs;
+
+    /// Where each input script sits, including its length prefix.
+    std::vector<std::pair<size_t, size_t>> inputScripts;
+    bool replaceByFee = false;
+};
+
+static Status
+rawScan(RawTx &result, DataSlice rawTx)
+{
+    CacheReader reader(rawTx);
+    RawTx out;
+    uint32_t version, locktime;
+    ABC_CHECK(reader.readNumber(version));
+
+    uint64_t inputs;
+    ABC_CHECK(reader.readSize(inputs));
+    out.inputs.reserve(std::min<uint64_t>(inputs, rawTx.size()));
+    for (uint64_t i = 0; i < inputs; ++i)
     {
-        // Just use the previous result if we have been here before:
-        auto vi = visited_.find(txid);
-        if (visited_.end() != vi)
-            return vi->second;
+        bc::output_point point;
+        DataSlice script;
+        uint32_t sequence;
+        ABC_CHECK(reader.readHash(point.hash));
+        ABC_CHECK(reader.readNumber(point.index));
+        const size_t scriptBegin = rawTx.size() - reader.remaining();
+        ABC_CHECK(reader.readData(script));
+        const size_t scriptEnd = rawTx.size() - reader.remaining();
+        ABC_CHECK(reader.readNumber(sequence));
+        out.inputs.push_back(point);
+        out.inputScripts.emplace_back(scriptBegin, scriptEnd);
+
+        // Same test as `isReplaceByFee`:
+        if (sequence < 0xffffffff - 1)
+            out.replaceByFee = true;
+    }
 
-        // We have to assume missing transactions are safe:
-        auto i = cache_.txs_.find(txid);
-        if (cache_.txs_.end() == i)
-            return (visited_[txid] = 0);
+    uint64_t outputs;
+    ABC_CHECK(reader.readSize(outputs));
+    out.outputs.reserve(std::min<uint64_t>(outputs, rawTx.size()));
+    for (uint64_t i = 0; i < outputs; ++i)
+    {
+        RawOutput output;
+        ABC_CHECK(reader.readNumber(output.value));
+        ABC_CHECK(reader.readData(output.script));
+        out.outputs.push_back(output);
+    }
 
-        // Confirmed transactions are also safe:
-        if (cache_.txidHeight(txid))
-            return (visited_[txid] = 0);
+    ABC_CHECK(reader.readNumber(locktime));
+    if (!reader.done())
+        return ABC_ERROR(ABC_CC_ParseError, "Bad transaction format");
 
-        // Check for the opt-in replace-by-fee flag:
-        unsigned out = 0;
-        if (isReplaceByFee(i->second))
-            out |= replaceByFee;
+    result = std::move(out);
+    return Status();
+}
 
-        // Recursively check all the inputs:
-        for (const auto &input: i->second.inputs)
-        {
-            out |= problems(bc::encode_hash(input.previous_output.hash));
-            if (doubleSpends_.count(input.previous_output))
-                out |= doubleSpent;
-        }
-        return (visited_[txid] = out);
+/**
+ * Same as `makeNtxid`, but working directly on the serialized bytes.
+ * Blanking a script leaves a lone zero-length prefix in its place.
+ */
+static bc::hash_digest
+rawNtxid(DataSlice rawTx, const RawTx &scan)
+{
+    DataChunk data;
+    data.reserve(rawTx.size() + 4);
+
+    auto start = rawTx.begin();
+    for (const auto &script: scan.inputScripts)
+    {
+        data.insert(data.end(), start, rawTx.begin() + script.first);
+        data.push_back(0);
+        start = rawTx.begin() + script.second;
     }
+    data.insert(data.end(), start, rawTx.end());
 
-private:
-    const TxCache &cache_;
+    const auto hashType = bc::to_little_endian<uint32_t>(bc::sighash::all);
+    data.insert(data.end(), hashType.begin(), hashType.end());
+    return bc::bitcoin_hash(data);
+}
 
-    PointSet spends_;
-    PointSet doubleSpends_;
-    std::map<std::string, unsigned> visited_;
-};
+/**
+ * Converts a txid from the string-based API into the internal key format.
+ * Malformed txids map to the null hash, which never matches a real tx.
+ */
+static bc::hash_digest
+txidDecode(const std::string &txid)
+{
+    bc::hash_digest out;
+    if (!bc::decode_hash(out, txid))
+        return bc::null_hash;
+    return out;
+}
 
 struct CacheJson:
     public JsonObject
@@ -164,7 +243,8 @@ struct HeightJson:
 
 
 TxCache::TxCache(BlockCache &blockCache):
-    blocks_(blockCache)
+    blocks_(blockCache),
+    decodedLimit_(decodedLimitDefault)
 {
 }
 
@@ -173,7 +253,54 @@ TxCache::clear()
 {
     std::lock_guard<std::mutex> lock(mutex_);
     txs_.clear();
+    arena_.clear();
+    arenaGarbage_ = 0;
+    decoded_.clear();
+    decodedIndex_.clear();
     heights_.clear();
+    spends_.clear();
+    problems_.clear();
+    utxos_.clear();
+    unconfirmed_.clear();
+}
+
+Status
+TxCache::load(CacheReader &reader)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Tx data:
+    uint64_t txsSize;
+    ABC_CHECK(reader.readSize(txsSize));
+    for (uint64_t i = 0; i < txsSize; i++)
+    {
+        bc::hash_digest txid;
+        DataSlice rawTx;
+        ABC_CHECK(reader.readHash(txid));
+        ABC_CHECK(reader.readData(rawTx));
+        ABC_CHECK(arenaInsert(txid, rawTx));
+    }
+
+    // Heights:
+    uint64_t heightsSize;
+    ABC_CHECK(reader.readSize(heightsSize));
+    for (uint64_t i = 0; i < heightsSize; i++)
+    {
+        bc::hash_digest txid;
+        uint64_t height, firstSeen;
+        ABC_CHECK(reader.readHash(txid));
+        ABC_CHECK(reader.readNumber(height));
+        ABC_CHECK(reader.readNumber(firstSeen));
+
+        HeightInfo info;
+        info.height = height;
+        info.firstSeen = firstSeen;
+        heights_[txid] = info;
+        blocks_.headerNeededAdd(info.height);
+    }
+
+    indexRebuild();
+    return Status();
 }
 
 Status
@@ -188,14 +315,13 @@ TxCache::load(JsonObject &json)
     for (size_t i = 0; i < txsSize; i++)
     {
         TxJson txJson(txsJson[i]);
-        if (txJson.txidOk() && txJson.dataOk())
+        bc::hash_digest txid;
+        if (txJson.txidOk() && txJson.dataOk() &&
+                bc::decode_hash(txid, txJson.txid()))
         {
             DataChunk rawTx;
             ABC_CHECK(base64Decode(rawTx, txJson.data()));
-            bc::transaction_type tx;
-            ABC_CHECK(decodeTx(tx, rawTx));
-
-            txs_[txJson.txid()] = std::move(tx);
+            ABC_CHECK(arenaInsert(txid, rawTx));
         }
     }
 
@@ -205,119 +331,135 @@ TxCache::load(JsonObject &json)
     for (size_t i = 0; i < heightsSize; i++)
     {
         HeightJson heightJson(heightsJson[i]);
-        if (heightJson.txidOk())
+        bc::hash_digest txid;
+        if (heightJson.txidOk() && bc::decode_hash(txid, heightJson.txid()))
         {
             HeightInfo info;
             info.height = heightJson.height();
             info.firstSeen = heightJson.firstSeen();
-            heights_[heightJson.txid()] = info;
+            heights_[txid] = info;
             blocks_.headerNeededAdd(info.height);
         }
     }
 
+    indexRebuild();
     return Status();
 }
 
-Status
-TxCache::save(JsonObject &json)
+void
+TxCache::save(CacheWriter &writer)
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    CacheJson cacheJson(json);
 
     // Tx data:
-    JsonArray txsJson;
+    writer.writeSize(txs_.size());
     for (const auto &tx: txs_)
     {
-        bc::data_chunk rawTx(satoshi_raw_size(tx.second));
-        bc::satoshi_save(tx.second, rawTx.begin());
-
-        TxJson txJson;
-        ABC_CHECK(txJson.txidSet(tx.first));
-        ABC_CHECK(txJson.dataSet(base64Encode(rawTx)));
-        ABC_CHECK(txsJson.append(txJson));
+        writer.writeHash(tx.first);
+        writer.writeData(raw(tx.second));
     }
-    cacheJson.txsSet(txsJson);
 
     // Heights:
-    JsonArray heightsJson;
+    writer.writeSize(heights_.size());
     for (const auto &height: heights_)
     {
-        HeightJson heightJson;
-        ABC_CHECK(heightJson.txidSet(height.first));
-        if (height.second.height)
-            ABC_CHECK(heightJson.heightSet(height.second.height));
-        ABC_CHECK(heightJson.firstSeenSet(height.second.firstSeen));
-        ABC_CHECK(heightsJson.append(heightJson));
+        writer.writeHash(height.first);
+        writer.writeNumber(height.second.height);
+        writer.writeNumber(height.second.firstSeen);
     }
-    cacheJson.heightsSet(heightsJson);
+}
 
-    return Status();
+void
+TxCache::journalSet(CacheJournal *journal)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    journal_ = journal;
+}
+
+void
+TxCache::decodedLimitSet(size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    decodedLimit_ = limit;
+    while (decodedLimit_ < decoded_.size())
+    {
+        decodedIndex_.erase(decoded_.back().first);
+        decoded_.pop_back();
+    }
 }
 
 Status
 TxCache::get(bc::transaction_type &result, const std::string &txid) const
 {
     std::lock_guard<std::mutex> lock(mutex_);
-
-    auto i = txs_.find(txid);
-    if (txs_.end() == i)
-        return ABC_ERROR(ABC_CC_Synchronizing, "Cannot find transaction");
-
-    result = i->second;
-    return Status();
+    return decode(result, txidDecode(txid));
 }
 
 Status
 TxCache::info(TxInfo &result, const bc::transaction_type &tx) const
 {
+    bc::data_chunk rawTx(satoshi_raw_size(tx));
+    bc::satoshi_save(tx, rawTx.begin());
+    TxRow row;
+    ABC_CHECK(rowScan(row, rawTx));
+
     std::lock_guard<std::mutex> lock(mutex_);
-    ABC_CHECK(infoInternal(result, tx));
+    ABC_CHECK(infoInternal(result, bc::hash_transaction(tx), makeNtxid(tx),
+                           row));
     return Status();
 }
 
 Status
 TxCache::info(TxInfo &result, const std::string &txid) const
 {
-    bc::transaction_type tx;
-    ABC_CHECK(get(tx, txid));
-    ABC_CHECK(info(result, tx));
-    return Status();
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto hash = txidDecode(txid);
+
+    auto i = txs_.find(hash);
+    if (txs_.end() == i)
+        return ABC_ERROR(ABC_CC_Synchronizing, "Cannot find transaction");
+
+    ABC_CHECK(ntxid(i->second));
+
+    return infoInternal(result, hash, i->second.ntxid, i->second);
 }
 
 Status
-TxCache::infoInternal(TxInfo &result, const bc::transaction_type &tx) const
+TxCache::infoInternal(TxInfo &result, const bc::hash_digest &txid,
+                      const bc::hash_digest &ntxid, const TxRow &row) const
 {
     TxInfo out;
     int64_t totalIn = 0, totalOut = 0;
 
     // Basic info:
-    out.txid = bc::encode_hash(bc::hash_transaction(tx));
-    out.ntxid = bc::encode_hash(makeNtxid(tx));
+    out.txid = bc::encode_hash(txid);
+    out.ntxid = bc::encode_hash(ntxid);
 
     // Scan inputs:
-    for (const auto &input: tx.inputs)
+    for (const auto &input: row.inputs)
     {
-        const auto txid = bc::encode_hash(input.previous_output.hash);
-        auto i = txs_.find(txid);
+        auto i = txs_.find(input.hash);
         if (txs_.end() == i)
-            return ABC_ERROR(ABC_CC_Synchronizing, "Missing input " + txid);
-        if (i->second.outputs.size() <= input.previous_output.index)
-            return ABC_ERROR(ABC_CC_Error, "Impossible input on " + txid);
-        auto &output = i->second.outputs[input.previous_output.index];
+            return ABC_ERROR(ABC_CC_Synchronizing,
+                             "Missing input " + bc::encode_hash(input.hash));
+
+        const auto &parent = i->second;
+        if (parent.outputs.size() <= input.index)
+            return ABC_ERROR(ABC_CC_Error,
+                             "Impossible input on " + bc::encode_hash(input.hash));
+        const auto &output = parent.outputs[input.index];
 
         totalIn += output.value;
-        bc::payment_address address;
-        bc::extract(address, output.script);
-        out.ios.push_back(TxInOut{true, output.value, address.encoded()});
+        out.ios.push_back(TxInOut{true, output.value,
+                                  addressEncode(output.address)});
     }
 
     // Scan outputs:
-    for (const auto &output: tx.outputs)
+    for (const auto &output: row.outputs)
     {
         totalOut += output.value;
-        bc::payment_address address;
-        bc::extract(address, output.script);
-        out.ios.push_back(TxInOut{false, output.value, address.encoded()});
+        out.ios.push_back(TxInOut{false, output.value,
+                                  addressEncode(output.address)});
     }
 
     out.fee = totalIn - totalOut;
@@ -332,17 +474,14 @@ TxCache::missing(const std::string &txid) const
     std::lock_guard<std::mutex> lock(mutex_);
 
     // Check the transaction:
-    auto i = txs_.find(txid);
+    auto i = txs_.find(txidDecode(txid));
     if (txs_.end() == i)
         return true;
 
     // Check the inputs:
     for (const auto &input: i->second.inputs)
-    {
-        const auto txid = bc::encode_hash(input.previous_output.hash);
-        if (!txs_.count(txid))
+        if (!txs_.count(input.hash))
             return true;
-    }
 
     return false;
 }
@@ -356,7 +495,7 @@ TxCache::missingTxids(const TxidSet &txids) const
     for (const auto &txid: txids)
     {
         // Check the transaction:
-        auto i = txs_.find(txid);
+        auto i = txs_.find(txidDecode(txid));
         if (txs_.end() == i)
         {
             out.insert(txid);
@@ -365,11 +504,8 @@ TxCache::missingTxids(const TxidSet &txids) const
 
         // Check the inputs:
         for (const auto &input: i->second.inputs)
-        {
-            const auto txid = bc::encode_hash(input.previous_output.hash);
-            if (!txs_.count(txid))
-                out.insert(txid);
-        }
+            if (!txs_.count(input.hash))
+                out.insert(bc::encode_hash(input.hash));
     }
 
     return out;
@@ -378,12 +514,14 @@ TxCache::missingTxids(const TxidSet &txids) const
 Status
 TxCache::status(TxStatus &result, const std::string &txid) const
 {
-    TxGraph graph(*this);
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto hash = txidDecode(txid);
+
     TxStatus out;
-    out.height = txidHeight(txid);
-    const auto problems = graph.problems(txid);
-    out.isDoubleSpent = problems & TxGraph::doubleSpent;
-    out.isReplaceByFee = problems & TxGraph::replaceByFee;
+    out.height = txidHeight(hash);
+    const auto flags = problems(hash);
+    out.isDoubleSpent = flags & problemDoubleSpent;
+    out.isReplaceByFee = flags & problemReplaceByFee;
 
     result = out;
     return Status();
@@ -395,17 +533,22 @@ TxCache::statuses(const TxidSet &txids) const
     std::lock_guard<std::mutex> lock(mutex_);
     std::list<std::pair<TxInfo, TxStatus>> out;
 
-    TxGraph graph(*this);
     for (const auto &txid: txids)
     {
-        auto i = txs_.find(txid);
+        auto i = txs_.find(txidDecode(txid));
+        if (txs_.end() == i)
+            continue;
+
+        if (!ntxid(i->second))
+            continue;
+
         std::pair<TxInfo, TxStatus> pair;
-        if (txs_.end() != i && infoInternal(pair.first, i->second))
+        if (infoInternal(pair.first, i->first, i->second.ntxid, i->second))
         {
             pair.second.height = txidHeight(i->first);
-            const auto problems = graph.problems(i->first);
-            pair.second.isDoubleSpent = problems & TxGraph::doubleSpent;
-            pair.second.isReplaceByFee = problems & TxGraph::replaceByFee;
+            const auto flags = problems(i->first);
+            pair.second.isDoubleSpent = flags & problemDoubleSpent;
+            pair.second.isReplaceByFee = flags & problemReplaceByFee;
             out.push_back(pair);
         }
     }
@@ -418,55 +561,187 @@ TxCache::statuses(const TxidSet &txids) const
 TxOutputList
 TxCache::utxos(const AddressSet &addresses) const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    AddressKeySet keys;
+    for (const auto &address: addresses)
+        keys.insert(addressDecode(address));
 
-    // Build a list of spends:
-    TxGraph graph(*this);
+    std::lock_guard<std::mutex> lock(mutex_);
 
-    // Check each output against the list:
     TxOutputList out;
-    for (auto &row: txs_)
+    for (const auto &key: keys)
     {
-        for (uint32_t i = 0; i < row.second.outputs.size(); ++i)
+        const auto i = utxos_.find(key);
+        if (utxos_.end() == i)
+            continue;
+
+        for (const auto &point: i->second)
         {
-            bc::hash_digest hash;
-            bc::decode_hash(hash, row.first);
-
-            bc::output_point point = {hash, i};
-            const auto &output = row.second.outputs[i];
-            bc::payment_address address;
-            const auto txid = row.first;
-
-            // The output is interesting if it isn't spent and belongs to us:
-            if (!graph.isSpent(point) &&
-                    bc::extract(address, output.script) &&
-                    addresses.count(address.encoded()))
+            const auto &row = txs_.find(point.hash)->second;
+            out.push_back(TxOutput
             {
-                out.push_back(TxOutput
-                {
-                    point, output.value,
-                    !graph.problems(row.first),
-                    isIncoming(row.second, txid, addresses)
-                });
-            }
+                point, row.outputs[point.index].value,
+                !problems(point.hash),
+                isIncoming(point.hash, keys)
+            });
         }
     }
 
     return out;
 }
 
+AddressSet
+TxCache::unconfirmedAddresses() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    AddressKeySet keys;
+    for (const auto &tx: unconfirmed_)
+        keys.insert(tx.second.begin(), tx.second.end());
+
+    AddressSet out;
+    for (const auto &key: keys)
+        out.insert(addressEncode(key));
+    return out;
+}
+
+TxidSet
+TxCache::unconfirmedTxids() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    TxidSet out;
+    for (const auto &tx: unconfirmed_)
+        out.insert(bc::encode_hash(tx.first));
+    return out;
+}
+
+bool
+TxCache::stratumHash(std::string &result, const TxidSet &txids) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Electrum lists confirmed transactions by height,
+    // then unconfirmed ones, which are -1 if they spend unconfirmed funds.
+    // The server's order within a block is unknowable,
+    // so a tie might produce a mismatch, which only costs a fetch:
+    struct HistoryRow
+    {
+        bool unconfirmed;
+        long height;
+        std::string txid;
+    };
+    std::vector<HistoryRow> history;
+    history.reserve(txids.size());
+    for (const auto &txid: txids)
+    {
+        const auto hash = txidDecode(txid);
+        const auto height = txidHeight(hash);
+        if (height)
+        {
+            history.push_back(HistoryRow{false, static_cast<long>(height), txid});
+            continue;
+        }
+
+        // Unconfirmed transactions need their inputs checked:
+        auto i = txs_.find(hash);
+        if (txs_.end() == i)
+            return false;
+
+        long unconfirmedHeight = 0;
+        for (const auto &input: i->second.inputs)
+            if (txs_.count(input.hash) && !txidHeight(input.hash))
+                unconfirmedHeight = -1;
+        history.push_back(HistoryRow{true, unconfirmedHeight, txid});
+    }
+
+    std::sort(history.begin(), history.end(),
+              [](const HistoryRow &a, const HistoryRow &b)
+    {
+        if (a.unconfirmed != b.unconfirmed)
+            return b.unconfirmed;
+        if (a.height != b.height)
+            return a.unconfirmed ? b.height < a.height : a.height < b.height;
+        return a.txid < b.txid;
+    });
+
+    // Addresses without history have a null hash:
+    result.clear();
+    if (history.empty())
+        return true;
+
+    std::string status;
+    for (const auto &row: history)
+        status += row.txid + ":" + std::to_string(row.height) + ":";
+    result = base16Encode(bc::sha256_hash(bc::to_data_chunk(status)));
+    return true;
+}
+
 bool
 TxCache::drop(const std::string &txid, time_t now)
 {
     std::unique_lock<std::mutex> lock(mutex_);
+    const auto hash = txidDecode(txid);
 
     // Do not drop if it is confirmed or less than an hour old:
-    const auto &info = heights_[txid];
+    const auto &info = heights_[hash];
     if (info.height || now < info.firstSeen + 60*60)
         return false;
 
-    heights_.erase(txid);
-    txs_.erase(txid);
+    heights_.erase(hash);
+    problems_.erase(hash);
+    unconfirmed_.erase(hash);
+
+    if (journal_)
+    {
+        CacheWriter record;
+        record.writeByte(CacheJournal::txDrop);
+        record.writeHash(hash);
+        journal_->append(record);
+    }
+
+    auto i = txs_.find(hash);
+    if (txs_.end() == i)
+        return true;
+    const auto inputs = std::move(i->second.inputs);
+    const auto outputs = i->second.outputs.size();
+
+    // Our outputs are gone:
+    for (uint32_t j = 0; j < outputs; ++j)
+        utxosErase(bc::output_point{hash, j});
+
+    // Remove our spends, which might clear up some double-spends:
+    std::vector<bc::hash_digest> dirty;
+    for (const auto &input: inputs)
+    {
+        auto spend = spends_.find(input);
+        if (spends_.end() == spend)
+            continue;
+
+        auto &txids = spend->second;
+        auto j = std::find(txids.begin(), txids.end(), hash);
+        if (txids.end() != j)
+            txids.erase(j);
+        if (txids.empty())
+        {
+            spends_.erase(spend);
+            utxosInsert(input);
+        }
+        else if (1 == txids.size())
+        {
+            dirty.push_back(txids.front());
+        }
+    }
+
+    // Our children have lost a parent:
+    std::vector<bc::hash_digest> children;
+    spenders(children, hash, outputs);
+    dirty.insert(dirty.end(), children.begin(), children.end());
+
+    arenaErase(hash);
+    for (const auto &child: children)
+        if (unconfirmed_.count(child))
+            unconfirmedUpdate(child);
+    problemsUpdate(std::move(dirty));
     return true;
 }
 
@@ -475,15 +750,28 @@ TxCache::insert(const bc::transaction_type &tx)
 {
     std::unique_lock<std::mutex> lock(mutex_);
 
-    // Do not stomp existing tx's:
-    auto txid = bc::encode_hash(bc::hash_transaction(tx));
-    if (txs_.find(txid) == txs_.end())
-    {
-        txs_[txid] = tx;
-        return true;
-    }
+    std::vector<bc::hash_digest> dirty;
+    if (!insertInternal(dirty, tx))
+        return false;
 
-    return false;
+    problemsUpdate(std::move(dirty));
+    return true;
+}
+
+size_t
+TxCache::insert(const std::vector<bc::transaction_type> &txs)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Settle the problem flags once for the whole batch:
+    size_t out = 0;
+    std::vector<bc::hash_digest> dirty;
+    for (const auto &tx: txs)
+        if (insertInternal(dirty, tx))
+            ++out;
+
+    problemsUpdate(std::move(dirty));
+    return out;
 }
 
 void
@@ -491,34 +779,58 @@ TxCache::confirmed(const std::string &txid, size_t height, time_t now)
 {
     std::lock_guard<std::mutex> lock(mutex_);
 
-    auto &info = heights_[txid];
+    bc::hash_digest hash;
+    if (!bc::decode_hash(hash, txid))
+        return;
+
+    auto &info = heights_[hash];
+    const bool wasConfirmed = info.height;
+    const bool changed = info.height != height || !info.firstSeen;
     info.height = height;
     blocks_.headerNeededAdd(height);
     if (0 == info.firstSeen)
         info.firstSeen = now;
+
+    if (journal_ && changed)
+    {
+        CacheWriter record;
+        record.writeByte(CacheJournal::txHeight);
+        record.writeHash(hash);
+        record.writeNumber(info.height);
+        record.writeNumber(info.firstSeen);
+        journal_->append(record);
+    }
+
+    // Confirmed transactions are safe, so this can change our problems:
+    if (wasConfirmed != !!height)
+    {
+        unconfirmedUpdate(hash);
+        problemsUpdate(std::vector<bc::hash_digest>{hash});
+    }
 }
 
 bool
-TxCache::isIncoming(const bc::transaction_type &tx, const std::string &txid,
-                    const AddressSet &addresses) const
+TxCache::isIncoming(const bc::hash_digest &txid,
+                    const AddressKeySet &addresses) const
 {
     // Confirmed transactions are no longer incoming:
     if (txidHeight(txid))
         return false;
 
-    // This is a spend if we control all the inputs:
-    for (auto &input: tx.inputs)
-    {
-        bc::payment_address address;
-        if (!bc::extract(address, input.script) ||
-                !addresses.count(address.encoded()))
+    auto i = txs_.find(txid);
+    if (txs_.end() == i)
+        return true;
+
+    // This is a spend if we control all the inputs.
+    // Inputs we can't trace back to a parent count as someone else's:
+    for (const auto &input: i->second.inputs)
+        if (!addresses.count(pointAddress(input)))
             return true;
-    }
     return false;
 }
 
 size_t
-TxCache::txidHeight(const std::string &txid) const
+TxCache::txidHeight(const bc::hash_digest &txid) const
 {
     const auto i = heights_.find(txid);
     if (heights_.end() == i)
@@ -526,4 +838,342 @@ TxCache::txidHeight(const std::string &txid) const
     return i->second.height;
 }
 
+unsigned
+TxCache::problems(const bc::hash_digest &txid) const
+{
+    const auto i = problems_.find(txid);
+    if (problems_.end() == i)
+        return 0;
+    return i->second;
+}
+
+unsigned
+TxCache::problemsCompute(const bc::hash_digest &txid) const
+{
+    // We have to assume missing transactions are safe:
+    auto i = txs_.find(txid);
+    if (txs_.end() == i)
+        return 0;
+
+    // Confirmed transactions are also safe:
+    if (txidHeight(txid))
+        return 0;
+
+    // Check for the opt-in replace-by-fee flag:
+    unsigned out = 0;
+    if (i->second.replaceByFee)
+        out |= problemReplaceByFee;
+
+    // Inherit problems from our inputs:
+    for (const auto &input: i->second.inputs)
+    {
+        out |= problems(input.hash);
+        const auto spend = spends_.find(input);
+        if (spends_.end() != spend && 1 < spend->second.size())
+            out |= problemDoubleSpent;
+    }
+    return out;
+}
+
+bool
+TxCache::insertInternal(std::vector<bc::hash_digest> &dirty,
+                        const bc::transaction_type &tx)
+{
+    // Do not stomp existing tx's:
+    const auto txid = bc::hash_transaction(tx);
+    if (txs_.count(txid))
+        return false;
+
+    bc::data_chunk rawTx(satoshi_raw_size(tx));
+    bc::satoshi_save(tx, rawTx.begin());
+    if (!arenaInsert(txid, rawTx).log())
+        return false;
+
+    if (journal_)
+    {
+        CacheWriter record;
+        record.writeByte(CacheJournal::txInsert);
+        record.writeData(rawTx);
+        journal_->append(record);
+    }
+
+    // Index our spends, which might reveal some double-spends:
+    dirty.push_back(txid);
+    for (const auto &input: tx.inputs)
+    {
+        auto &txids = spends_[input.previous_output];
+        txids.push_back(txid);
+        if (2 == txids.size())
+            dirty.push_back(txids.front());
+        utxosErase(input.previous_output);
+    }
+
+    // Our outputs might already be spent by children we have:
+    for (uint32_t i = 0; i < tx.outputs.size(); ++i)
+        utxosInsert(bc::output_point{txid, i});
+
+    // Any children we already have were waiting on us:
+    std::vector<bc::hash_digest> children;
+    spenders(children, txid, tx.outputs.size());
+    dirty.insert(dirty.end(), children.begin(), children.end());
+
+    // Our children can now see which addresses they spend from:
+    unconfirmedUpdate(txid);
+    for (const auto &child: children)
+        if (unconfirmed_.count(child))
+            unconfirmedUpdate(child);
+
+    return true;
+}
+
+void
+TxCache::problemsUpdate(std::vector<bc::hash_digest> txids)
+{
+    // The graph is acyclic, so this will settle once nothing changes:
+    while (!txids.empty())
+    {
+        const auto txid = txids.back();
+        txids.pop_back();
+
+        const auto flags = problemsCompute(txid);
+        if (flags == problems(txid))
+            continue;
+
+        if (flags)
+            problems_[txid] = flags;
+        else
+            problems_.erase(txid);
+
+        auto i = txs_.find(txid);
+        if (txs_.end() != i)
+            spenders(txids, txid, i->second.outputs.size());
+    }
+}
+
+void
+TxCache::spenders(std::vector<bc::hash_digest> &result,
+                  const bc::hash_digest &txid, size_t outputs) const
+{
+    for (uint32_t i = 0; i < outputs; ++i)
+    {
+        const auto spend = spends_.find(bc::output_point{txid, i});
+        if (spends_.end() != spend)
+            result.insert(result.end(),
+                          spend->second.begin(), spend->second.end());
+    }
+}
+
+void
+TxCache::unconfirmedUpdate(const bc::hash_digest &txid)
+{
+    auto i = txs_.find(txid);
+    if (txidHeight(txid) || txs_.end() == i)
+    {
+        unconfirmed_.erase(txid);
+        return;
+    }
+
+    // Input addresses come from the parents, if we have them:
+    AddressKeySet addresses;
+    for (const auto &input: i->second.inputs)
+    {
+        const auto address = pointAddress(input);
+        if (addressValid(address))
+            addresses.insert(address);
+    }
+    for (const auto &output: i->second.outputs)
+    {
+        if (addressValid(output.address))
+            addresses.insert(output.address);
+    }
+    unconfirmed_[txid] = std::move(addresses);
+}
+
+void
+TxCache::indexRebuild()
+{
+    spends_.clear();
+    problems_.clear();
+    utxos_.clear();
+    unconfirmed_.clear();
+
+    // Every row was scanned on the way in, so this just reads the results:
+    std::vector<bc::hash_digest> txids;
+    txids.reserve(txs_.size());
+    for (const auto &row: txs_)
+    {
+        txids.push_back(row.first);
+        for (const auto &input: row.second.inputs)
+            spends_[input].push_back(row.first);
+    }
+
+    for (const auto &txid: txids)
+        if (!txidHeight(txid))
+            unconfirmedUpdate(txid);
+
+    for (const auto &row: txs_)
+    {
+        const auto &outputs = row.second.outputs;
+        for (uint32_t i = 0; i < outputs.size(); ++i)
+        {
+            const bc::output_point point{row.first, i};
+            if (!spends_.count(point) && addressValid(outputs[i].address))
+                utxos_[outputs[i].address].insert(point);
+        }
+    }
+
+    problemsUpdate(std::move(txids));
+}
+
+void
+TxCache::utxosInsert(const bc::output_point &point)
+{
+    if (spends_.count(point))
+        return;
+
+    const auto address = pointAddress(point);
+    if (addressValid(address))
+        utxos_[address].insert(point);
+}
+
+void
+TxCache::utxosErase(const bc::output_point &point)
+{
+    const auto address = pointAddress(point);
+    auto row = utxos_.find(address);
+    if (utxos_.end() == row)
+        return;
+
+    row->second.erase(point);
+    if (row->second.empty())
+        utxos_.erase(row);
+}
+
+DataSlice
+TxCache::raw(const TxRow &row) const
+{
+    return DataSlice(arena_.data() + row.offset,
+                     arena_.data() + row.offset + row.size);
+}
+
+Status
+TxCache::rowScan(TxRow &result, DataSlice rawTx)
+{
+    RawTx scan;
+    ABC_CHECK(rawScan(scan, rawTx));
+
+    result.replaceByFee = scan.replaceByFee;
+    result.inputs = std::move(scan.inputs);
+    result.outputs.clear();
+    result.outputs.reserve(scan.outputs.size());
+    for (const auto &output: scan.outputs)
+    {
+        const auto address = scriptAddress(output.script);
+        TxRowOutput row;
+        row.value = output.value;
+        row.address.version = address.version();
+        row.address.hash = address.hash();
+        result.outputs.push_back(row);
+    }
+    return Status();
+}
+
+Status
+TxCache::arenaInsert(const bc::hash_digest &txid, DataSlice rawTx)
+{
+    TxRow row;
+    ABC_CHECK(rowScan(row, rawTx));
+    row.offset = arena_.size();
+    row.size = rawTx.size();
+    arena_.insert(arena_.end(), rawTx.begin(), rawTx.end());
+    txs_[txid] = std::move(row);
+    return Status();
+}
+
+void
+TxCache::arenaErase(const bc::hash_digest &txid)
+{
+    auto i = txs_.find(txid);
+    if (txs_.end() == i)
+        return;
+    arenaGarbage_ += i->second.size;
+    txs_.erase(i);
+
+    auto decoded = decodedIndex_.find(txid);
+    if (decodedIndex_.end() != decoded)
+    {
+        decoded_.erase(decoded->second);
+        decodedIndex_.erase(decoded);
+    }
+
+    // Repack once the dead space outweighs the live transactions:
+    if (arenaGarbage_ < arenaGarbageMinimum ||
+            arenaGarbage_ < arena_.size() / 2)
+        return;
+
+    DataChunk arena;
+    arena.reserve(arena_.size() - arenaGarbage_);
+    for (auto &row: txs_)
+    {
+        const auto rawTx = raw(row.second);
+        row.second.offset = arena.size();
+        arena.insert(arena.end(), rawTx.begin(), rawTx.end());
+    }
+    arena_.swap(arena);
+    arenaGarbage_ = 0;
+}
+
+Status
+TxCache::decode(bc::transaction_type &result,
+                const bc::hash_digest &txid) const
+{
+    auto decoded = decodedIndex_.find(txid);
+    if (decodedIndex_.end() != decoded)
+    {
+        decoded_.splice(decoded_.begin(), decoded_, decoded->second);
+        result = decoded->second->second;
+        return Status();
+    }
+
+    auto i = txs_.find(txid);
+    if (txs_.end() == i)
+        return ABC_ERROR(ABC_CC_Synchronizing, "Cannot find transaction");
+    ABC_CHECK(decodeTx(result, raw(i->second)));
+
+    if (decodedLimit_)
+    {
+        decoded_.emplace_front(txid, result);
+        decodedIndex_[txid] = decoded_.begin();
+        if (decodedLimit_ < decoded_.size())
+        {
+            decodedIndex_.erase(decoded_.back().first);
+            decoded_.pop_back();
+        }
+    }
+    return Status();
+}
+
+Status
+TxCache::ntxid(TxRow &row) const
+{
+    if (!row.ntxidKnown)
+    {
+        RawTx scan;
+        ABC_CHECK(rawScan(scan, raw(row)));
+        row.ntxid = rawNtxid(raw(row), scan);
+        row.ntxidKnown = true;
+    }
+    return Status();
+}
+
+AddressKey
+TxCache::pointAddress(const bc::output_point &point) const
+{
+    const auto i = txs_.find(point.hash);
+    if (txs_.end() == i || i->second.outputs.size() <= point.index)
+        return AddressKey();
+
+    return i->second.outputs[point.index].address;
+}
+
 } // namespace abcd
@@ -9,13 +9,40 @@
 #define ABCD_BITCOIN_CACHE_TX_CACHE_HPP
 
 #include "../Typedefs.hpp"
+#include "../../util/Data.hpp"
 #include <bitcoin/bitcoin.hpp>
 #include <list>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace std {
+
+/**
+ * Allows `bc::point_type` to be used as a key in unordered containers.
+ */
+template<> struct hash<bc::point_type>
+{
+    typedef bc::point_type argument_type;
+    typedef std::size_t result_type;
+
+    result_type
+    operator()(argument_type const &p) const
+    {
+        auto h = libbitcoin::from_little_endian_unsafe<result_type>(
+                     p.hash.begin());
+        return h ^ p.index;
+    }
+};
+
+} // namespace std
 
 namespace abcd {
 
 class BlockCache;
+class CacheJournal;
+class CacheReader;
+class CacheWriter;
 class JsonObject;
 
 /**
@@ -62,6 +89,51 @@ struct TxOutput
 
 typedef std::list<TxOutput> TxOutputList;
 
+/**
+ * Allows `bc::hash_digest` to be used as a key in unordered containers.
+ * Txids are already uniformly distributed, so the leading bytes suffice.
+ */
+struct TxidHash
+{
+    size_t
+    operator()(const bc::hash_digest &txid) const
+    {
+        return bc::from_little_endian_unsafe<size_t>(txid.begin());
+    }
+};
+
+template<typename T>
+using TxidMap = std::unordered_map<bc::hash_digest, T, TxidHash>;
+
+/**
+ * An address in binary form.
+ * Working this out from an output script is a simple copy,
+ * where the base58 string would need a bignum conversion.
+ */
+struct AddressKey
+{
+    uint8_t version = bc::payment_address::invalid_version;
+    bc::short_hash hash = bc::short_hash();
+
+    bool
+    operator==(const AddressKey &other) const
+    {
+        return version == other.version && hash == other.hash;
+    }
+};
+
+struct AddressKeyHash
+{
+    size_t
+    operator()(const AddressKey &key) const
+    {
+        return bc::from_little_endian_unsafe<size_t>(key.hash.begin()) ^
+               key.version;
+    }
+};
+
+typedef std::unordered_set<AddressKey, AddressKeyHash> AddressKeySet;
+
 /**
  * Translates a list of `TxOutput` structures to the libbitcoin equivalent.
  * @param filter true to filter out unconfirmed outputs.
@@ -93,16 +165,35 @@ public:
     clear();
 
     /**
-     * Reads the database contents from the provided cache JSON object.
+     * Reads the database contents from a binary cache file.
      */
     Status
-    load(JsonObject &json);
+    load(CacheReader &reader);
 
     /**
-     * Saves the database contents to the provided cache JSON object.
+     * Reads the database contents from the old cache JSON object.
      */
     Status
-    save(JsonObject &json);
+    load(JsonObject &json);
+
+    /**
+     * Saves the database contents to a binary cache file.
+     */
+    void
+    save(CacheWriter &writer);
+
+    /**
+     * Sets up a journal to record each change as it happens.
+     */
+    void
+    journalSet(CacheJournal *journal);
+
+    /**
+     * Sets how many decoded transactions to keep on hand.
+     * Zero means every access decodes from scratch.
+     */
+    void
+    decodedLimitSet(size_t limit);
 
     // Queries ------------------------------------------------------------
 
@@ -158,6 +249,30 @@ public:
     TxOutputList
     utxos(const AddressSet &addresses) const;
 
+    /**
+     * Lists the addresses touched by unconfirmed transactions,
+     * either through their inputs or their outputs.
+     * This only visits the unconfirmed transactions,
+     * so it stays cheap no matter how long the history gets.
+     */
+    AddressSet
+    unconfirmedAddresses() const;
+
+    /**
+     * Lists the unconfirmed transactions, from the same index.
+     */
+    TxidSet
+    unconfirmedTxids() const;
+
+    /**
+     * Computes the Electrum status hash for an address with this history,
+     * so it can be checked against the server's without a fetch.
+     * The hash is blank if the history is empty.
+     * @return false if the cache is missing something it needs.
+     */
+    bool
+    stratumHash(std::string &result, const TxidSet &txids) const;
+
     // Updates ------------------------------------------------------------
 
     /**
@@ -174,6 +289,13 @@ public:
     bool
     insert(const bc::transaction_type &tx);
 
+    /**
+     * Inserts a batch of transactions under a single lock.
+     * @return the number of transactions that were new.
+     */
+    size_t
+    insert(const std::vector<bc::transaction_type> &txs);
+
     /**
      * Mark a transaction as confirmed.
      * TODO: Require the block hash as well, once obelisk provides this.
@@ -182,37 +304,204 @@ public:
     confirmed(const std::string &txid, size_t height, time_t now=time(nullptr));
 
 private:
-    friend class TxGraph;
-
     struct HeightInfo
     {
         size_t height = 0;
         time_t firstSeen = 0;
     };
 
+    struct TxRowOutput
+    {
+        uint64_t value;
+        AddressKey address;
+    };
+
+    /**
+     * Transactions stay serialized, packed one after another in the arena,
+     * and are only decoded when something needs more than the raw bytes.
+     * The parts the indexes and queries use are scanned out once,
+     * when the transaction first arrives.
+     */
+    struct TxRow
+    {
+        size_t offset;
+        size_t size;
+        bool ntxidKnown = false;
+        bc::hash_digest ntxid;
+        bool replaceByFee = false;
+        std::vector<bc::output_point> inputs;
+        std::vector<TxRowOutput> outputs;
+    };
+
+    // The string-based API decodes txids once at the door,
+    // so everything inside the cache works with binary hashes:
     mutable std::mutex mutex_;
-    std::map<std::string, bc::transaction_type> txs_;
-    std::map<std::string, HeightInfo> heights_;
+    mutable TxidMap<TxRow> txs_;
+    DataChunk arena_;
+    size_t arenaGarbage_ = 0;
+    TxidMap<HeightInfo> heights_;
     BlockCache &blocks_;
+    CacheJournal *journal_ = nullptr;
+
+    /**
+     * Maps each spent output to the cached transactions spending it.
+     * More than one spender means the output is double-spent.
+     */
+    std::unordered_map<bc::output_point, std::vector<bc::hash_digest>> spends_;
+
+    /**
+     * Problem flags for the unconfirmed transactions that have any.
+     * These are updated incrementally as the graph changes,
+     * so status queries never need to walk the graph.
+     */
+    TxidMap<unsigned> problems_;
+
+    /**
+     * Maps each address to the unspent outputs paying it,
+     * so `utxos` never needs to look at other people's outputs.
+     */
+    typedef std::unordered_set<bc::output_point> PointSet;
+    std::unordered_map<AddressKey, PointSet, AddressKeyHash> utxos_;
+
+    /**
+     * Maps each unconfirmed transaction to the addresses it touches,
+     * so new blocks only need to look at the pending transactions.
+     */
+    TxidMap<AddressKeySet> unconfirmed_;
+
+    /**
+     * Recently-decoded transactions, with the most recent at the front.
+     */
+    typedef std::list<std::pair<bc::hash_digest, bc::transaction_type>>
+            DecodedList;
+    mutable DecodedList decoded_;
+    mutable TxidMap<DecodedList::iterator> decodedIndex_;
+    size_t decodedLimit_;
+
+    /**
+     * Returns a transaction's serialized form.
+     */
+    DataSlice
+    raw(const TxRow &row) const;
+
+    /**
+     * Fills in a row's inputs and outputs from a serialized transaction.
+     */
+    static Status
+    rowScan(TxRow &result, DataSlice rawTx);
+
+    /**
+     * Scans a transaction and copies it into the arena.
+     */
+    Status
+    arenaInsert(const bc::hash_digest &txid, DataSlice rawTx);
+
+    /**
+     * Removes a transaction, repacking the arena once it gets too sparse.
+     */
+    void
+    arenaErase(const bc::hash_digest &txid);
+
+    /**
+     * Decodes a transaction, using the recently-decoded list if possible.
+     */
+    Status
+    decode(bc::transaction_type &result, const bc::hash_digest &txid) const;
+
+    /**
+     * Fills in the row's ntxid if it hasn't been worked out yet.
+     */
+    Status
+    ntxid(TxRow &row) const;
+
+    /**
+     * Returns the address an output pays to,
+     * or an invalid key if it has none or the transaction is missing.
+     */
+    AddressKey
+    pointAddress(const bc::output_point &point) const;
 
     /**
      * Same as `txInfo`, but should be called with the mutex held.
      */
     Status
-    infoInternal(TxInfo &result, const bc::transaction_type &tx) const;
+    infoInternal(TxInfo &result, const bc::hash_digest &txid,
+                 const bc::hash_digest &ntxid, const TxRow &row) const;
 
     /**
      * Returns true if the transaction has incoming non-change funds.
      */
     bool
-    isIncoming(const bc::transaction_type &tx, const std::string &txid,
-               const AddressSet &addresses) const;
+    isIncoming(const bc::hash_digest &txid,
+               const AddressKeySet &addresses) const;
 
     /**
      * Returns a transaction's height, or zero if it is unconfirmed.
      */
     size_t
-    txidHeight(const std::string &txid) const;
+    txidHeight(const bc::hash_digest &txid) const;
+
+    /**
+     * Returns the cached problem flags for a transaction.
+     */
+    unsigned
+    problems(const bc::hash_digest &txid) const;
+
+    /**
+     * Calculates a transaction's problem flags from its own state,
+     * the spend index, and the cached flags of its parents.
+     */
+    unsigned
+    problemsCompute(const bc::hash_digest &txid) const;
+
+    /**
+     * Same as `insert`, but should be called with the mutex held.
+     * Adds the transactions needing new problem flags to the list,
+     * leaving the caller to run `problemsUpdate`.
+     */
+    bool
+    insertInternal(std::vector<bc::hash_digest> &dirty,
+                   const bc::transaction_type &tx);
+
+    /**
+     * Recalculates the problem flags for the given transactions,
+     * pushing any changes down to their descendants.
+     */
+    void
+    problemsUpdate(std::vector<bc::hash_digest> txids);
+
+    /**
+     * Adds the transactions that spend from this one to the list.
+     */
+    void
+    spenders(std::vector<bc::hash_digest> &result,
+             const bc::hash_digest &txid, size_t outputs) const;
+
+    /**
+     * Adds an output to the utxo index if it is unspent and has an address.
+     */
+    void
+    utxosInsert(const bc::output_point &point);
+
+    /**
+     * Removes an output from the utxo index.
+     */
+    void
+    utxosErase(const bc::output_point &point);
+
+    /**
+     * Adds or refreshes a transaction's entry in the unconfirmed index,
+     * or removes it if the transaction is confirmed or missing.
+     */
+    void
+    unconfirmedUpdate(const bc::hash_digest &txid);
+
+    /**
+     * Rebuilds the spend index, utxo index, unconfirmed index,
+     * and problem flags from scratch.
+     */
+    void
+    indexRebuild();
 };
 
 } // namespace abcd
@@ -13,12 +13,16 @@
 #include "../../json/JsonObject.hpp"
 #include "../../util/Debug.hpp"
 #include <algorithm>
+#include <string.h>
 
 namespace abcd {
 
 constexpr std::chrono::seconds keepaliveTime(60);
 constexpr std::chrono::seconds timeout(10);
 
+constexpr size_t windowDefault = 100;
+constexpr size_t batchLimitDefault = 50;
+
 struct RequestJson:
     public JsonObject
 {
@@ -44,6 +48,8 @@ struct HeaderJson:
 struct ReplyJson:
     public JsonObject
 {
+    ABC_JSON_CONSTRUCTORS(ReplyJson, JsonObject)
+
     ABC_JSON_INTEGER(id, "id", 0)
     ABC_JSON_VALUE(result, "result", JsonPtr);
 
@@ -54,10 +60,20 @@ struct ReplyJson:
 
 StratumConnection::~StratumConnection()
 {
+    for (auto &i: queued_)
+        i.pending.onError(ABC_ERROR(ABC_CC_Error, "Connection closed"));
     for (auto &i: pending_)
         i.second.onError(ABC_ERROR(ABC_CC_Error, "Connection closed"));
 }
 
+StratumConnection::StratumConnection():
+    window_(windowDefault),
+    batchLimit_(batchLimitDefault),
+    latencyTotal_(0),
+    latencyMax_(0)
+{
+}
+
 void
 StratumConnection::version(const StatusCallback &onError,
                            const VersionHandler &onReply)
@@ -122,7 +138,17 @@ StratumConnection::sendTx(const StatusCallback &onDone, DataSlice tx)
 }
 
 Status
-StratumConnection::connect(const std::string &rawUri)
+StratumConnection::connect(const std::string &uri)
+{
+    ABC_CHECK(connectStart(uri));
+    ABC_CHECK(connection_.connectWait());
+    lastKeepalive_ = std::chrono::steady_clock::now();
+
+    return Status();
+}
+
+Status
+StratumConnection::connectStart(const std::string &rawUri)
 {
     uri_ = rawUri;
 
@@ -141,8 +167,18 @@ StratumConnection::connect(const std::string &rawUri)
     auto serverPort = server.substr(last + 1, std::string::npos);
 
     // Connect to the server:
-    ABC_CHECK(connection_.connect(serverName, atoi(serverPort.c_str())));
-    lastKeepalive_ = std::chrono::steady_clock::now();
+    ABC_CHECK(connection_.connectStart(serverName, atoi(serverPort.c_str())));
+
+    return Status();
+}
+
+Status
+StratumConnection::connectCheck(bool &done)
+{
+    const bool wasConnected = connection_.connected();
+    ABC_CHECK(connection_.connectCheck(done));
+    if (done && !wasConnected)
+        lastKeepalive_ = std::chrono::steady_clock::now();
 
     return Status();
 }
@@ -151,27 +187,39 @@ Status
 StratumConnection::wakeup(SleepTime &sleep)
 {
     // Read any data available on the socket:
-    DataChunk buffer;
-    ABC_CHECK(connection_.read(buffer));
-    incoming_ += std::string(buffer.begin(), buffer.end());
+    ABC_CHECK(connection_.read(incoming_));
 
-    // Extract any incoming messages:
+    // Process each complete message right where it sits in the buffer:
+    size_t start = 0;
     while (true)
     {
-        // Find the newline:
-        auto where = std::find(incoming_.begin(), incoming_.end(), '\n');
-        if (incoming_.end() == where)
+        const auto data = incoming_.data();
+        const auto newline = static_cast<const uint8_t *>(
+                                 memchr(data + incomingScanned_, '\n',
+                                        incoming_.size() - incomingScanned_));
+        if (!newline)
             break;
 
-        // Extract and process the message:
-        ABC_CHECK(handleMessage(std::string(incoming_.begin(), where + 1)));
-        incoming_.erase(incoming_.begin(), where + 1);
+        const size_t end = newline - data + 1;
+        ABC_CHECK(handleMessage(DataSlice(data + start, data + end)));
+        start = incomingScanned_ = end;
     }
 
+    // Only the partial message at the end needs to move:
+    incoming_.erase(incoming_.begin(), incoming_.begin() + start);
+    incomingScanned_ = incoming_.size();
+
     // We need to wake up every minute:
     auto now = std::chrono::steady_clock::now();
     if (lastKeepalive_ + keepaliveTime < now)
     {
+        const auto s = stats();
+        ABC_DebugLevel(1, "%s: %zu in flight, %zu queued, %zu replies "
+                       "in %zu batches, latency %d ms average, %d ms max",
+                       uri_.c_str(), s.inFlight, s.queued, s.replies,
+                       s.batches, int(s.latencyAverage.count()),
+                       int(s.latencyMax.count()));
+
         auto onError = [](Status status) { };
         auto onReply = [](const std::string &version)
         {
@@ -184,8 +232,12 @@ StratumConnection::wakeup(SleepTime &sleep)
     sleep = std::chrono::duration_cast<SleepTime>(
                 lastKeepalive_ + keepaliveTime - now);
 
+    // Send anything queued so far, including the keepalive,
+    // so callers that never flush still make progress:
+    ABC_CHECK(flush());
+
     // Check the timeout:
-    if (pending_.size())
+    if (pending_.size() || queued_.size())
     {
         if (lastProgress_ + timeout < now)
             return ABC_ERROR(ABC_CC_ServerError, "Connection timed out");
@@ -205,7 +257,78 @@ StratumConnection::uri()
 bool
 StratumConnection::queueFull()
 {
-    return 10 < pending_.size();
+    return window_ <= pending_.size() + queued_.size();
+}
+
+Status
+StratumConnection::flush()
+{
+    while (!queued_.empty())
+    {
+        // Gather up a batch:
+        auto end = queued_.begin();
+        size_t count = 0;
+        while (queued_.end() != end && count < batchLimit_)
+            ++end, ++count;
+
+        // Lone requests go out as-is, and batches go out as arrays:
+        std::string message;
+        if (1 == count)
+        {
+            message = queued_.front().request;
+        }
+        else
+        {
+            message = "[";
+            for (auto i = queued_.begin(); i != end; ++i)
+            {
+                if (i != queued_.begin())
+                    message += ',';
+                message += i->request;
+            }
+            message += "]";
+        }
+
+        auto s = connection_.send(message + '\n');
+        if (!s)
+        {
+            for (auto i = queued_.begin(); i != end; ++i)
+                i->pending.onError(s);
+            queued_.erase(queued_.begin(), end);
+            return s;
+        }
+        ++batches_;
+
+        // Start the timeout if this is the first message in flight:
+        const auto now = std::chrono::steady_clock::now();
+        if (pending_.empty())
+            lastProgress_ = now;
+
+        // The messages have been sent, so save the decoders:
+        for (auto i = queued_.begin(); i != end; ++i)
+        {
+            i->pending.sent = now;
+            pending_[i->id] = std::move(i->pending);
+        }
+        queued_.erase(queued_.begin(), end);
+    }
+
+    return Status();
+}
+
+StratumStats
+StratumConnection::stats() const
+{
+    StratumStats out;
+    out.inFlight = pending_.size();
+    out.queued = queued_.size();
+    out.replies = replies_;
+    out.batches = batches_;
+    out.latencyAverage = std::chrono::duration_cast<SleepTime>(latencyTotal_);
+    if (replies_)
+        out.latencyAverage /= replies_;
+    out.latencyMax = std::chrono::duration_cast<SleepTime>(latencyMax_);
+    return out;
 }
 
 void
@@ -382,28 +505,52 @@ StratumConnection::sendMessage(const std::string &method, JsonPtr params,
     query.methodSet(method);
     query.paramsSet(params);
 
-    auto s = connection_.send(query.encode(true) + '\n');
-    if (!s)
-        return onError(s);
-
     // Start the timeout if this is the first message in the queue:
-    if (pending_.empty())
+    if (pending_.empty() && queued_.empty())
         lastProgress_ = std::chrono::steady_clock::now();
 
-    // The message has been sent, so save the decoder:
-    pending_[id] = Pending{ onError, decoder };
+    queued_.push_back(Queued
+    {
+        id, query.encode(true),
+        Pending{ onError, decoder, std::chrono::steady_clock::time_point() }
+    });
 }
 
 Status
-StratumConnection::handleMessage(const std::string &message)
+StratumConnection::handleMessage(DataSlice message)
 {
-    ReplyJson json;
+    JsonPtr json;
     ABC_CHECK(json.decode(message));
+
+    // Batch replies come back as arrays:
+    if (json_is_array(json.get()))
+    {
+        JsonArray array(json);
+        size_t size = array.size();
+        for (size_t i = 0; i < size; ++i)
+            ABC_CHECK(handleReply(array[i]));
+        return Status();
+    }
+
+    return handleReply(json);
+}
+
+Status
+StratumConnection::handleReply(JsonPtr reply)
+{
+    ReplyJson json(reply);
     if (json.idOk())
     {
         auto i = pending_.find(json.id());
         if (pending_.end() != i)
         {
+            const auto latency = std::chrono::steady_clock::now() -
+                                 i->second.sent;
+            ++replies_;
+            latencyTotal_ += latency;
+            latencyMax_ = std::max(latencyMax_, latency);
+            lastProgress_ = std::chrono::steady_clock::now();
+
             auto s = i->second.decoder(json.result());
             if (!s)
                 i->second.onError(s);
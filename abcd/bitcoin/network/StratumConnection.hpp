@@ -11,6 +11,7 @@
 #include "IBitcoinConnection.hpp"
 #include "TcpConnection.hpp"
 #include <chrono>
+#include <list>
 #include <map>
 
 namespace abcd {
@@ -21,6 +22,24 @@ typedef std::chrono::milliseconds SleepTime;
 // Scheme used for stratum URI's:
 constexpr auto stratumScheme = "stratum";
 
+/**
+ * Request counters for a single server connection.
+ */
+struct StratumStats
+{
+    /** Requests sent, but not yet answered. */
+    size_t inFlight;
+    /** Requests waiting for the next batch to go out. */
+    size_t queued;
+    /** Replies received since connecting. */
+    size_t replies;
+    /** Writes to the socket, each holding one or more requests. */
+    size_t batches;
+
+    SleepTime latencyAverage;
+    SleepTime latencyMax;
+};
+
 class StratumConnection:
     public IBitcoinConnection
 {
@@ -29,6 +48,7 @@ public:
     typedef std::function<void (double fee)> FeeCallback;
 
     ~StratumConnection();
+    StratumConnection();
 
     /**
      * Requests the server version.
@@ -54,23 +74,62 @@ public:
     sendTx(const StatusCallback &onDone, DataSlice tx);
 
     /**
-     * Connects to the specified stratum server.
+     * Connects to the specified stratum server, blocking until done.
      */
     Status
     connect(const std::string &uri);
 
+    /**
+     * Begins connecting to the specified stratum server without blocking.
+     * Call `connectCheck` to find out when the connection is ready.
+     */
+    Status
+    connectStart(const std::string &uri);
+
+    /**
+     * Advances a connection begun with `connectStart`.
+     * @param done set to true once the connection is ready for requests.
+     */
+    Status
+    connectCheck(bool &done);
+
     /**
      * Performs any pending work,
      * and returns the number of ms until the next time we need a wakeup.
+     * This also flushes any requests queued before the call.
      */
     Status
     wakeup(SleepTime &sleep);
 
+    /**
+     * Writes out any requests queued since the last flush,
+     * packing them into JSON-RPC batches.
+     * Callers queueing work after `wakeup` should call this
+     * before going back to sleep.
+     */
+    Status
+    flush();
+
     /**
      * Obtains the socket that the main loop should sleep on.
      */
     int pollfd() const { return connection_.pollfd(); }
 
+    /**
+     * Sets the number of requests that can be outstanding at once,
+     * counting both the queued and in-flight ones.
+     */
+    void windowSet(size_t window) { window_ = window; }
+
+    /**
+     * Sets the largest number of requests to pack into one batch.
+     * A limit of 1 disables batching.
+     */
+    void batchLimitSet(size_t limit) { batchLimit_ = limit ? limit : 1; }
+
+    StratumStats
+    stats() const;
+
     // IBitcoinConnection interface:
     std::string
     uri() override;
@@ -111,18 +170,37 @@ private:
     // Socket:
     std::string uri_;
     TcpConnection connection_;
-    std::string incoming_;
+
+    // Received data, with any partial message left at the front.
+    // Everything before `incomingScanned_` is known to have no newlines:
+    DataChunk incoming_;
+    size_t incomingScanned_ = 0;
 
     // Sending:
     unsigned lastId = 0;
+    size_t window_;
+    size_t batchLimit_;
     struct Pending
     {
         StatusCallback onError;
         Decoder decoder;
-        // TODO: Add timeout logic
+        std::chrono::steady_clock::time_point sent;
     };
+    struct Queued
+    {
+        unsigned id;
+        std::string request;
+        Pending pending;
+    };
+    std::list<Queued> queued_;
     std::map<unsigned, Pending> pending_;
 
+    // Statistics:
+    size_t replies_ = 0;
+    size_t batches_ = 0;
+    std::chrono::steady_clock::duration latencyTotal_;
+    std::chrono::steady_clock::duration latencyMax_;
+
     // Timeout:
     std::chrono::steady_clock::time_point lastProgress_;
 
@@ -134,7 +212,8 @@ private:
     std::map<std::string, AddressUpdateCallback> addressCallbacks_;
 
     /**
-     * Sends a message and sets up the reply decoder.
+     * Queues a message and sets up the reply decoder.
+     * The message goes out with the next `flush`.
      * If anything goes wrong (including errors returned by the decoder),
      * the error callback will be called.
      */
@@ -143,10 +222,17 @@ private:
                 const StatusCallback &onError, const Decoder &decoder);
 
     /**
-     * Decodes and handles a complete message from the server.
+     * Decodes and handles a complete message from the server,
+     * which could be a batch of several replies.
+     */
+    Status
+    handleMessage(DataSlice message);
+
+    /**
+     * Handles a single reply or subscription update.
      */
     Status
-    handleMessage(const std::string &message);
+    handleReply(JsonPtr reply);
 };
 
 } // namespace abcd
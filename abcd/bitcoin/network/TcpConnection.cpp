@@ -9,94 +9,216 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
 
 namespace abcd {
 
-static int
-timeoutConnect(int sock, struct sockaddr *addr,
-               socklen_t addr_len, struct timeval *tv)
-{
-    fd_set fdset;
-    int flags = 0;
-    int so_error;
-    socklen_t len = sizeof(so_error);
-
-    if ((flags = fcntl(sock, F_GETFL, 0)) < 0)
-        return -1;
-
-    if (fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
-        return -1;
+constexpr size_t readChunkMinimum = 16 * 1024;
+constexpr size_t readChunkMaximum = 1024 * 1024;
 
-    if (connect(sock, addr, addr_len) == 0)
-        goto exit;
+constexpr std::chrono::seconds connectTimeout(10);
+constexpr int connectPollMs = 50;
 
-    FD_ZERO(&fdset);
-    FD_SET(sock, &fdset);
-
-    if (select(sock + 1, NULL, &fdset, NULL, tv) > 0)
-    {
-        getsockopt(sock, SOL_SOCKET, SO_ERROR, &so_error, &len);
-        if (so_error == 0)
-            goto exit;
-    }
-    return -1;
-
-exit:
-    if (fcntl(sock, F_SETFL, flags) < 0)
-        return -1;
-    return 0;
-}
+/**
+ * A DNS lookup running on its own thread.
+ * The connection can give up before the lookup finishes,
+ * in which case the thread cleans up after itself.
+ */
+struct TcpConnection::Lookup
+{
+    std::mutex mutex;
+    bool done = false;
+    bool abandoned = false;
+    struct addrinfo *list = nullptr;
+};
 
 TcpConnection::~TcpConnection()
 {
+    if (lookup_)
+    {
+        std::lock_guard<std::mutex> lock(lookup_->mutex);
+        if (lookup_->list)
+            freeaddrinfo(lookup_->list);
+        lookup_->list = nullptr;
+        lookup_->abandoned = true;
+    }
+    if (addresses_)
+        freeaddrinfo(addresses_);
     if (0 < fd_)
         close(fd_);
 }
 
 TcpConnection::TcpConnection():
-    fd_(0)
+    fd_(0),
+    connected_(false),
+    addresses_(nullptr),
+    next_(nullptr)
 {
 }
 
 Status
 TcpConnection::connect(const std::string &hostname, unsigned port)
 {
-    // Do the DNS lookup:
-    struct addrinfo hints {};
-    struct addrinfo *list = nullptr;
-    hints.ai_family = AF_UNSPEC; // Allow IPv6 or IPv4
-    hints.ai_socktype = SOCK_STREAM; // TCP only
-    if (getaddrinfo(hostname.c_str(), std::to_string(port).c_str(), &hints, &list))
-        return ABC_ERROR(ABC_CC_ServerError, "Cannot look up " + hostname);
+    ABC_CHECK(connectStart(hostname, port));
+    return connectWait();
+}
 
-    // Try the returned DNS entries until one connects:
-    for (struct addrinfo *p = list; p; ++p)
+Status
+TcpConnection::connectWait()
+{
+    while (true)
     {
+        bool done;
+        ABC_CHECK(connectCheck(done));
+        if (done)
+            return Status();
+
+        // Sleep until the socket is ready, or the lookup might be done:
+        struct pollfd item = {fd_, POLLOUT, 0};
+        poll(&item, 0 < fd_ ? 1 : 0, connectPollMs);
+    }
+}
+
+Status
+TcpConnection::connectStart(const std::string &hostname, unsigned port)
+{
+    if (0 < fd_ || lookup_)
+        return ABC_ERROR(ABC_CC_Error, "Already connecting to " + hostname_);
+
+    hostname_ = hostname;
+    deadline_ = std::chrono::steady_clock::now() + connectTimeout;
+
+    // Do the DNS lookup in the background:
+    auto lookup = std::make_shared<Lookup>();
+    const auto service = std::to_string(port);
+    try
+    {
+        std::thread([lookup, hostname, service]()
+        {
+            struct addrinfo hints {};
+            struct addrinfo *list = nullptr;
+            hints.ai_family = AF_UNSPEC; // Allow IPv6 or IPv4
+            hints.ai_socktype = SOCK_STREAM; // TCP only
+            if (getaddrinfo(hostname.c_str(), service.c_str(), &hints, &list))
+                list = nullptr;
+
+            std::lock_guard<std::mutex> lock(lookup->mutex);
+            if (lookup->abandoned && list)
+                freeaddrinfo(list);
+            else
+                lookup->list = list;
+            lookup->done = true;
+        }).detach();
+    }
+    catch (const std::system_error &)
+    {
+        return ABC_ERROR(ABC_CC_SysError, "Cannot start DNS lookup");
+    }
+    lookup_ = lookup;
+
+    return Status();
+}
+
+Status
+TcpConnection::connectCheck(bool &done)
+{
+    done = connected_;
+    if (connected_)
+        return Status();
+
+    if (deadline_ < std::chrono::steady_clock::now())
+        return ABC_ERROR(ABC_CC_ServerError, "Timed out connecting to " + hostname_);
+
+    // Pick up the DNS results once they arrive:
+    if (lookup_)
+    {
+        auto lookup = lookup_;
+        std::lock_guard<std::mutex> lock(lookup->mutex);
+        if (!lookup->done)
+            return Status();
+
+        addresses_ = next_ = lookup->list;
+        lookup->list = nullptr;
+        lookup_.reset();
+        if (!addresses_)
+            return ABC_ERROR(ABC_CC_ServerError, "Cannot look up " + hostname_);
+
+        ABC_CHECK(connectNext());
+        done = connected_;
+        return Status();
+    }
+
+    // Check on the address we are trying:
+    struct pollfd item = {fd_, POLLOUT, 0};
+    if (poll(&item, 1, 0) <= 0)
+        return Status();
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (!getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &length) && !error)
+    {
+        // Go back to blocking sends:
+        int flags = fcntl(fd_, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd_, F_SETFL, flags & ~O_NONBLOCK) < 0)
+            return ABC_ERROR(ABC_CC_SysError, "Cannot configure socket");
+
+        connected_ = true;
+        done = true;
+        return Status();
+    }
+
+    // That one failed, so move on to the next one:
+    close(fd_);
+    fd_ = 0;
+    ABC_CHECK(connectNext());
+    done = connected_;
+    return Status();
+}
+
+Status
+TcpConnection::connectNext()
+{
+    // Try the remaining DNS entries until one gets going:
+    for (; next_; next_ = next_->ai_next)
+    {
+        const auto *p = next_;
         fd_ = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
         if (fd_ < 0)
         {
-            freeaddrinfo(list);
-            return ABC_ERROR(ABC_CC_ServerError, "Cannot create socket to " + hostname);
+            fd_ = 0;
+            return ABC_ERROR(ABC_CC_ServerError, "Cannot create socket to " + hostname_);
         }
 
-        struct timeval sto;
-        sto.tv_sec = 10;
-        sto.tv_usec = 0;
-        if (0 == timeoutConnect(fd_, p->ai_addr, p->ai_addrlen, &sto))
-            break;
+        int flags = fcntl(fd_, F_GETFL, 0);
+        if (0 <= flags && 0 <= fcntl(fd_, F_SETFL, flags | O_NONBLOCK))
+        {
+            if (0 == ::connect(fd_, p->ai_addr, p->ai_addrlen))
+            {
+                if (0 <= fcntl(fd_, F_SETFL, flags))
+                {
+                    connected_ = true;
+                    next_ = next_->ai_next;
+                    return Status();
+                }
+            }
+            else if (EINPROGRESS == errno)
+            {
+                next_ = next_->ai_next;
+                return Status();
+            }
+        }
 
         close(fd_);
         fd_ = 0;
     }
-    freeaddrinfo(list);
 
-    if (fd_ < 0)
-        return ABC_ERROR(ABC_CC_ServerError, "Cannot connect to " + hostname);
-
-    return Status();
+    return ABC_ERROR(ABC_CC_ServerError, "Cannot connect to " + hostname_);
 }
 
 Status
@@ -115,21 +237,47 @@ TcpConnection::send(DataSlice data)
 }
 
 Status
-TcpConnection::read(DataChunk &result)
+TcpConnection::read(DataChunk &buffer)
 {
-    unsigned char data[1024];
-    auto bytes = recv(fd_, data, sizeof(data), MSG_DONTWAIT);
-    if (bytes < 0)
+    // Read straight into the buffer, growing the reads as long as
+    // the socket keeps filling them, until the socket runs dry:
+    const size_t start = buffer.size();
+    size_t used = start;
+    size_t chunk = readChunkMinimum;
+    while (true)
     {
-        if (EAGAIN != errno && EWOULDBLOCK != errno)
-            return ABC_ERROR(ABC_CC_ServerError, "Cannot read from socket");
+        // Only grow the buffer once its spare capacity is used up:
+        if (buffer.capacity() - used < readChunkMinimum)
+            buffer.reserve(std::max(used + chunk, 2 * buffer.capacity()));
+        const size_t space = std::min(buffer.capacity() - used, chunk);
 
-        // No data, but that's fine:
-        bytes = 0;
-    }
+        buffer.resize(used + space);
+        auto bytes = recv(fd_, buffer.data() + used, space, MSG_DONTWAIT);
+        if (bytes <= 0)
+            buffer.resize(used);
 
-    result = DataChunk(data, data + bytes);
-    return Status();
+        // Hand over anything we got before reporting a closed socket.
+        // The socket stays closed, so the next call reports it:
+        if (bytes < 0)
+        {
+            if (EAGAIN != errno && EWOULDBLOCK != errno && start == used)
+                return ABC_ERROR(ABC_CC_ServerError, "Cannot read from socket");
+
+            // No more data, but that's fine:
+            return Status();
+        }
+        if (0 == bytes)
+        {
+            if (start == used)
+                return ABC_ERROR(ABC_CC_ServerError,
+                                 "Connection closed by server");
+            return Status();
+        }
+
+        used += bytes;
+        if (static_cast<size_t>(bytes) == space && chunk < readChunkMaximum)
+            chunk *= 2;
+    }
 }
 
 } // namespace abcd
@@ -10,6 +10,10 @@
 
 #include "../../util/Status.hpp"
 #include "../../util/Data.hpp"
+#include <chrono>
+#include <memory>
+
+struct addrinfo;
 
 namespace abcd {
 
@@ -20,11 +24,39 @@ public:
     TcpConnection();
 
     /**
-     * Connect to the specified server.
+     * Connect to the specified server, blocking until done.
      */
     Status
     connect(const std::string &hostname, unsigned port);
 
+    /**
+     * Begins connecting to the specified server without blocking.
+     * The DNS lookup runs in the background,
+     * and `connectCheck` picks up the results.
+     */
+    Status
+    connectStart(const std::string &hostname, unsigned port);
+
+    /**
+     * Advances a connection begun with `connectStart`.
+     * Call this whenever the socket becomes writable,
+     * or periodically while the DNS lookup is still running.
+     * @param done set to true once the connection is ready to use.
+     */
+    Status
+    connectCheck(bool &done);
+
+    /**
+     * Blocks until a connection begun with `connectStart` is ready.
+     */
+    Status
+    connectWait();
+
+    /**
+     * True once the socket has finished connecting.
+     */
+    bool connected() const { return connected_; }
+
     /**
      * Send some data over the socket.
      */
@@ -32,10 +64,12 @@ public:
     send(DataSlice data);
 
     /**
-     * Read all pending data from the socket (might not produce anything).
+     * Reads everything the socket has available, without blocking,
+     * and appends it to the end of the buffer.
+     * The buffer might not grow if nothing has arrived yet.
      */
     Status
-    read(DataChunk &result);
+    read(DataChunk &buffer);
 
     /**
      * Obtains a list of sockets that the main loop should sleep on.
@@ -43,7 +77,24 @@ public:
     int pollfd() const { return fd_; }
 
 private:
+    struct Lookup;
+
     int fd_;
+    bool connected_;
+
+    // Connection progress:
+    std::string hostname_;
+    std::shared_ptr<Lookup> lookup_;
+    struct addrinfo *addresses_;
+    struct addrinfo *next_;
+    std::chrono::steady_clock::time_point deadline_;
+
+    /**
+     * Starts a non-blocking connection to the next DNS entry,
+     * skipping any that fail right away.
+     */
+    Status
+    connectNext();
 };
 
 } // namespace abcd
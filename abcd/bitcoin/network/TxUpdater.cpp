@@ -8,6 +8,7 @@
 #include "TxUpdater.hpp"
 #include "LibbitcoinConnection.hpp"
 #include "StratumConnection.hpp"
+#include "../cache/BlockCache.hpp"
 #include "../cache/Cache.hpp"
 #include "../../General.hpp"
 #include "../../util/Debug.hpp"
@@ -23,37 +24,120 @@ constexpr auto NUM_CONNECT_SERVERS = 5;
 constexpr auto MINIMUM_LIBBITCOIN_SERVERS = 1;
 constexpr auto MINIMUM_STRATUM_SERVERS = 4;
 
+// Extra stratum connections to race against the others:
+constexpr auto SPARE_CONNECT_SERVERS = 3;
+// DNS lookups have nothing to poll on, so check back this often:
+constexpr std::chrono::milliseconds CONNECT_POLL_TIME(50);
+// Servers we have never timed rank between the fast and slow ones:
+constexpr std::chrono::milliseconds UNKNOWN_CONNECT_LATENCY(1000);
+constexpr std::chrono::milliseconds FAILED_CONNECT_LATENCY(10000);
+
+/**
+ * Strips the key, if any, from a server list entry.
+ */
+static std::string
+serverUri(const std::string &server)
+{
+    return server.substr(0, server.find(' '));
+}
+
 TxUpdater::~TxUpdater()
 {
-    disconnect();
+    disconnectAll();
 }
 
-TxUpdater::TxUpdater(Cache &cache, void *ctx):
-    cache_(cache),
+TxUpdater::TxUpdater(BlockCache &blockCache, void *ctx):
+    blocks_(blockCache),
     ctx_(ctx)
 {
 }
 
 void
-TxUpdater::disconnect()
+TxUpdater::cacheAdd(unsigned id, Cache &cache)
+{
+    caches_.emplace(id, CacheInfo(cache));
+}
+
+void
+TxUpdater::cacheRemove(unsigned id)
+{
+    auto i = caches_.find(id);
+    if (caches_.end() == i)
+        return;
+
+    i->second.cache.save().log(); // Failure is fine
+    caches_.erase(i);
+
+    for (auto &subscriber: subscribers_)
+        subscriber.second.erase(id);
+
+    if (!wantConnection())
+        disconnectAll();
+}
+
+void
+TxUpdater::cacheWakeup(unsigned id)
+{
+    auto i = caches_.find(id);
+    if (caches_.end() != i)
+        i->second.pending = true;
+}
+
+void
+TxUpdater::disconnect(unsigned id)
 {
-    wantConnection = false;
+    auto i = caches_.find(id);
+    if (caches_.end() != i)
+        i->second.wantConnection = false;
 
+    if (!wantConnection())
+        disconnectAll();
+}
+
+Status
+TxUpdater::connect(unsigned id)
+{
+    auto i = caches_.find(id);
+    if (caches_.end() == i)
+        return ABC_ERROR(ABC_CC_Error, "Unknown watcher");
+
+    i->second.wantConnection = true;
+    i->second.pending = true;
+    return connectAll();
+}
+
+bool
+TxUpdater::wantConnection() const
+{
+    for (const auto &i: caches_)
+        if (i.second.wantConnection)
+            return true;
+    return false;
+}
+
+void
+TxUpdater::disconnectAll()
+{
     auto i = connections_.begin();
     while (i != connections_.end())
     {
         delete *i;
         i = connections_.erase(i);
     }
+    connecting_.clear();
+    stateHashes_.clear();
+
+    // Start over with every server next time,
+    // picking the fastest ones first:
+    untriedLibbitcoin_.clear();
+    untriedStratum_.clear();
 
     ABC_DebugLog("Disconnected from all servers.");
 }
 
 Status
-TxUpdater::connect()
+TxUpdater::connectAll()
 {
-    wantConnection = true;
-
     // This happens once, and never changes:
     if (serverList_.empty())
         serverList_ = generalBitcoinServers();
@@ -63,13 +147,27 @@ TxUpdater::connect()
         ABC_DebugLevel(1, "serverList_[%d]=%s", i, serverList_[i].c_str());
     }
 
+    // Servers we are already using don't belong in the untried lists:
+    auto inUse = [this](long index)
+    {
+        for (const auto &attempt: connecting_)
+            if (index == attempt.index)
+                return true;
+        const auto uri = serverUri(serverList_[index]);
+        for (auto *bc: connections_)
+            if (uri == bc->uri())
+                return true;
+        return false;
+    };
+
     // If we are out of fresh libbitcoin servers, reload the list:
     if (untriedLibbitcoin_.empty())
     {
         for (size_t i = 0; i < serverList_.size(); ++i)
         {
             const auto &server = serverList_[i];
-            if (0 == server.compare(0, LIBBITCOIN_PREFIX_LENGTH, LIBBITCOIN_PREFIX))
+            if (0 == server.compare(0, LIBBITCOIN_PREFIX_LENGTH, LIBBITCOIN_PREFIX)
+                    && !inUse(i))
                 untriedLibbitcoin_.insert(i);
         }
     }
@@ -80,16 +178,17 @@ TxUpdater::connect()
         for (size_t i = 0; i < serverList_.size(); ++i)
         {
             const auto &server = serverList_[i];
-            if (0 == server.compare(0, STRATUM_PREFIX_LENGTH, STRATUM_PREFIX))
+            if (0 == server.compare(0, STRATUM_PREFIX_LENGTH, STRATUM_PREFIX)
+                    && !inUse(i))
                 untriedStratum_.insert(i);
         }
     }
 
-    ABC_DebugLevel(2,"%d libbitcoin untried, %d stratrum untried",
+    ABC_DebugLevel(2,"%zu libbitcoin untried, %zu stratrum untried",
                    untriedLibbitcoin_.size(), untriedStratum_.size());
 
-    // Count the number of existing connections:
-    size_t stratumCount = 0;
+    // Count the number of existing connections, including unfinished ones:
+    size_t stratumCount = connecting_.size();
     size_t libbitcoinCount = 0;
     for (auto *bc: connections_)
     {
@@ -99,12 +198,19 @@ TxUpdater::connect()
             ++libbitcoinCount;
     }
 
-    // Let's make some connections:
+    // Let's make some connections.
+    // Stratum connections finish in the background, so we start a few
+    // more than we need, and the first ones to finish win:
     srand(time(nullptr));
     int numConnections = 0;
     while (connections_.size() < NUM_CONNECT_SERVERS
+            && connections_.size() + connecting_.size() <
+            NUM_CONNECT_SERVERS + SPARE_CONNECT_SERVERS
             && (untriedLibbitcoin_.size() || untriedStratum_.size()))
     {
+        const size_t openSlots = NUM_CONNECT_SERVERS + SPARE_CONNECT_SERVERS -
+                                 connections_.size() - connecting_.size();
+
         auto *untriedPrimary = &untriedStratum_;
         auto *primaryCount = &stratumCount;
         auto *untriedSecondary = &untriedLibbitcoin_;
@@ -123,24 +229,20 @@ TxUpdater::connect()
         }
 
         if (untriedPrimary->size() &&
-                ((minSecondary - *secondaryCount < NUM_CONNECT_SERVERS - connections_.size()) ||
+                ((minSecondary - *secondaryCount < openSlots) ||
                  (rand() & 8)))
         {
-            auto i = untriedPrimary->begin();
-            std::advance(i, rand() % untriedPrimary->size());
-            if (connectTo(*i).log())
+            if (connectTo(pickUntried(*untriedPrimary)).log())
             {
                 (*primaryCount)++;
                 ++numConnections;
             }
         }
         else if (untriedSecondary->size() &&
-                 ((minPrimary - *primaryCount < NUM_CONNECT_SERVERS - connections_.size()) ||
+                 ((minPrimary - *primaryCount < openSlots) ||
                   (rand() & 8)))
         {
-            auto i = untriedSecondary->begin();
-            std::advance(i, rand() % untriedSecondary->size());
-            if (connectTo(*i).log())
+            if (connectTo(pickUntried(*untriedSecondary)).log())
             {
                 (*secondaryCount)++;
                 ++numConnections;
@@ -151,9 +253,85 @@ TxUpdater::connect()
     return Status();
 }
 
+void
+TxUpdater::connectProgress()
+{
+    auto i = connecting_.begin();
+    while (i != connecting_.end())
+    {
+        const auto uri = i->sc->uri();
+        bool done = false;
+        const auto s = i->sc->connectCheck(done);
+        const auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - i->start);
+
+        if (!s)
+        {
+            ABC_DebugLog("%s: connect failed after %d ms (%s)",
+                         uri.c_str(), int(latency.count()), s.message().c_str());
+            connectLatency_[uri] = FAILED_CONNECT_LATENCY;
+            i = connecting_.erase(i);
+        }
+        else if (done)
+        {
+            ABC_DebugLog("%s: connected in %d ms", uri.c_str(),
+                         int(latency.count()));
+            connectLatency_[uri] = latency;
+            std::unique_ptr<IBitcoinConnection> bc(i->sc.release());
+            i = connecting_.erase(i);
+            connectReady(std::move(bc)).log();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    // Once we have enough servers, the stragglers lose the race.
+    // Nothing is known to be wrong with them, so they can go again later:
+    if (NUM_CONNECT_SERVERS <= connections_.size())
+    {
+        for (const auto &attempt: connecting_)
+            untriedStratum_.insert(attempt.index);
+        connecting_.clear();
+    }
+}
+
+long
+TxUpdater::pickUntried(const std::set<int> &untried)
+{
+    // Start at a random spot, so equally-good servers share the load:
+    auto i = untried.begin();
+    std::advance(i, rand() % untried.size());
+
+    long best = *i;
+    auto bestLatency = std::chrono::milliseconds::max();
+    for (size_t n = 0; n < untried.size(); ++n, ++i)
+    {
+        if (untried.end() == i)
+            i = untried.begin();
+
+        auto latency = UNKNOWN_CONNECT_LATENCY;
+        const auto known = connectLatency_.find(serverUri(serverList_[*i]));
+        if (connectLatency_.end() != known)
+            latency = known->second;
+
+        if (latency < bestLatency)
+        {
+            best = *i;
+            bestLatency = latency;
+        }
+    }
+
+    return best;
+}
+
 std::chrono::milliseconds
 TxUpdater::wakeup()
 {
+    // Finish any connections that are ready:
+    connectProgress();
+
     // Handle any old work that has finished:
     std::chrono::milliseconds nextWakeup(0);
     for (auto *bc: connections_)
@@ -173,53 +351,34 @@ TxUpdater::wakeup()
             nextWakeup = bc::client::min_sleep(nextWakeup, lc->wakeup());
     }
 
-    // Fetch missing transactions:
-    time_t sleep;
-    const auto statuses = cache_.addresses.statuses(sleep);
-    nextWakeup = bc::client::min_sleep(nextWakeup, std::chrono::seconds(sleep));
-    for (const auto &status: statuses)
+    // Only wallets with something new to do need their addresses checked:
+    const auto now = std::chrono::steady_clock::now();
+    for (auto &i: caches_)
     {
-        for (const auto &txid: status.missingTxids)
-        {
-            // Try to use the same server:
-            auto *bc = pickServer(addressServers_[status.address]);
-            if (!bc)
-                break;
+        cacheArrivals(i.second);
 
-            fetchTx(txid, bc);
-        }
-    }
-
-    // Schedule new address work:
-    for (const auto &status: statuses)
-    {
-        if (status.dirty)
+        auto &info = i.second;
+        if (!info.pending && now < info.nextCheck)
         {
-            // Try to use the same server that made us dirty:
-            auto *bc = pickServer(addressServers_[status.address]);
-            if (!bc)
-                break;
-
-            if (bc->addressSubscribed(status.address))
-                fetchAddress(status.address, bc);
-            else
-                subscribeAddress(status.address, bc);
+            if (std::chrono::steady_clock::time_point::max() != info.nextCheck)
+            {
+                const auto wait = std::chrono::duration_cast<
+                                  std::chrono::milliseconds>(info.nextCheck - now);
+                nextWakeup = bc::client::min_sleep(nextWakeup,
+                                                   wait + std::chrono::milliseconds(1));
+            }
+            continue;
         }
-        else if (status.needsCheck)
-        {
-            // Try to use a different server than last time:
-            auto *bc = pickOtherServer(addressServers_[status.address]);
-            if (!bc)
-                break;
 
-            subscribeAddress(status.address, bc);
-        }
+        // Wallets that could not get a server stay pending,
+        // and try again once some other work finishes:
+        info.pending = !cacheCheck(i.first, info);
     }
 
     // Grab block headers that we don't have:
     while (true)
     {
-        size_t headerNeeded = cache_.blocks.headerNeeded();
+        size_t headerNeeded = blocks_.headerNeeded();
         if (!headerNeeded)
             break;
 
@@ -229,22 +388,30 @@ TxUpdater::wakeup()
 
         blockHeaderFetch(headerNeeded, bc);
     }
-    cache_.blocks.save();
-    cache_.blocks.onHeaderInvoke();
+    blocks_.save();
+    blocks_.onHeaderInvoke();
 
-    // Save the cache if it is dirty and enough time has elapsed:
-    if (cacheDirty)
+    // Flush the cache journals once enough time has elapsed,
+    // so a crash loses at most this many seconds of work:
+    time_t seconds = time(nullptr);
+    for (auto &i: caches_)
     {
-        time_t now = time(nullptr);
-
-        if (10 <= now - cacheLastSave)
+        auto &info = i.second;
+        if (10 <= seconds - info.lastSave)
         {
-            cache_.save().log(); // Failure is fine
-            cacheLastSave = now;
-            cacheDirty = false;
+            info.cache.save().log(); // Failure is fine
+            info.lastSave = seconds;
         }
     }
 
+    // Send everything queued up above as batches:
+    for (auto *bc: connections_)
+    {
+        auto *sc = dynamic_cast<StratumConnection *>(bc);
+        if (sc && !sc->flush().log())
+            failedServers_.insert(bc->uri());
+    }
+
     // Prune failed servers:
     for (const auto &uri: failedServers_)
     {
@@ -255,6 +422,15 @@ TxUpdater::wakeup()
             if (uri == bc->uri())
             {
                 ABC_DebugLog("Disconnecting from %s", bc->uri().c_str());
+                connectLatency_[uri] = FAILED_CONNECT_LATENCY;
+                for (auto hash = stateHashes_.begin();
+                        hash != stateHashes_.end();)
+                {
+                    if (uri == hash->first.first)
+                        hash = stateHashes_.erase(hash);
+                    else
+                        ++hash;
+                }
                 delete bc;
                 i = connections_.erase(i);
             }
@@ -267,12 +443,89 @@ TxUpdater::wakeup()
     failedServers_.clear();
 
     // Connect to more servers:
-    if (wantConnection && connections_.size() < NUM_CONNECT_SERVERS)
-        connect().log();
+    if (wantConnection() && connections_.size() < NUM_CONNECT_SERVERS)
+        connectAll().log();
+    if (!connecting_.empty())
+        nextWakeup = bc::client::min_sleep(nextWakeup, CONNECT_POLL_TIME);
 
     return nextWakeup;
 }
 
+bool
+TxUpdater::cacheCheck(unsigned id, CacheInfo &info)
+{
+    auto &cache = info.cache;
+    bool done = true;
+
+    time_t sleep;
+    const auto statuses = cache.addresses.statuses(sleep);
+    info.nextCheck = sleep ?
+                     std::chrono::steady_clock::now() + std::chrono::seconds(sleep) :
+                     std::chrono::steady_clock::time_point::max();
+
+    // Fetch missing transactions:
+    for (const auto &status: statuses)
+    {
+        for (const auto &txid: status.missingTxids)
+        {
+            // Try to use the same server:
+            auto *bc = pickServer(info.addressServers[status.address]);
+            if (!bc)
+            {
+                done = false;
+                break;
+            }
+
+            fetchTx(id, txid, bc);
+        }
+    }
+
+    // Schedule new address work:
+    for (const auto &status: statuses)
+    {
+        if (status.dirty)
+        {
+            // Try to use the same server that made us dirty:
+            auto *bc = pickServer(info.addressServers[status.address]);
+            if (!bc)
+                return false;
+
+            if (bc->addressSubscribed(status.address))
+                fetchAddress(id, status.address, bc);
+            else
+                subscribeAddress(id, status.address, bc);
+        }
+        else if (status.needsCheck)
+        {
+            // Try to use a different server than last time:
+            auto *bc = pickOtherServer(info.addressServers[status.address]);
+            if (!bc)
+                return false;
+
+            subscribeAddress(id, status.address, bc);
+        }
+    }
+
+    return done;
+}
+
+void
+TxUpdater::cacheArrivals(CacheInfo &info)
+{
+    if (info.arrivedTxs.empty())
+        return;
+
+    // Take the batch first, since the callbacks can re-enter:
+    std::vector<bc::transaction_type> txs;
+    TxidSet txids;
+    txs.swap(info.arrivedTxs);
+    txids.swap(info.arrivedTxids);
+
+    ABC_DebugLog("Inserting %d fetched transactions", txs.size());
+    info.cache.txs.insert(txs);
+    info.cache.addresses.updateTx(txids);
+}
+
 std::list<zmq_pollitem_t>
 TxUpdater::pollitems()
 {
@@ -293,6 +546,19 @@ TxUpdater::pollitems()
         if (lc)
             out.push_back(lc->pollitem());
     }
+
+    // Unfinished connections are waiting to become writable:
+    for (const auto &attempt: connecting_)
+    {
+        if (0 < attempt.sc->pollfd())
+        {
+            zmq_pollitem_t pollitem =
+            {
+                nullptr, attempt.sc->pollfd(), ZMQ_POLLOUT, 0
+            };
+            out.push_back(pollitem);
+        }
+    }
     return out;
 }
 
@@ -329,28 +595,36 @@ TxUpdater::connectTo(long index)
     }
 
     // Make the connection:
-    std::unique_ptr<IBitcoinConnection> bc;
     if (0 == server.compare(0, LIBBITCOIN_PREFIX_LENGTH, LIBBITCOIN_PREFIX))
     {
         // Libbitcoin server:
         untriedLibbitcoin_.erase(index);
         std::unique_ptr<LibbitcoinConnection> lc(new LibbitcoinConnection(ctx_));
         ABC_CHECK(lc->connect(server, key));
-        bc.reset(lc.release());
+        return connectReady(std::unique_ptr<IBitcoinConnection>(lc.release()));
     }
     else if (0 == server.compare(0, STRATUM_PREFIX_LENGTH, STRATUM_PREFIX))
     {
-        // Stratum server:
+        // Stratum server, which finishes connecting in `connectProgress`:
         untriedStratum_.erase(index);
         std::unique_ptr<StratumConnection> sc(new StratumConnection());
-        ABC_CHECK(sc->connect(server));
-        bc.reset(sc.release());
+        ABC_CHECK(sc->connectStart(server));
+        connecting_.push_back(Connecting
+        {
+            index, std::chrono::steady_clock::now(), std::move(sc)
+        });
+        ABC_DebugLog("Connecting to %s as %d", server.c_str(), index);
+        return Status();
     }
     else
     {
         return ABC_ERROR(ABC_CC_Error, "Unknown server type " + server);
     }
+}
 
+Status
+TxUpdater::connectReady(std::unique_ptr<IBitcoinConnection> bc)
+{
     // Height callbacks:
     subscribeHeight(bc.get());
 
@@ -364,9 +638,11 @@ TxUpdater::connectTo(long index)
         fetchFeeEstimate(4, sc);
         fetchFeeEstimate(5, sc);
     }
+    if (sc)
+        ABC_CHECK(sc->flush());
 
+    ABC_DebugLog("Connected to %s", bc->uri().c_str());
     connections_.push_back(bc.release());
-    ABC_DebugLog("Connected to %s as %d", server.c_str(), index);
 
     return Status();
 }
@@ -416,20 +692,19 @@ TxUpdater::subscribeHeight(IBitcoinConnection *bc)
     auto onReply = [this, uri](size_t height)
     {
         ABC_DebugLog("%s: height %d returned", uri.c_str(), height);
-        cache_.blocks.heightSet(height);
+        blocks_.heightSet(height);
 
-        // Update addresses with unconfirmed txs:
-        const auto statuses = cache_.txs.statuses(cache_.addresses.txids());
-        for (const auto status: statuses)
+        // Update addresses listing unconfirmed txs:
+        for (auto &i: caches_)
         {
-            if (!status.second.height)
+            auto &cache = i.second.cache;
+            const auto txids = cache.txs.unconfirmedTxids();
+            for (const auto &address: cache.addresses.txidAddresses(txids))
             {
-                for (const auto &io: status.first.ios)
-                {
-                    ABC_DebugLog("Marking %s dirty (tx height check)",
-                                 io.address.c_str());
-                    cache_.addresses.updateStratumHash(io.address);
-                }
+                ABC_DebugLog("Marking %s dirty (tx height check)",
+                             address.c_str());
+                cache.addresses.updateStratumHash(address);
+                i.second.pending = true;
             }
         }
     };
@@ -438,16 +713,26 @@ TxUpdater::subscribeHeight(IBitcoinConnection *bc)
 }
 
 void
-TxUpdater::subscribeAddress(const std::string &address, IBitcoinConnection *bc)
+TxUpdater::subscribeAddress(unsigned id, const std::string &address,
+                            IBitcoinConnection *bc)
 {
-    // If we are already subscribed, mark the address as up-to-date:
+    auto &info = caches_.at(id);
+    const auto uri = bc->uri();
+    subscribers_[address].insert(id);
+
+    // If we are already subscribed, mark the address as up-to-date.
+    // Another wallet may own the subscription,
+    // so catch up with the last state hash the server sent:
     if (bc->addressSubscribed(address))
     {
-        cache_.addresses.updateSubscribe(address);
+        const auto hash = stateHashes_.find(std::make_pair(uri, address));
+        if (stateHashes_.end() != hash &&
+                info.cache.addresses.updateStratumHash(address, hash->second))
+            info.addressServers[address] = uri;
+        info.cache.addresses.updateSubscribe(address);
         return;
     }
 
-    const auto uri = bc->uri();
     auto onError = [this, address, uri](Status s)
     {
         ABC_DebugLog("%s: %s subscribe failed (%s)",
@@ -455,18 +740,30 @@ TxUpdater::subscribeAddress(const std::string &address, IBitcoinConnection *bc)
         failedServers_.insert(uri);
     };
 
+    // The subscription outlives this request,
+    // so route each update to whoever is watching at the time:
     auto onReply = [this, address, uri](const std::string &stateHash)
     {
-        if (cache_.addresses.updateStratumHash(address, stateHash))
-        {
-            addressServers_[address] = uri;
-            ABC_DebugLog("%s: %s subscribe reply (dirty) %s",
-                         uri.c_str(), address.c_str(), stateHash.c_str());
-        }
-        else
+        stateHashes_[std::make_pair(uri, address)] = stateHash;
+
+        for (auto subscriber: subscribers_[address])
         {
-            ABC_DebugLog("%s: %s subscribe reply (clean) %s",
-                         uri.c_str(), address.c_str(), stateHash.c_str());
+            auto i = caches_.find(subscriber);
+            if (caches_.end() == i)
+                continue;
+
+            if (i->second.cache.addresses.updateStratumHash(address, stateHash))
+            {
+                i->second.addressServers[address] = uri;
+                i->second.pending = true;
+                ABC_DebugLog("%s: %s subscribe reply (dirty) %s",
+                             uri.c_str(), address.c_str(), stateHash.c_str());
+            }
+            else
+            {
+                ABC_DebugLog("%s: %s subscribe reply (clean) %s",
+                             uri.c_str(), address.c_str(), stateHash.c_str());
+            }
         }
     };
 
@@ -474,52 +771,64 @@ TxUpdater::subscribeAddress(const std::string &address, IBitcoinConnection *bc)
 }
 
 void
-TxUpdater::fetchAddress(const std::string &address, IBitcoinConnection *bc)
+TxUpdater::fetchAddress(unsigned id, const std::string &address,
+                        IBitcoinConnection *bc)
 {
-    if (wipAddresses_.count(address))
+    auto &info = caches_.at(id);
+    if (info.wipAddresses.count(address))
         return;
-    wipAddresses_.insert(address);
+    info.wipAddresses.insert(address);
 
     const auto uri = bc->uri();
-    auto onError = [this, address, uri](Status s)
+    auto onError = [this, id, address, uri](Status s)
     {
         ABC_DebugLog("%s: %s fetch failed (%s)",
                      uri.c_str(), address.c_str(), s.message().c_str());
         failedServers_.insert(uri);
-        wipAddresses_.erase(address);
+
+        auto i = caches_.find(id);
+        if (caches_.end() != i)
+            i->second.wipAddresses.erase(address);
     };
 
-    auto onReply = [this, address, uri](const AddressHistory &history)
+    auto onReply = [this, id, address, uri](const AddressHistory &history)
     {
         ABC_DebugLog("%s: %s fetched %d TXIDs", uri.c_str(), address.c_str(),
                      history.size());
-        wipAddresses_.erase(address);
-        addressServers_[address] = uri;
+
+        auto i = caches_.find(id);
+        if (caches_.end() == i)
+            return;
+        auto &info = i->second;
+        auto &cache = info.cache;
+        info.wipAddresses.erase(address);
+        info.addressServers[address] = uri;
+        info.pending = true;
 
         TxidSet txids;
         for (auto &row: history)
         {
-            cache_.txs.confirmed(row.first, row.second);
+            cache.txs.confirmed(row.first, row.second);
             txids.insert(row.first);
         }
 
         if (!history.empty())
         {
-            cache_.addresses.update(address, txids);
+            cache.addresses.update(address, txids);
         }
         else
         {
-            std::string hash = cache_.addresses.getStratumHash(address);
+            std::string hash = cache.addresses.getStratumHash(address);
             if (hash.empty())
             {
-                cache_.addresses.update(address, txids);
+                cache.addresses.update(address, txids);
             }
             else
             {
                 ABC_DebugLog("%s: %s SERVER ERROR EMPTY TXIDs with hash %s", uri.c_str(),
                              address.c_str(), hash.c_str());
                 // Do not trust current server. Force a new server.
-                addressServers_[address] = "";
+                info.addressServers[address] = "";
             }
         }
     };
@@ -528,29 +837,39 @@ TxUpdater::fetchAddress(const std::string &address, IBitcoinConnection *bc)
 }
 
 void
-TxUpdater::fetchTx(const std::string &txid, IBitcoinConnection *bc)
+TxUpdater::fetchTx(unsigned id, const std::string &txid,
+                   IBitcoinConnection *bc)
 {
-    if (wipTxids_.count(txid))
+    auto &info = caches_.at(id);
+    if (info.wipTxids.count(txid))
         return;
-    wipTxids_.insert(txid);
+    info.wipTxids.insert(txid);
 
     const auto uri = bc->uri();
-    auto onError = [this, txid, uri](Status s)
+    auto onError = [this, id, txid, uri](Status s)
     {
         ABC_DebugLog("%s: tx %s fetch failed (%s)",
                      uri.c_str(), txid.c_str(), s.message().c_str());
         failedServers_.insert(uri);
-        wipTxids_.erase(txid);
+
+        auto i = caches_.find(id);
+        if (caches_.end() != i)
+            i->second.wipTxids.erase(txid);
     };
 
-    auto onReply = [this, txid, uri](const bc::transaction_type &tx)
+    auto onReply = [this, id, txid, uri](const bc::transaction_type &tx)
     {
         ABC_DebugLog("%s: tx %s fetched", uri.c_str(), txid.c_str());
-        wipTxids_.erase(txid);
 
-        cache_.txs.insert(tx);
-        cache_.addresses.update();
-        cacheDirty = true;
+        auto i = caches_.find(id);
+        if (caches_.end() == i)
+            return;
+        i->second.wipTxids.erase(txid);
+        i->second.pending = true;
+
+        // The next wakeup handles everything that arrived together:
+        i->second.arrivedTxs.push_back(tx);
+        i->second.arrivedTxids.insert(txid);
     };
 
     ABC_DebugLog("%s: tx %s requested", uri.c_str(), txid.c_str());
@@ -597,7 +916,7 @@ TxUpdater::blockHeaderFetch(size_t height, IBitcoinConnection *bc)
         ABC_DebugLog("%s: header %d fetched",
                      uri.c_str(), height);
 
-        cache_.blocks.headerInsert(height, header);
+        blocks_.headerInsert(height, header);
     };
 
     bc->blockHeaderFetch(onError, onReply, height);
@@ -10,27 +10,59 @@
 
 #include "../Typedefs.hpp"
 #include "../../util/Data.hpp"
+#include <bitcoin/bitcoin.hpp>
 #include <zmq.h>
 #include <chrono>
+#include <list>
 #include <map>
+#include <memory>
+#include <set>
+#include <vector>
 
 namespace abcd {
 
+class BlockCache;
 class Cache;
 class IBitcoinConnection;
 class StratumConnection;
 
 /**
- * Syncs a set of transactions with the bitcoin server.
+ * Syncs the transactions for any number of wallets with the bitcoin servers.
+ * Every wallet shares the same pool of server connections,
+ * and replies are routed back to the wallets that asked for them.
  */
 class TxUpdater
 {
 public:
     ~TxUpdater();
-    TxUpdater(Cache &cache, void *ctx);
+    TxUpdater(BlockCache &blockCache, void *ctx);
 
-    void disconnect();
-    Status connect();
+    /**
+     * Begins syncing a wallet's cache.
+     * The id is chosen by the caller, and must not be re-used.
+     */
+    void
+    cacheAdd(unsigned id, Cache &cache);
+
+    /**
+     * Stops syncing a wallet's cache.
+     * Replies still in flight for this wallet will be dropped.
+     */
+    void
+    cacheRemove(unsigned id);
+
+    /**
+     * Tells the updater that a wallet has new work to do.
+     */
+    void
+    cacheWakeup(unsigned id);
+
+    /**
+     * Stops the wallet from holding the server connections open.
+     * The servers disconnect once no wallet wants them.
+     */
+    void disconnect(unsigned id);
+    Status connect(unsigned id);
 
     /**
      * Performs any pending work.
@@ -53,36 +85,119 @@ public:
     sendTx(StatusCallback status, DataSlice tx);
 
 private:
-    Status connectTo(long index);
-
-    Cache &cache_;
+    /**
+     * Per-wallet sync state.
+     */
+    struct CacheInfo
+    {
+        CacheInfo(Cache &cache): cache(cache) {}
+
+        Cache &cache;
+        bool wantConnection = false;
+        time_t lastSave = 0;
+
+        // The wallet needs its address list checked on the next wakeup:
+        bool pending = true;
+        std::chrono::steady_clock::time_point nextCheck;
+
+        // Fetches currently in progress:
+        AddressSet wipAddresses;
+        TxidSet wipTxids;
+
+        // Fetched transactions waiting to go into the cache:
+        std::vector<bc::transaction_type> arrivedTxs;
+        TxidSet arrivedTxids;
+
+        /**
+         * The last server used to query the address.
+         * Used to avoid reusing the same server over and over,
+         * and to fetch transactions from the same server that reported them.
+         */
+        std::map<std::string, std::string> addressServers;
+    };
+
+    BlockCache &blocks_;
     void *ctx_;
 
-    bool wantConnection = false;
-    bool cacheDirty = false;
-    time_t cacheLastSave = 0;
+    std::map<unsigned, CacheInfo> caches_;
+
+    /**
+     * The wallets that want updates for each address.
+     * Several wallets can watch the same address over one subscription.
+     */
+    std::map<std::string, std::set<unsigned>> subscribers_;
+
+    /**
+     * The last state hash each server reported for each address,
+     * so wallets that join an existing subscription can catch up.
+     */
+    std::map<std::pair<std::string, std::string>, std::string> stateHashes_;
 
     std::vector<IBitcoinConnection *> connections_;
     std::vector<std::string> serverList_;
     std::set<int> untriedLibbitcoin_;
     std::set<int> untriedStratum_;
 
-    // Fetches currently in progress:
-    AddressSet wipAddresses_;
-    TxidSet wipTxids_;
+    /**
+     * A stratum connection that has not finished connecting yet.
+     * Several of these race each other, and the first ones to finish win.
+     */
+    struct Connecting
+    {
+        long index;
+        std::chrono::steady_clock::time_point start;
+        std::unique_ptr<StratumConnection> sc;
+    };
+    std::list<Connecting> connecting_;
 
     /**
-     * The last server used to query the address.
-     * Used to avoid reusing the same server over and over,
-     * and to fetch transactions from the same server that reported them.
+     * How long each server took to connect last time,
+     * so the fast ones get picked first.
      */
-    std::map<std::string, std::string> addressServers_;
+    std::map<std::string, std::chrono::milliseconds> connectLatency_;
 
     /**
      * A list of servers that have failed.
      */
     std::set<std::string> failedServers_;
 
+    bool wantConnection() const;
+    void disconnectAll();
+    Status connectAll();
+    Status connectTo(long index);
+
+    /**
+     * Advances the connections that are still in progress.
+     */
+    void
+    connectProgress();
+
+    /**
+     * Sets up a freshly-connected server and adds it to the pool.
+     */
+    Status
+    connectReady(std::unique_ptr<IBitcoinConnection> bc);
+
+    /**
+     * Picks the untried server with the best connection history.
+     */
+    long
+    pickUntried(const std::set<int> &untried);
+
+    /**
+     * Schedules network work for one wallet.
+     * Returns false if the servers were too busy to take all of it.
+     */
+    bool
+    cacheCheck(unsigned id, CacheInfo &info);
+
+    /**
+     * Moves a wallet's fetched transactions into its cache as one batch,
+     * so a burst of arrivals only needs one completion pass.
+     */
+    void
+    cacheArrivals(CacheInfo &info);
+
     /**
      * Finds the requested server, assuming it is even connected and ready.
      * @return The best available server,
@@ -103,13 +218,15 @@ private:
     subscribeHeight(IBitcoinConnection *bc);
 
     void
-    subscribeAddress(const std::string &address, IBitcoinConnection *bc);
+    subscribeAddress(unsigned id, const std::string &address,
+                     IBitcoinConnection *bc);
 
     void
-    fetchAddress(const std::string &address, IBitcoinConnection *bc);
+    fetchAddress(unsigned id, const std::string &address,
+                 IBitcoinConnection *bc);
 
     void
-    fetchTx(const std::string &txid, IBitcoinConnection *bc);
+    fetchTx(unsigned id, const std::string &txid, IBitcoinConnection *bc);
 
     void
     fetchFeeEstimate(size_t blocks, StratumConnection *sc);
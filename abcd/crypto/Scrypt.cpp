@@ -6,12 +6,17 @@
  */
 
 #include "Scrypt.hpp"
+#include "Crypto.hpp"
 #include "Random.hpp"
 #include "../util/Debug.hpp"
+#include "../bitcoin/KeyCache.hpp"
 #include "../bitcoin/Testnet.hpp"
+#include "../util/Parallel.hpp"
+#include "../util/Util.hpp"
 #include "../../minilibs/scrypt/crypto_scrypt.h"
 #include <sys/time.h>
 #include <math.h>
+#include <mutex>
 
 namespace abcd {
 
@@ -29,6 +34,100 @@ namespace abcd {
 
 #define SCRYPT_DEFAULT_SALT_LENGTH 32
 
+// Lanes only run in parallel while their combined working memory fits here:
+#define SCRYPT_PARALLEL_MAX_MEMORY      (256 * 1024 * 1024)
+
+// The result cache never holds more than this many entries:
+#define SCRYPT_CACHE_MAX_ENTRIES        64
+
+/**
+ * Remembers recent hash results, for callers that opt in.
+ * Entries are keyed by an HMAC of the parameters and input,
+ * using a random per-process key, so the cache holds no passwords.
+ * The whole cache gets wiped once its oldest entry reaches the lifetime.
+ */
+struct ScryptCache
+{
+    std::mutex mutex;
+    std::chrono::seconds lifetime{0};
+    std::chrono::steady_clock::time_point start;
+    DataChunk hmacKey;
+    KeyCache results;
+    size_t entries = 0;
+
+    void
+    clear()
+    {
+        results.clear();
+        entries = 0;
+    }
+
+    void
+    expire()
+    {
+        if (entries && start + lifetime < std::chrono::steady_clock::now())
+            clear();
+    }
+};
+static ScryptCache gCache;
+
+/**
+ * Finds the cache key for a hash.
+ * @return false if the cache is off or cannot hold this result.
+ */
+static bool
+scryptCacheKey(std::string &result, const ScryptSnrp &snrp,
+               DataSlice data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(gCache.mutex);
+    if (!gCache.lifetime.count() || size != sizeof(bc::ec_secret))
+        return false;
+
+    const uint64_t params[] = {snrp.salt.size(), snrp.n, snrp.r, snrp.p};
+    const auto paramData = reinterpret_cast<const uint8_t *>(params);
+    const auto digest = hmacSha256(buildData(
+    {
+        snrp.salt, DataSlice(paramData, paramData + sizeof(params)), data
+    }), gCache.hmacKey);
+    result = toString(digest);
+    return true;
+}
+
+Status
+scryptCacheSet(std::chrono::seconds lifetime)
+{
+    DataChunk hmacKey;
+    if (lifetime.count())
+        ABC_CHECK(randomData(hmacKey, SCRYPT_DEFAULT_SALT_LENGTH));
+
+    std::lock_guard<std::mutex> lock(gCache.mutex);
+    gCache.clear();
+    gCache.lifetime = lifetime;
+    gCache.hmacKey = hmacKey;
+    return Status();
+}
+
+void
+scryptCacheClear()
+{
+    std::lock_guard<std::mutex> lock(gCache.mutex);
+    gCache.clear();
+    crypto_scrypt_arena_release();
+}
+
+/**
+ * Spreads scrypt's independent `p` lanes across the thread pool.
+ */
+static void
+scryptForeach(void *ctx, uint32_t count, crypto_scrypt_lane_fn lane,
+              void *state)
+{
+    parallelFor(count, [lane, state](size_t i)
+    {
+        lane(state, i);
+    });
+}
+
 Status
 ScryptSnrp::create()
 {
@@ -45,6 +144,7 @@ ScryptSnrp::create()
     gettimeofday(&timerStart, nullptr);
     ABC_CHECK(hash(temp, salt));
     gettimeofday(&timerEnd, nullptr);
+    crypto_scrypt_arena_release();
 
     // Find the time in microseconds:
     int totalTime = 1000000 * (timerEnd.tv_sec - timerStart.tv_sec);
@@ -108,13 +208,55 @@ ScryptSnrp::create()
 Status
 ScryptSnrp::hash(DataChunk &result, DataSlice data, size_t size) const
 {
+    // Check the cache:
+    std::string cacheKey;
+    const bool cached = scryptCacheKey(cacheKey, *this, data, size);
+    if (cached)
+    {
+        std::lock_guard<std::mutex> lock(gCache.mutex);
+        gCache.expire();
+
+        bc::ec_secret secret;
+        if (gCache.results.find(secret, cacheKey))
+        {
+            result = DataChunk(secret.begin(), secret.end());
+            return Status();
+        }
+    }
+
     DataChunk out(size);
 
-    int rc = crypto_scrypt(data.data(), data.size(),
-                           salt.data(), salt.size(), n, r, p, out.data(), size);
+    // Run independent lanes on separate threads if the memory allows:
+    crypto_scrypt_foreach_fn foreach = nullptr;
+    if (1 < p && n * 128 * r * p <= SCRYPT_PARALLEL_MAX_MEMORY)
+        foreach = scryptForeach;
+
+    int rc = crypto_scrypt_foreach(data.data(), data.size(),
+                                   salt.data(), salt.size(), n, r, p,
+                                   out.data(), size, foreach, nullptr);
     if (rc)
         return ABC_ERROR(ABC_CC_ScryptError, "Error calculating Scrypt hash");
 
+    // Remember the result, unless the cache was turned off in the meantime:
+    if (cached)
+    {
+        std::lock_guard<std::mutex> lock(gCache.mutex);
+        if (gCache.lifetime.count())
+        {
+            gCache.expire();
+            if (SCRYPT_CACHE_MAX_ENTRIES <= gCache.entries)
+                gCache.clear();
+            if (!gCache.entries)
+                gCache.start = std::chrono::steady_clock::now();
+
+            bc::ec_secret secret;
+            std::copy(out.begin(), out.end(), secret.begin());
+            gCache.results.insert(cacheKey, secret);
+            ++gCache.entries;
+            ABC_UtilGuaranteedMemset(secret.data(), 0, secret.size());
+        }
+    }
+
     result = std::move(out);
     return Status();
 }
@@ -10,6 +10,7 @@
 
 #include "../util/Data.hpp"
 #include "../util/Status.hpp"
+#include <chrono>
 
 namespace abcd {
 
@@ -39,6 +40,23 @@ struct ScryptSnrp
     hash(DataChunk &result, DataSlice data, size_t size=scryptDefaultSize) const;
 };
 
+/**
+ * Lets `ScryptSnrp::hash` remember its results for up to `lifetime`,
+ * so repeating a hash within a session returns immediately.
+ * The results live in locked memory, and are keyed by a digest
+ * rather than the input itself.
+ * A lifetime of zero turns the cache off, which is the default.
+ */
+Status
+scryptCacheSet(std::chrono::seconds lifetime);
+
+/**
+ * Wipes any cached scrypt results,
+ * along with the working memory the calling thread keeps between hashes.
+ */
+void
+scryptCacheClear();
+
 /**
  * Returns the fixed SNRP value used for the username.
  */
@@ -11,9 +11,25 @@
 #include <pthread.h>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 namespace abcd {
 
+// Idle handles beyond this many per pool are closed:
+#define HTTP_POOL_IDLE_MAX 4
+
+/**
+ * Idle handles, plus the DNS and TLS session caches they share.
+ */
+struct HttpPoolState
+{
+    std::mutex mutex;
+    std::vector<CURL *> idle;
+
+    CURLSH *share = nullptr;
+    std::mutex shareMutexes[CURL_LOCK_DATA_LAST];
+};
+
 /**
  * Manages the cURL library global memory lifetime.
  */
@@ -23,6 +39,7 @@ struct HttpSingleton
     HttpSingleton();
 
     std::unique_ptr<std::mutex[]> mutexes;
+    HttpPoolState pools[2];
     Status status;
 };
 
@@ -48,8 +65,34 @@ sslThreadIdCallback(CRYPTO_THREADID *id)
 #endif
 }
 
+static void
+shareLockCallback(CURL *handle, curl_lock_data data, curl_lock_access access,
+                  void *userp)
+{
+    static_cast<HttpPoolState *>(userp)->shareMutexes[data].lock();
+}
+
+static void
+shareUnlockCallback(CURL *handle, curl_lock_data data, void *userp)
+{
+    static_cast<HttpPoolState *>(userp)->shareMutexes[data].unlock();
+}
+
+static HttpPoolState &
+poolState(HttpPool pool)
+{
+    return gSingleton.pools[static_cast<int>(pool)];
+}
+
 HttpSingleton::~HttpSingleton()
 {
+    for (auto &pool: pools)
+    {
+        for (auto handle: pool.idle)
+            curl_easy_cleanup(handle);
+        if (pool.share)
+            curl_share_cleanup(pool.share);
+    }
     curl_global_cleanup();
 }
 
@@ -62,7 +105,30 @@ HttpSingleton::HttpSingleton()
 
     // Initialize cURL:
     if (curl_global_init(CURL_GLOBAL_DEFAULT))
+    {
         status = ABC_ERROR(ABC_CC_Error, "Cannot initialize cURL");
+        return;
+    }
+
+    // Connection pools:
+    for (auto &pool: pools)
+    {
+        pool.share = curl_share_init();
+        if (!pool.share ||
+                curl_share_setopt(pool.share, CURLSHOPT_LOCKFUNC,
+                                  shareLockCallback) ||
+                curl_share_setopt(pool.share, CURLSHOPT_UNLOCKFUNC,
+                                  shareUnlockCallback) ||
+                curl_share_setopt(pool.share, CURLSHOPT_USERDATA, &pool) ||
+                curl_share_setopt(pool.share, CURLSHOPT_SHARE,
+                                  CURL_LOCK_DATA_DNS) ||
+                curl_share_setopt(pool.share, CURLSHOPT_SHARE,
+                                  CURL_LOCK_DATA_SSL_SESSION))
+        {
+            status = ABC_ERROR(ABC_CC_Error, "Cannot create cURL share");
+            return;
+        }
+    }
 }
 
 Status
@@ -71,4 +137,53 @@ httpInit()
     return gSingleton.status;
 }
 
+Status
+httpHandleAcquire(CURL *&result, HttpPool pool)
+{
+    ABC_CHECK(gSingleton.status);
+    auto &state = poolState(pool);
+
+    CURL *handle = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (!state.idle.empty())
+        {
+            handle = state.idle.back();
+            state.idle.pop_back();
+        }
+    }
+    if (!handle)
+        handle = curl_easy_init();
+    if (!handle)
+        return ABC_ERROR(ABC_CC_Error, "cURL failed create handle");
+
+    if (curl_easy_setopt(handle, CURLOPT_SHARE, state.share))
+    {
+        curl_easy_cleanup(handle);
+        return ABC_ERROR(ABC_CC_Error, "cURL failed to set share");
+    }
+
+    result = handle;
+    return Status();
+}
+
+void
+httpHandleRelease(CURL *handle, HttpPool pool)
+{
+    // Drop the old options, which may point at freed request data,
+    // but keep the connection cache:
+    curl_easy_reset(handle);
+
+    auto &state = poolState(pool);
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.idle.size() < HTTP_POOL_IDLE_MAX)
+        {
+            state.idle.push_back(handle);
+            return;
+        }
+    }
+    curl_easy_cleanup(handle);
+}
+
 } // namespace abcd
@@ -9,6 +9,7 @@
 #define ABCD_HTTP_HTTP_HPP
 
 #include "../util/Status.hpp"
+#include <curl/curl.h>
 
 namespace abcd {
 
@@ -18,6 +19,31 @@ namespace abcd {
 Status
 httpInit();
 
+/**
+ * Handles in the same pool share open connections, TLS sessions,
+ * and DNS results. Requests using certificate pinning get their own pool,
+ * so they never pick up a connection that skipped the pinning check.
+ */
+enum class HttpPool
+{
+    general,
+    pinned
+};
+
+/**
+ * Borrows an idle cURL handle from the pool, or creates a new one.
+ * The handle has default options, apart from its pool's share.
+ */
+Status
+httpHandleAcquire(CURL *&result, HttpPool pool);
+
+/**
+ * Resets a cURL handle and returns it to the pool,
+ * keeping its open connections alive for the next request.
+ */
+void
+httpHandleRelease(CURL *handle, HttpPool pool);
+
 } // namespace abcd
 
 #endif
@@ -8,6 +8,7 @@
 #include "HttpRequest.hpp"
 #include "../Context.hpp"
 #include "../util/Debug.hpp"
+#include <algorithm>
 
 namespace abcd {
 
@@ -65,6 +66,36 @@ curlDataCallback(void *data, size_t memberSize, size_t numMembers,
     return size;
 }
 
+/**
+ * Splits cURL's cumulative timers into per-phase durations.
+ */
+static Status
+curlTiming(HttpTiming &result, CURL *handle)
+{
+    double dns, connect, tls, firstByte, total;
+    long connects;
+    ABC_CHECK_CURL(curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME, &dns));
+    ABC_CHECK_CURL(curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME, &connect));
+    ABC_CHECK_CURL(curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME, &tls));
+    ABC_CHECK_CURL(curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME,
+                                     &firstByte));
+    ABC_CHECK_CURL(curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total));
+    ABC_CHECK_CURL(curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects));
+
+    // Each timer is zero if its phase never happened:
+    connect = std::max(connect, dns);
+    tls = std::max(tls, connect);
+    firstByte = std::max(firstByte, tls);
+
+    result.dns = 1000 * dns;
+    result.connect = 1000 * (connect - dns);
+    result.tls = 1000 * (tls - connect);
+    result.firstByte = 1000 * (firstByte - tls);
+    result.total = 1000 * total;
+    result.reused = !connects;
+    return Status();
+}
+
 Status
 HttpReply::codeOk() const
 {
@@ -76,12 +107,13 @@ HttpReply::codeOk() const
 
 HttpRequest::~HttpRequest()
 {
-    if (handle_) curl_easy_cleanup(handle_);
+    if (handle_) httpHandleRelease(handle_, pool_);
     if (headers_) curl_slist_free_all(headers_);
 }
 
-HttpRequest::HttpRequest():
+HttpRequest::HttpRequest(HttpPool pool):
     handle_(nullptr),
+    pool_(pool),
     headers_(nullptr)
 {
     status_ = init();
@@ -130,13 +162,19 @@ HttpRequest::get(HttpReply &result, const std::string &url)
 
     // Make the request:
     ABC_CHECK_CURL(curl_easy_perform(handle_));
-    ABC_CHECK_CURL(curl_easy_getinfo(handle_, CURLINFO_RESPONSE_CODE,
-                                     &result.code));
-    if (result.codeOk())
-        ABC_DebugLog("%s (%d)", url.c_str(), result.code);
-    else
-        ABC_DebugLog("%s (%d)\n%s", url.c_str(), result.code,
-                     result.body.c_str());
+    long code;
+    ABC_CHECK_CURL(curl_easy_getinfo(handle_, CURLINFO_RESPONSE_CODE, &code));
+    result.code = code;
+    // The reply is already in, so missing timing data isn't fatal:
+    curlTiming(result.timing, handle_).log();
+
+    const auto &t = result.timing;
+    ABC_DebugLog("%s (%d) %.0f ms: dns %.0f, connect %.0f, tls %.0f, "
+                 "first byte %.0f%s", url.c_str(), result.code, t.total,
+                 t.dns, t.connect, t.tls, t.firstByte,
+                 t.reused ? " (reused)" : "");
+    if (!result.codeOk())
+        ABC_DebugLog("%s", result.body.c_str());
 
     return Status();
 }
@@ -167,13 +205,12 @@ HttpRequest::request(HttpReply &result, const std::string &url,
 Status
 HttpRequest::init()
 {
-    handle_ = curl_easy_init();
-    if (!handle_)
-        return ABC_ERROR(ABC_CC_Error, "cURL failed create handle");
+    ABC_CHECK(httpHandleAcquire(handle_, pool_));
 
     // Basic options:
     ABC_CHECK_CURL(curl_easy_setopt(handle_, CURLOPT_NOSIGNAL, 1));
     ABC_CHECK_CURL(curl_easy_setopt(handle_, CURLOPT_CONNECTTIMEOUT, TIMEOUT));
+    ABC_CHECK_CURL(curl_easy_setopt(handle_, CURLOPT_TCP_KEEPALIVE, 1L));
 
     const auto certPath = gContext->paths.certPath();
     if (!certPath.empty())
@@ -8,17 +8,35 @@
 #ifndef ABCD_HTTP_HTTP_REQUEST_HPP
 #define ABCD_HTTP_HTTP_REQUEST_HPP
 
+#include "Http.hpp"
 #include "../util/Status.hpp"
 #include <curl/curl.h>
 
 namespace abcd {
 
+/**
+ * How long each phase of a request took, in milliseconds.
+ * Phases skipped thanks to a reused connection come out as zero.
+ */
+struct HttpTiming
+{
+    double dns = 0;
+    double connect = 0;
+    double tls = 0;
+    double firstByte = 0;
+    double total = 0;
+    /** True if the request went out over an already-open connection. */
+    bool reused = false;
+};
+
 struct HttpReply
 {
     /** The HTTP status code. */
     int code;
     /** The returned message body. */
     std::string body;
+    /** Where the time went. */
+    HttpTiming timing;
 
     /**
      * Verifies that the response code is in the 200 range.
@@ -29,12 +47,14 @@ struct HttpReply
 
 /**
  * A class for building up and making HTTP requests.
+ * The underlying cURL handles come from a shared pool,
+ * so requests to the same host can reuse an open connection.
  */
 class HttpRequest
 {
 public:
     ~HttpRequest();
-    HttpRequest();
+    HttpRequest(HttpPool pool=HttpPool::general);
 
     /**
      * Enables verbose debugging on the HTTP request.
@@ -73,6 +93,7 @@ protected:
     CURL *handle_;
 
 private:
+    HttpPool pool_;
     struct curl_slist *headers_;
 
     Status init();
@@ -127,16 +127,23 @@ JsonPtr::load(const std::string &path, DataSlice dataKey)
 
     DataChunk data;
     ABC_CHECK(box.decrypt(data, dataKey));
-    ABC_CHECK(decode(toString(data)));
+    ABC_CHECK(decode(DataSlice(data)));
 
     return Status();
 }
 
 Status
 JsonPtr::decode(const std::string &data)
+{
+    return decode(DataSlice(data));
+}
+
+Status
+JsonPtr::decode(DataSlice data)
 {
     json_error_t error;
-    json_t *root = json_loadb(data.data(), data.size(), loadFlags, &error);
+    json_t *root = json_loadb(reinterpret_cast<const char *>(data.data()),
+                              data.size(), loadFlags, &error);
     if (!root)
         return ABC_ERROR(ABC_CC_JSONError, error.text);
     reset(root);
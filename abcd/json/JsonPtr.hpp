@@ -68,6 +68,8 @@ public:
      */
     Status
     decode(const std::string &data);
+    Status
+    decode(DataSlice data);
 
     /**
      * Saves the JSON object to disk.
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "AuthTask.hpp"
+#include "../crypto/Scrypt.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+namespace abcd {
+
+struct AuthTask::State
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool cancelled = false;
+    bool done = false;
+
+    // Results, guarded by `done`:
+    Status status;
+    DataChunk authKey;
+    AuthError authError;
+};
+
+AuthTask::~AuthTask()
+{
+    cancel();
+}
+
+AuthTask::AuthTask(const std::string &secret, Request request):
+    state_(std::make_shared<State>())
+{
+    try
+    {
+        std::thread(run, state_, secret, request).detach();
+    }
+    catch (const std::system_error &)
+    {
+        // No thread to spare, so just do the work now:
+        run(state_, secret, std::move(request));
+    }
+}
+
+void
+AuthTask::cancel()
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->cancelled = true;
+}
+
+Status
+AuthTask::wait(DataChunk &authKey, AuthError &authError)
+{
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->cv.wait(lock, [this]()
+    {
+        return state_->done;
+    });
+
+    authError = state_->authError;
+    ABC_CHECK(state_->status);
+    authKey = state_->authKey;
+    return Status();
+}
+
+Status
+AuthTask::steps(State &state, const std::string &secret, Request &request)
+{
+    auto cancelled = [&state]()
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return state.cancelled;
+    };
+
+    // Nothing else touches the results until `done` is set:
+    if (cancelled())
+        return ABC_ERROR(ABC_CC_Error, "Login task cancelled");
+    ABC_CHECK(usernameSnrp().hash(state.authKey, secret));
+
+    if (!request)
+        return Status();
+    if (cancelled())
+        return ABC_ERROR(ABC_CC_Error, "Login task cancelled");
+    ABC_CHECK(request(state.authKey, state.authError));
+
+    return Status();
+}
+
+void
+AuthTask::run(std::shared_ptr<State> state, std::string secret,
+              Request request)
+{
+    state->status = steps(*state, secret, request);
+
+    // Release anything the request captured before handing over:
+    request = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->done = true;
+    }
+    state->cv.notify_all();
+}
+
+} // namespace abcd
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#ifndef ABCD_LOGIN_AUTH_TASK_HPP
+#define ABCD_LOGIN_AUTH_TASK_HPP
+
+#include "server/LoginServer.hpp"
+#include "../util/Data.hpp"
+#include "../util/Status.hpp"
+#include <functional>
+#include <memory>
+
+namespace abcd {
+
+/**
+ * The server half of a login, running on a background thread.
+ * The task hashes a secret with the username SNRP,
+ * then passes the result to a server request, if there is one.
+ * This lets the scrypt work and network round-trip overlap with
+ * whatever the caller does locally in the meantime.
+ * If the system has no thread to spare, the constructor does the work itself.
+ *
+ * Destroying the task cancels it without waiting,
+ * so the request must only capture things it owns (such as `shared_ptr`s).
+ * A cancelled task skips any steps it has not started yet.
+ */
+class AuthTask
+{
+public:
+    typedef std::function<Status (DataSlice authKey, AuthError &authError)>
+    Request;
+
+    ~AuthTask();
+    AuthTask(const std::string &secret, Request request);
+    AuthTask(const AuthTask &) = delete;
+    AuthTask &operator=(const AuthTask &) = delete;
+
+    /**
+     * Tells the task its result is no longer needed.
+     */
+    void
+    cancel();
+
+    /**
+     * Blocks until the task is done.
+     * @param authKey receives the username-SNRP hash, for callers that
+     * need it again later, so they don't need to repeat the scrypt.
+     */
+    Status
+    wait(DataChunk &authKey, AuthError &authError);
+
+private:
+    struct State;
+    std::shared_ptr<State> state_;
+
+    static Status
+    steps(State &state, const std::string &secret, Request &request);
+
+    static void
+    run(std::shared_ptr<State> state, std::string secret, Request request);
+};
+
+} // namespace abcd
+
+#endif
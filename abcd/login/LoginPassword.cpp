@@ -6,6 +6,7 @@
  */
 
 #include "LoginPassword.hpp"
+#include "AuthTask.hpp"
 #include "Login.hpp"
 #include "LoginPackages.hpp"
 #include "LoginStore.hpp"
@@ -45,23 +46,16 @@ loginPasswordDisk(std::shared_ptr<Login> &result,
     return Status();
 }
 
+/**
+ * Finishes a server login, once the login package has arrived.
+ */
 static Status
 loginPasswordServer(std::shared_ptr<Login> &result,
                     LoginStore &store, const std::string &password,
-                    AuthError &authError)
+                    LoginJson loginJson)
 {
     const auto LP = store.username() + password;
 
-    // Create passwordAuth:
-    DataChunk passwordAuth;
-    ABC_CHECK(usernameSnrp().hash(passwordAuth, LP));
-
-    // Grab the login information from the server:
-    AuthJson authJson;
-    LoginJson loginJson;
-    ABC_CHECK(authJson.passwordSet(store, passwordAuth));
-    ABC_CHECK(loginServerLogin(loginJson, authJson, &authError));
-
     // Unlock passwordBox:
     DataChunk passwordKey;
     DataChunk dataKey;
@@ -78,10 +72,31 @@ loginPassword(std::shared_ptr<Login> &result,
               LoginStore &store, const std::string &password,
               AuthError &authError)
 {
+    const auto LP = store.username() + password;
+
+    // Start on the server's scrypt right away,
+    // so a failed disk login doesn't leave the user waiting twice.
+    // The server only hears about the login if the disk can't handle it:
+    AuthTask hash(LP, nullptr);
+
     // Try the login both ways:
-    if (!loginPasswordDisk(result, store, password))
-        ABC_CHECK(loginPasswordServer(result, store, password, authError));
+    if (loginPasswordDisk(result, store, password))
+    {
+        hash.cancel();
+        return Status();
+    }
+
+    DataChunk passwordAuth;
+    ABC_CHECK(hash.wait(passwordAuth, authError));
+
+    AuthJson authJson;
+    LoginJson loginJson;
+    ABC_CHECK(authJson.passwordSet(store, passwordAuth));
+    ABC_CHECK(loginServerLogin(loginJson, authJson, &authError));
+    ABC_CHECK(loginPasswordServer(result, store, password, loginJson));
 
+    // Keep the hash, so recovery and PIN setup can use it:
+    ABC_CHECK(result->passwordAuthSet(passwordAuth));
     return Status();
 }
 
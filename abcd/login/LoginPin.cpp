@@ -6,6 +6,7 @@
  */
 
 #include "LoginPin.hpp"
+#include "AuthTask.hpp"
 #include "Login.hpp"
 #include "LoginPackages.hpp"
 #include "LoginStore.hpp"
@@ -81,20 +82,28 @@ loginPin(std::shared_ptr<Login> &result,
     DataChunk pinAuthId;
     ABC_CHECK(local.pinAuthIdDecode(pinAuthId));
 
-    // Get EPINK from the server:
-    std::string EPINK;
+    // Get EPINK from the server, in the background:
+    auto EPINK = std::make_shared<std::string>();
+    AuthTask server(LPIN, [pinAuthId, EPINK](DataSlice pinAuthKey,
+                    AuthError &authError)
+    {
+        ABC_CHECK(loginServerGetPinPackage(pinAuthId, pinAuthKey, *EPINK,
+                                           authError));
+        return Status();
+    });
+
+    // Meanwhile, make the key that unlocks pinKey:
+    DataChunk pinKeyKey;        // Unlocks pinKey
+    ABC_CHECK(carePackage.passwordKeySnrp().hash(pinKeyKey, LPIN));
+
     DataChunk pinAuthKey;       // Unlocks the server
     JsonBox pinKeyBox;          // Holds pinKey
-    ABC_CHECK(usernameSnrp().hash(pinAuthKey, LPIN));
-    ABC_CHECK(loginServerGetPinPackage(pinAuthId, pinAuthKey, EPINK,
-                                       authError));
-    ABC_CHECK(pinKeyBox.decode(EPINK));
+    ABC_CHECK(server.wait(pinAuthKey, authError));
+    ABC_CHECK(pinKeyBox.decode(*EPINK));
 
     // Decrypt dataKey:
-    DataChunk pinKeyKey;        // Unlocks pinKey
     DataChunk pinKey;           // Unlocks dataKey
     DataChunk dataKey;          // Unlocks the account
-    ABC_CHECK(carePackage.passwordKeySnrp().hash(pinKeyKey, LPIN));
     ABC_CHECK(pinKeyBox.decrypt(pinKey, pinKeyKey));
     ABC_CHECK(local.pinBox().decrypt(dataKey, pinKey));
 
@@ -20,7 +20,8 @@ curlSslCallback(CURL *curl, void *ssl_ctx, void *userptr)
     return CURLE_OK;
 }
 
-AirbitzRequest::AirbitzRequest()
+AirbitzRequest::AirbitzRequest():
+    HttpRequest(HttpPool::pinned)
 {
     if (!status_)
         return;
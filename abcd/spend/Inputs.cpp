@@ -18,9 +18,31 @@ namespace abcd {
 
 static std::map<bc::data_chunk, std::string> address_map;
 
+Status
+KeyTableProvider::key(bc::ec_secret &result, bool &compressed,
+                      const std::string &address)
+{
+    auto key = keys_.find(address);
+    if (key == keys_.end())
+        return ABC_ERROR(ABC_CC_Error, "Missing signing key");
+
+    result = bc::wif_to_secret(key->second);
+    compressed = bc::is_wif_compressed(key->second);
+    return Status();
+}
+
+Status
+AddressDbKeyProvider::key(bc::ec_secret &result, bool &compressed,
+                          const std::string &address)
+{
+    ABC_CHECK(addresses_.key(result, address));
+    compressed = true;
+    return Status();
+}
+
 Status
 signTx(bc::transaction_type &result, const TxCache &txCache,
-       const KeyTable &keys)
+       KeyProvider &keys)
 {
     for (size_t i = 0; i < result.inputs.size(); ++i)
     {
@@ -37,12 +59,10 @@ signTx(bc::transaction_type &result, const TxCache &txCache,
             return ABC_ERROR(ABC_CC_Error, "Invalid address");
 
         // Find the elliptic curve key for this input:
-        auto key = keys.find(pa.encoded());
-        if (key == keys.end())
-            return ABC_ERROR(ABC_CC_Error, "Missing signing key");
-        bc::ec_secret secret = bc::wif_to_secret(key->second);
-        bc::ec_point pubkey = bc::secret_to_public_key(secret,
-                              bc::is_wif_compressed(key->second));
+        bc::ec_secret secret;
+        bool compressed;
+        ABC_CHECK(keys.key(secret, compressed, pa.encoded()));
+        bc::ec_point pubkey = bc::secret_to_public_key(secret, compressed);
 
         // Generate the signature for this input:
         auto sig_hash = bc::script_type::generate_signature_hash(
@@ -15,6 +15,7 @@
 
 namespace abcd {
 
+class AddressDb;
 class TxCache;
 
 /**
@@ -22,12 +23,64 @@ class TxCache;
  */
 typedef std::map<const std::string, std::string> KeyTable;
 
+/**
+ * Supplies private keys for signing.
+ * Only the addresses a transaction actually spends from get looked up.
+ */
+class KeyProvider
+{
+public:
+    virtual ~KeyProvider() {}
+
+    /**
+     * Finds the private key for an address.
+     * @param compressed set to true if the public key should be compressed.
+     */
+    virtual Status
+    key(bc::ec_secret &result, bool &compressed,
+        const std::string &address) = 0;
+};
+
+/**
+ * Supplies keys from a fixed table, such as the one for a sweep.
+ */
+class KeyTableProvider:
+    public KeyProvider
+{
+public:
+    KeyTableProvider(const KeyTable &keys): keys_(keys) {}
+
+    Status
+    key(bc::ec_secret &result, bool &compressed,
+        const std::string &address) override;
+
+private:
+    const KeyTable &keys_;
+};
+
+/**
+ * Supplies keys for a wallet's own addresses, deriving them as needed.
+ */
+class AddressDbKeyProvider:
+    public KeyProvider
+{
+public:
+    AddressDbKeyProvider(AddressDb &addresses): addresses_(addresses) {}
+
+    Status
+    key(bc::ec_secret &result, bool &compressed,
+        const std::string &address) override;
+
+private:
+    AddressDb &addresses_;
+};
+
 /**
  * Fills the transaction's inputs with signatures.
  */
 Status
 signTx(bc::transaction_type &result, const TxCache &txCache,
-       const KeyTable &keys);
+       KeyProvider &keys);
 
 /**
  * Select a utxo collection that will satisfy the outputs as best possible
@@ -156,7 +156,7 @@ Spend::signTx(DataChunk &result)
     ABC_CHECK(makeTx(tx, changeAddress.address));
 
     // Sign the transaction:
-    KeyTable keys = wallet_.addresses.keyTable();
+    AddressDbKeyProvider keys(wallet_.addresses);
     ABC_CHECK(abcd::signTx(tx, wallet_.cache.txs, keys));
     result.resize(satoshi_raw_size(tx));
     bc::satoshi_save(tx, result.begin());
@@ -41,6 +41,8 @@ sweepSend(Wallet &wallet,
         Status().toError(info.status, ABC_HERE());
         info.szWalletUUID = wallet.id().c_str();
         info.szTxID = nullptr;
+        info.aszTxIDs = nullptr;
+        info.countTxIDs = 0;
         info.sweepSatoshi = 0;
         fCallback(&info);
 
@@ -69,7 +71,8 @@ sweepSend(Wallet &wallet,
     // Now sign that:
     KeyTable keys;
     keys[address] = wif;
-    ABC_CHECK(signTx(tx, wallet.cache.txs, keys));
+    KeyTableProvider provider(keys);
+    ABC_CHECK(signTx(tx, wallet.cache.txs, provider));
 
     // Send:
     bc::data_chunk raw_tx(satoshi_raw_size(tx));
@@ -108,6 +111,8 @@ sweepSend(Wallet &wallet,
     Status().toError(async.status, ABC_HERE());
     async.szWalletUUID = wallet.id().c_str();
     async.szTxID = info.txid.c_str();
+    async.aszTxIDs = nullptr;
+    async.countTxIDs = 0;
     async.sweepSatoshi = balance;
     fCallback(&async);
 
@@ -130,6 +135,8 @@ sweepOnComplete(Wallet &wallet,
         s.toError(info.status, ABC_HERE());
         info.szWalletUUID = wallet.id().c_str();
         info.szTxID = nullptr;
+        info.aszTxIDs = nullptr;
+        info.countTxIDs = 0;
         info.sweepSatoshi = 0;
         fCallback(&info);
     }
@@ -8,8 +8,10 @@
 #include "FileIO.hpp"
 #include "Debug.hpp"
 #include <dirent.h>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <mutex>
@@ -32,6 +34,24 @@ fileIsJson(const std::string &name)
     return 5 <= name.size() && std::equal(name.end() - 5, name.end(), ".json");
 }
 
+std::vector<std::string>
+fileListJson(const std::string &dir)
+{
+    std::vector<std::string> out;
+
+    DIR *handle = opendir(dir.c_str());
+    if (handle)
+    {
+        struct dirent *de;
+        while (nullptr != (de = readdir(handle)))
+            if (fileIsJson(de->d_name))
+                out.push_back(de->d_name);
+        closedir(handle);
+    }
+
+    return out;
+}
+
 Status
 fileEnsureDir(const std::string &dir)
 {
@@ -103,6 +123,102 @@ fileSave(DataSlice data, const std::string &path)
     return Status();
 }
 
+/**
+ * Flushes a directory, so renames inside it survive a crash.
+ */
+static Status
+fileSyncDir(const std::string &path)
+{
+    const auto slash = path.rfind('/');
+    const auto dir = std::string::npos == slash ? "." :
+                     slash ? path.substr(0, slash) : "/";
+
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0)
+        return ABC_ERROR(ABC_CC_FileOpenError, "Cannot open " + dir);
+
+    if (fsync(fd))
+    {
+        ::close(fd);
+        return ABC_ERROR(ABC_CC_FileWriteError, "Cannot flush " + dir);
+    }
+
+    ::close(fd);
+    return Status();
+}
+
+Status
+fileSaveSync(DataSlice data, const std::string &path)
+{
+    ABC_DebugLog("Writing file %s", path.c_str());
+
+    const auto pathTmp = path + ".tmp";
+    int fd = ::open(pathTmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return ABC_ERROR(ABC_CC_FileOpenError,
+                         "Cannot open " + pathTmp + " for writing");
+
+    const uint8_t *p = data.data();
+    size_t left = data.size();
+    while (left)
+    {
+        ssize_t written = write(fd, p, left);
+        if (written < 0)
+        {
+            ::close(fd);
+            return ABC_ERROR(ABC_CC_FileWriteError, "Cannot write " + pathTmp);
+        }
+        p += written;
+        left -= written;
+    }
+
+    // The data must be on disk before the rename makes it visible:
+    if (fsync(fd))
+    {
+        ::close(fd);
+        return ABC_ERROR(ABC_CC_FileWriteError, "Cannot flush " + pathTmp);
+    }
+    ::close(fd);
+
+    if (rename(pathTmp.c_str(), path.c_str()))
+        return ABC_ERROR(ABC_CC_FileWriteError,
+                         "Cannot rename " + pathTmp + " to " + path);
+
+    return fileSyncDir(path);
+}
+
+Status
+fileAppend(DataSlice data, const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+        return ABC_ERROR(ABC_CC_FileOpenError,
+                         "Cannot open " + path + " for writing");
+
+    const uint8_t *p = data.data();
+    size_t left = data.size();
+    while (left)
+    {
+        ssize_t written = write(fd, p, left);
+        if (written < 0)
+        {
+            ::close(fd);
+            return ABC_ERROR(ABC_CC_FileWriteError, "Cannot write " + path);
+        }
+        p += written;
+        left -= written;
+    }
+
+    if (fsync(fd))
+    {
+        ::close(fd);
+        return ABC_ERROR(ABC_CC_FileWriteError, "Cannot flush " + path);
+    }
+
+    ::close(fd);
+    return Status();
+}
+
 static Status
 fileDeleteRecursive(const std::string &path)
 {
@@ -163,5 +279,60 @@ fileTime(time_t &result, const std::string &path)
     return Status();
 }
 
+FileMap::FileMap():
+    data_(nullptr),
+    size_(0)
+{
+}
+
+FileMap::~FileMap()
+{
+    close();
+}
+
+Status
+FileMap::open(const std::string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return ABC_ERROR(ABC_CC_FileOpenError,
+                         "Cannot open " + path + " for reading");
+
+    struct stat statInfo;
+    if (fstat(fd, &statInfo))
+    {
+        ::close(fd);
+        return ABC_ERROR(ABC_CC_FileReadError, "Could not stat file " + path);
+    }
+
+    // Zero-length mappings are not allowed, so leave empty files unmapped:
+    if (statInfo.st_size)
+    {
+        void *data = mmap(nullptr, statInfo.st_size, PROT_READ, MAP_PRIVATE,
+                          fd, 0);
+        if (MAP_FAILED == data)
+        {
+            ::close(fd);
+            return ABC_ERROR(ABC_CC_FileReadError, "Cannot map " + path);
+        }
+        data_ = static_cast<const uint8_t *>(data);
+        size_ = statInfo.st_size;
+    }
+
+    ::close(fd);
+    return Status();
+}
+
+void
+FileMap::close()
+{
+    if (data_)
+        munmap(const_cast<uint8_t *>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
 } // namespace abcd
 
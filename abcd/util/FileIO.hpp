@@ -15,6 +15,7 @@
 #include "Data.hpp"
 #include "Status.hpp"
 #include <time.h>
+#include <vector>
 
 namespace abcd {
 
@@ -30,6 +31,13 @@ fileSlashify(const std::string &path);
 bool
 fileIsJson(const std::string &name);
 
+/**
+ * Lists the ".json" files in a directory, without the directory part.
+ * A missing directory has no files.
+ */
+std::vector<std::string>
+fileListJson(const std::string &dir);
+
 /**
  * Ensures that a directory exists, creating it if not.
  */
@@ -54,6 +62,20 @@ fileLoad(DataChunk &result, const std::string &path);
 Status
 fileSave(DataSlice data, const std::string &path);
 
+/**
+ * Same as `fileSave`, but does not return until the new contents
+ * and the rename that installs them have been flushed to storage.
+ */
+Status
+fileSaveSync(DataSlice data, const std::string &path);
+
+/**
+ * Appends data to the end of a file, creating it if needed.
+ * Does not return until the data has been flushed to storage.
+ */
+Status
+fileAppend(DataSlice data, const std::string &path);
+
 /**
  * Deletes a file recursively.
  */
@@ -66,6 +88,38 @@ fileDelete(const std::string &path);
 Status
 fileTime(time_t &result, const std::string &path);
 
+/**
+ * A read-only memory mapping of a file.
+ * The contents remain valid until the map is destroyed or re-opened.
+ */
+class FileMap
+{
+public:
+    FileMap();
+    ~FileMap();
+
+    FileMap(const FileMap &) = delete;
+    FileMap &operator=(const FileMap &) = delete;
+
+    /**
+     * Maps the file at the given path into memory.
+     */
+    Status
+    open(const std::string &path);
+
+    /**
+     * Releases the mapping, if any.
+     */
+    void
+    close();
+
+    DataSlice data() const { return DataSlice(data_, data_ + size_); }
+
+private:
+    const uint8_t *data_;
+    size_t size_;
+};
+
 } // namespace abcd
 
 #endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "Parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace abcd {
+
+// Mostly file I/O and crypto, so a few threads go a long way:
+constexpr size_t threadsMaximum = 8;
+
+static std::atomic<size_t> gThreads(0);
+
+// Extra threads running across all calls, including nested ones:
+static std::atomic<size_t> gExtra(0);
+
+void
+parallelLimitSet(size_t threads)
+{
+    gThreads = threads;
+}
+
+void
+parallelFor(size_t count, const std::function<void (size_t i)> &work)
+{
+    size_t threads = gThreads;
+    if (!threads)
+        threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                   threadsMaximum);
+
+    // Every thread pulls the next item until they are all taken:
+    std::atomic<size_t> next(0);
+    auto worker = [&next, count, &work]()
+    {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                work(i);
+            }
+            catch (...)
+            {
+            }
+        }
+    };
+
+    // Nested and concurrent calls share one budget of extra threads.
+    // The calling thread always does its share,
+    // so the work gets done even if no more threads are available:
+    std::vector<std::thread> pool;
+    while (pool.size() + 1 < count)
+    {
+        if (threads <= gExtra++ + 1)
+        {
+            --gExtra;
+            break;
+        }
+
+        try
+        {
+            pool.emplace_back(worker);
+        }
+        catch (const std::system_error &)
+        {
+            --gExtra;
+            break;
+        }
+    }
+    worker();
+    for (auto &thread: pool)
+        thread.join();
+    gExtra -= pool.size();
+}
+
+} // namespace abcd
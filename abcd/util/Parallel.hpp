@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#ifndef ABCD_UTIL_PARALLEL_HPP
+#define ABCD_UTIL_PARALLEL_HPP
+
+#include <stddef.h>
+#include <functional>
+
+namespace abcd {
+
+/**
+ * Sets the number of threads `parallelFor` can use.
+ * A limit of 1 makes everything run on the calling thread.
+ * A limit of 0 picks a default based on the number of cores.
+ */
+void
+parallelLimitSet(size_t threads);
+
+/**
+ * Runs `work(i)` for each `i` from 0 up to `count`,
+ * spread across a pool of threads.
+ * Blocks until every item is done.
+ * Nested calls are fine, and share the same thread limit.
+ * The work must be safe to run concurrently,
+ * and any exceptions it throws are lost.
+ */
+void
+parallelFor(size_t count, const std::function<void (size_t i)> &work);
+
+} // namespace abcd
+
+#endif
@@ -14,16 +14,96 @@
 #include "../../minilibs/git-sync/sync.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <system_error>
+#include <thread>
 
 namespace abcd {
 
-std::recursive_mutex gSyncMutex;
+// Repos running more syncs than this at once just queue up:
+#define SYNC_PARALLEL_LIMIT 4
+
+/**
+ * Library-wide state.
+ * Syncs register themselves in `active`,
+ * so `syncTerminate` can wait for them to finish.
+ */
+static std::mutex gStateMutex;
+static std::condition_variable gStateIdle;
 static bool gbInitialized = false;
+static size_t gActive = 0;
+
+// Server rotation, shared by all repos:
+static std::mutex gServerMutex;
 static int syncServerIndex;
 static std::string syncServerName;
 
-typedef std::lock_guard<std::recursive_mutex> AutoSyncLock;
+// Outcomes, for `syncCounts`:
+static std::atomic<unsigned> gSkipped(0);
+static std::atomic<unsigned> gPerformed(0);
+
+// One lock per repo directory, so separate repos can sync in parallel:
+static std::mutex gRepoLocksMutex;
+static std::map<std::string, std::shared_ptr<std::recursive_mutex>> gRepoLocks;
+
+/**
+ * Holds a repo's lock, and keeps the library from shutting down underneath.
+ */
+class AutoSyncLock
+{
+public:
+    ~AutoSyncLock()
+    {
+        if (!active_)
+            return;
+        if (lock_.owns_lock())
+            lock_.unlock();
+
+        std::lock_guard<std::mutex> lock(gStateMutex);
+        if (!--gActive)
+            gStateIdle.notify_all();
+    }
+
+    /**
+     * Registers the sync and takes the repo's lock.
+     * The sync counts as active while it waits,
+     * so `syncTerminate` can't shut libgit2 down in the meantime.
+     */
+    Status
+    acquire(const std::string &syncDir)
+    {
+        {
+            std::lock_guard<std::mutex> lock(gStateMutex);
+            if (!gbInitialized)
+                return ABC_ERROR(ABC_CC_NotInitialized,
+                                 "ABC_Sync has not been initalized");
+            ++gActive;
+            active_ = true;
+        }
+
+        lock_ = std::unique_lock<std::recursive_mutex>(*repoMutex(syncDir));
+        return Status();
+    }
+
+private:
+    bool active_ = false;
+    std::unique_lock<std::recursive_mutex> lock_;
+
+    static std::shared_ptr<std::recursive_mutex>
+    repoMutex(const std::string &syncDir)
+    {
+        std::lock_guard<std::mutex> lock(gRepoLocksMutex);
+        auto &out = gRepoLocks[syncDir];
+        if (!out)
+            out = std::make_shared<std::recursive_mutex>();
+        return out;
+    }
+};
 
 #define ABC_CHECK_GIT(f) \
     do { \
@@ -54,6 +134,8 @@ syncGitError(int e)
 static Status
 syncUrl(std::string &result, const std::string &syncKey, bool rotate=false)
 {
+    std::lock_guard<std::mutex> lock(gServerMutex);
+
     if (rotate || syncServerName.empty())
     {
         auto servers = generalSyncServers();
@@ -71,7 +153,7 @@ syncUrl(std::string &result, const std::string &syncKey, bool rotate=false)
 Status
 syncInit(const char *szCaCertPath)
 {
-    AutoSyncLock lock(gSyncMutex);
+    std::lock_guard<std::mutex> lock(gStateMutex);
 
     if (gbInitialized)
         return ABC_ERROR(ABC_CC_Reinitialization,
@@ -85,6 +167,7 @@ syncInit(const char *szCaCertPath)
                                        nullptr));
 
     // Choose a random server to start with:
+    std::lock_guard<std::mutex> serverLock(gServerMutex);
     syncServerIndex = time(nullptr);
 
     return Status();
@@ -93,7 +176,11 @@ syncInit(const char *szCaCertPath)
 void
 syncTerminate()
 {
-    AutoSyncLock lock(gSyncMutex);
+    std::unique_lock<std::mutex> lock(gStateMutex);
+    gStateIdle.wait(lock, []()
+    {
+        return !gActive;
+    });
 
     if (gbInitialized)
     {
@@ -105,7 +192,8 @@ syncTerminate()
 Status
 syncMakeRepo(const std::string &syncDir)
 {
-    AutoSyncLock lock(gSyncMutex);
+    AutoSyncLock lock;
+    ABC_CHECK(lock.acquire(syncDir));
 
     git_repository_init_options opts = GIT_REPOSITORY_INIT_OPTIONS_INIT;
     opts.flags |= GIT_REPOSITORY_INIT_MKDIR;
@@ -121,7 +209,8 @@ Status
 syncEnsureRepo(const std::string &syncDir, const std::string &tempDir,
                const std::string &syncKey)
 {
-    AutoSyncLock lock(gSyncMutex);
+    AutoSyncLock lock;
+    ABC_CHECK(lock.acquire(syncDir));
 
     if (!fileExists(syncDir))
     {
@@ -138,15 +227,42 @@ syncEnsureRepo(const std::string &syncDir, const std::string &tempDir,
 }
 
 Status
-syncRepo(const std::string &syncDir, const std::string &syncKey, bool &dirty)
+syncRepo(const std::string &syncDir, const std::string &syncKey, bool &dirty,
+         SyncStats *stats)
 {
-    AutoSyncLock lock(gSyncMutex);
+    AutoSyncLock lock;
+    ABC_CHECK(lock.acquire(syncDir));
+    const auto start = std::chrono::steady_clock::now();
 
     AutoFree<git_repository, git_repository_free> repo;
     ABC_CHECK_GIT(git_repository_open(&repo.get(), syncDir.c_str()));
 
     std::string url;
     ABC_CHECK(syncUrl(url, syncKey));
+
+    // Most syncs are no-ops, which the ref advertisement alone can reveal.
+    // If the server can't even do that, don't make the fetch wait on it too:
+    int up_to_date = 0;
+    if (sync_check(repo, url.c_str(), &up_to_date) < 0)
+    {
+        up_to_date = 0;
+        ABC_CHECK(syncUrl(url, syncKey, true));
+    }
+    if (up_to_date)
+    {
+        ++gSkipped;
+        dirty = false;
+        if (stats)
+        {
+            *stats = SyncStats();
+            stats->skipped = true;
+            stats->elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - start);
+        }
+        return Status();
+    }
+    ++gPerformed;
+
     if (sync_fetch(repo, url.c_str()) < 0)
     {
         ABC_CHECK(syncUrl(url, syncKey, true));
@@ -164,7 +280,65 @@ syncRepo(const std::string &syncDir, const std::string &syncKey, bool &dirty)
     assert(gContext);
 
     dirty = !!files_changed;
+    if (stats)
+    {
+        stats->filesChanged = files_changed;
+        stats->pushed = !!need_push;
+        stats->elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - start);
+    }
     return Status();
 }
 
+void
+syncCounts(unsigned &skipped, unsigned &performed)
+{
+    skipped = gSkipped;
+    performed = gPerformed;
+}
+
+void
+syncAll(std::vector<SyncTask> &tasks)
+{
+    // Hand out tasks to a small pool of threads:
+    std::atomic<size_t> next(0);
+    auto worker = [&tasks, &next]()
+    {
+        for (size_t i = next++; i < tasks.size(); i = next++)
+        {
+            auto &task = tasks[i];
+            const auto start = std::chrono::steady_clock::now();
+            task.dirty = false;
+            task.status = task.sync(task.dirty, task.stats);
+            task.stats.elapsed =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start);
+
+            ABC_DebugLog("Synced %s in %d ms, %d files changed%s",
+                         task.name.c_str(), int(task.stats.elapsed.count()),
+                         task.stats.filesChanged,
+                         !task.status ? " (failed)" :
+                         task.stats.skipped ? " (up to date)" : "");
+        }
+    };
+
+    const size_t threads = std::min<size_t>(SYNC_PARALLEL_LIMIT, tasks.size());
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; ++i)
+    {
+        // If we run out of threads, the ones we have can do the work:
+        try
+        {
+            pool.emplace_back(worker);
+        }
+        catch (const std::system_error &)
+        {
+            break;
+        }
+    }
+    worker();
+    for (auto &thread: pool)
+        thread.join();
+}
+
 } // namespace abcd
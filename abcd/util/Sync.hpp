@@ -13,6 +13,9 @@
 #define ABC_Sync_h
 
 #include "Status.hpp"
+#include <chrono>
+#include <functional>
+#include <vector>
 
 #define SYNC_KEY_LENGTH 20
 
@@ -49,16 +52,61 @@ Status
 syncEnsureRepo(const std::string &syncDir, const std::string &tempDir,
                const std::string &syncKey);
 
+/**
+ * Details about a finished sync.
+ */
+struct SyncStats
+{
+    int filesChanged = 0;
+    bool pushed = false;
+    /** The server had nothing new and there was nothing to push. */
+    bool skipped = false;
+    std::chrono::milliseconds elapsed{0};
+};
+
 /**
  * Synchronizes the directory with the server.
  * New files in the folder will go up to the server,
  * and new files on the server will come down to the directory.
  * If there is a conflict, the server's file will win.
+ * Each repo has its own lock, so different repos can sync at once.
  * @param dirty set to true if the sync has modified the filesystem,
  * or false otherwise.
+ * @param stats receives timing and change counts, if provided.
  */
 Status
-syncRepo(const std::string &syncDir, const std::string &syncKey, bool &dirty);
+syncRepo(const std::string &syncDir, const std::string &syncKey, bool &dirty,
+         SyncStats *stats=nullptr);
+
+/**
+ * Counts the syncs that were skipped as no-ops
+ * versus the ones that had to fetch, since the library started.
+ */
+void
+syncCounts(unsigned &skipped, unsigned &performed);
+
+/**
+ * One entry in a batch of syncs.
+ */
+struct SyncTask
+{
+    /** A name for logging. */
+    std::string name;
+    /** Performs the sync, typically by calling `syncRepo`. */
+    std::function<Status (bool &dirty, SyncStats &stats)> sync;
+
+    // Results:
+    Status status;
+    bool dirty = false;
+    SyncStats stats;
+};
+
+/**
+ * Runs a batch of syncs, a few at a time, and waits for them all.
+ * Each task's results, including its total time, land in the task itself.
+ */
+void
+syncAll(std::vector<SyncTask> &tasks);
 
 } // namespace abcd
 
@@ -7,13 +7,14 @@
 
 #include "AddressDb.hpp"
 #include "Wallet.hpp"
+#include "../bitcoin/Derive.hpp"
 #include "../bitcoin/cache/Cache.hpp"
 #include "../crypto/Crypto.hpp"
 #include "../json/JsonObject.hpp"
 #include "../util/Debug.hpp"
 #include "../util/FileIO.hpp"
+#include "../util/Parallel.hpp"
 #include <bitcoin/bitcoin.hpp>
-#include <dirent.h>
 #include <time.h>
 
 namespace abcd {
@@ -121,32 +122,36 @@ AddressDb::load()
     addresses_.clear();
     files_.clear();
 
-    // Open the directory:
-    DIR *dir = opendir(dir_.c_str());
-    if (dir)
+    // Decrypt and parse the files in parallel:
+    const auto names = fileListJson(dir_);
+    struct Loaded
     {
-        struct dirent *de;
-        while (nullptr != (de = readdir(dir)))
-        {
-            if (!fileIsJson(de->d_name))
-                continue;
-
-            // Try to load the address:
-            AddressMeta address;
-            AddressJson json;
-            if (json.load(dir_ + de->d_name, wallet_.dataKey()).log() &&
-                    json.unpack(address).log())
-            {
-                if (path(address) != dir_ + de->d_name)
-                    ABC_DebugLog("Filename %s does not match address", de->d_name);
-
-                addresses_[address.address] = address;
-                files_[address.address] = json;
-
-                wallet_.cache.addresses.insert(address.address);
-            }
-        }
-        closedir(dir);
+        AddressMeta address;
+        AddressJson json;
+        bool ok = false;
+    };
+    std::vector<Loaded> loaded(names.size());
+    parallelFor(names.size(), [this, &names, &loaded](size_t i)
+    {
+        auto &out = loaded[i];
+        out.ok = out.json.load(dir_ + names[i], wallet_.dataKey()).log() &&
+                 out.json.unpack(out.address).log();
+    });
+
+    // Add them to the database:
+    for (size_t n = 0; n < names.size(); ++n)
+    {
+        if (!loaded[n].ok)
+            continue;
+        const auto &address = loaded[n].address;
+
+        if (path(address) != dir_ + names[n])
+            ABC_DebugLog("Filename %s does not match address", names[n].c_str());
+
+        addresses_[address.address] = address;
+        files_[address.address] = loaded[n].json;
+
+        wallet_.cache.addresses.insert(address.address);
     }
 
     ABC_CHECK(stockpile());
@@ -199,20 +204,22 @@ AddressDb::list() const
     return out;
 }
 
-KeyTable
-AddressDb::keyTable()
+Status
+AddressDb::key(bc::ec_secret &result, const std::string &address)
 {
     std::lock_guard<std::mutex> lock(mutex_);
 
-    auto m00 = mainBranch(wallet_);
-    KeyTable out;
-    for (const auto &i: addresses_)
-    {
-        out[i.first] = bc::secret_to_wif(
-                           m00.generate_private_key(i.second.index).private_key());
-    }
+    if (keys_.find(result, address))
+        return Status();
 
-    return out;
+    auto i = addresses_.find(address);
+    if (i == addresses_.end())
+        return ABC_ERROR(ABC_CC_Error, "Missing signing key");
+
+    result = mainBranch(wallet_).generate_private_key(i->second.index).
+             private_key();
+    keys_.insert(address, result);
+    return Status();
 }
 
 bool
@@ -303,35 +310,56 @@ AddressDb::stockpile()
         indices[i.second.index] = i.second.recyclable;
 
     // Check for gaps:
+    std::vector<uint32_t> missing;
     size_t lastUsed = 0;
-    for (size_t i = 0; i < addresses_.size() || i < lastUsed + 5; ++i)
+    for (size_t i = 0; i < addresses_.size() + missing.size() ||
+            i < lastUsed + 5; ++i)
     {
         auto index = indices.find(i);
         if (index == indices.end())
-        {
-            // Create the missing address:
-            auto m00n = mainBranch(wallet_).generate_private_key(i);
-            if (m00n.valid())
-            {
-                AddressMeta address;
-                address.index = i;
-                address.address = m00n.address().encoded();
-                address.recyclable = true;
-                address.time = time(nullptr);
-                addresses_[address.address] = address;
-
-                AddressJson json;
-                ABC_CHECK(json.pack(address));
-                ABC_CHECK(json.save(path(address), wallet_.dataKey()));
-                files_[address.address] = json;
-
-                wallet_.cache.addresses.insert(address.address);
-            }
-        }
+            missing.push_back(i);
         else if (!index->second)
-        {
             lastUsed = i;
-        }
+    }
+    if (missing.empty())
+        return Status();
+
+    // Derive the missing addresses as a batch:
+    const auto derived = deriveAddresses(mainBranch(wallet_), missing);
+    const auto now = time(nullptr);
+    std::vector<AddressMeta> created;
+    for (size_t i = 0; i < missing.size(); ++i)
+    {
+        if (derived[i].empty())
+            continue;
+
+        AddressMeta address;
+        address.index = missing[i];
+        address.address = derived[i];
+        address.recyclable = true;
+        address.time = now;
+        created.push_back(address);
+    }
+
+    // Encrypt and write the files in parallel:
+    std::vector<AddressJson> files(created.size());
+    std::vector<Status> results(created.size());
+    parallelFor(created.size(), [this, &created, &files, &results](size_t i)
+    {
+        results[i] = files[i].pack(created[i]);
+        if (results[i])
+            results[i] = files[i].save(path(created[i]), wallet_.dataKey());
+    });
+
+    // Add them to the database:
+    for (size_t i = 0; i < created.size(); ++i)
+    {
+        ABC_CHECK(results[i]);
+        const auto &address = created[i];
+        addresses_[address.address] = address;
+        files_[address.address] = files[i];
+
+        wallet_.cache.addresses.insert(address.address);
     }
 
     return Status();
@@ -9,6 +9,7 @@
 #define ABCD_WALLET_ADDRESS_DB_HPP
 
 #include "Metadata.hpp"
+#include "../bitcoin/KeyCache.hpp"
 #include "../bitcoin/Typedefs.hpp"
 #include "../json/JsonPtr.hpp"
 #include <list>
@@ -19,7 +20,6 @@ namespace abcd {
 
 class Wallet;
 struct TxInfo;
-typedef std::map<const std::string, std::string> KeyTable;
 
 struct AddressMeta
 {
@@ -64,10 +64,11 @@ public:
     list() const;
 
     /**
-     * Returns the private keys for the wallet's addresses.
+     * Derives the private key for one of the wallet's addresses.
+     * Keys stay cached for as long as the wallet is loaded.
      */
-    KeyTable
-    keyTable();
+    Status
+    key(bc::ec_secret &result, const std::string &address);
 
     /**
      * Returns true if the database contains the given address.
@@ -106,6 +107,7 @@ private:
 
     std::map<std::string, AddressMeta> addresses_;
     std::map<std::string, JsonPtr> files_;
+    KeyCache keys_;
 
     /**
      * Ensures that there are no gaps in the address list,
@@ -16,73 +16,124 @@
 
 namespace abcd {
 
-Status
-onReceive(Wallet &wallet, const TxInfo &info,
-          tABC_BitCoin_Event_Callback fCallback, void *pData)
+/**
+ * Saves the metadata for an incoming transaction, if it is new.
+ */
+static Status
+receiveSave(bool &isNew, Wallet &wallet, const TxInfo &info)
 {
-    wallet.balanceDirty();
     ABC_CHECK(wallet.addresses.markOutputs(info));
 
     // Does the transaction already exist?
     TxMeta meta;
-    if (!wallet.txs.get(meta, info.ntxid))
+    isNew = !wallet.txs.get(meta, info.ntxid);
+    if (!isNew)
+        return Status();
+
+    const auto balance = wallet.addresses.balance(info);
+
+    meta.ntxid = info.ntxid;
+    meta.txid = info.txid;
+    meta.timeCreation = time(nullptr);
+    meta.internal = false;
+    meta.airbitzFeeWanted = 0;
+    meta.airbitzFeeSent = 0;
+
+    // Receives can accumulate Airbitz fees:
+    const auto airbitzFeeInfo = generalAirbitzFeeInfo();
+    meta.airbitzFeeWanted = airbitzFeeIncoming(airbitzFeeInfo, balance);
+    logInfo("Airbitz fee: " +
+            std::to_string(meta.airbitzFeeWanted) + " wanted, " +
+            std::to_string(wallet.txs.airbitzFeePending()) + " pending");
+
+    // Grab metadata from the address:
+    for (const auto &io: info.ios)
     {
-        const auto balance = wallet.addresses.balance(info);
-
-        meta.ntxid = info.ntxid;
-        meta.txid = info.txid;
-        meta.timeCreation = time(nullptr);
-        meta.internal = false;
-        meta.airbitzFeeWanted = 0;
-        meta.airbitzFeeSent = 0;
-
-        // Receives can accumulate Airbitz fees:
-        const auto airbitzFeeInfo = generalAirbitzFeeInfo();
-        meta.airbitzFeeWanted = airbitzFeeIncoming(airbitzFeeInfo, balance);
-        logInfo("Airbitz fee: " +
-                std::to_string(meta.airbitzFeeWanted) + " wanted, " +
-                std::to_string(wallet.txs.airbitzFeePending()) + " pending");
-
-        // Grab metadata from the address:
-        for (const auto &io: info.ios)
-        {
-            AddressMeta address;
-            if (wallet.addresses.get(address, io.address))
-                meta.metadata = address.metadata;
-        }
-        ABC_CHECK(gContext->exchangeCache.satoshiToCurrency(
-                      meta.metadata.amountCurrency, balance,
-                      static_cast<Currency>(wallet.currency())));
-
-        // Save the metadata:
-        ABC_CHECK(wallet.txs.save(meta, balance, info.fee));
-
-        // Update the GUI:
-        ABC_DebugLog("IncomingBitCoin callback: wallet %s, txid: %s",
-                     wallet.id().c_str(), info.txid.c_str());
-        tABC_AsyncBitCoinInfo async;
-        async.pData = pData;
-        async.eventType = ABC_AsyncEventType_IncomingBitCoin;
-        Status().toError(async.status, ABC_HERE());
-        async.szWalletUUID = wallet.id().c_str();
-        async.szTxID = info.txid.c_str();
-        async.sweepSatoshi = 0;
+        AddressMeta address;
+        if (wallet.addresses.get(address, io.address))
+            meta.metadata = address.metadata;
+    }
+    ABC_CHECK(gContext->exchangeCache.satoshiToCurrency(
+                  meta.metadata.amountCurrency, balance,
+                  static_cast<Currency>(wallet.currency())));
+
+    // Save the metadata:
+    ABC_CHECK(wallet.txs.save(meta, balance, info.fee));
+
+    return Status();
+}
+
+Status
+onReceive(Wallet &wallet, const std::list<TxInfo> &infos, bool batch,
+          tABC_BitCoin_Event_Callback fCallback, void *pData)
+{
+    wallet.balanceDirty();
+
+    // One bad transaction shouldn't hide the rest of the batch:
+    std::vector<std::pair<std::string, bool>> saved;
+    std::vector<std::string> newTxids;
+    for (const auto &info: infos)
+    {
+        bool isNew;
+        if (!receiveSave(isNew, wallet, info).log())
+            continue;
+        saved.push_back(std::make_pair(info.txid, isNew));
+        if (isNew)
+            newTxids.push_back(info.txid);
+    }
+    if (saved.empty())
+        return Status();
+
+    tABC_AsyncBitCoinInfo async;
+    async.pData = pData;
+    Status().toError(async.status, ABC_HERE());
+    async.szWalletUUID = wallet.id().c_str();
+    async.szTxID = nullptr;
+    async.sweepSatoshi = 0;
+    async.aszTxIDs = nullptr;
+    async.countTxIDs = 0;
+
+    // Update the GUI:
+    if (batch && 1 < newTxids.size())
+    {
+        ABC_DebugLog("IncomingBitCoinBatch callback: wallet %s, %zu txids",
+                     wallet.id().c_str(), newTxids.size());
+        std::vector<const char *> pointers;
+        for (const auto &txid: newTxids)
+            pointers.push_back(txid.c_str());
+        async.eventType = ABC_AsyncEventType_IncomingBitCoinBatch;
+        async.aszTxIDs = pointers.data();
+        async.countTxIDs = pointers.size();
         fCallback(&async);
     }
-    else
+    else if (batch && newTxids.empty())
     {
-        // Update the GUI:
+        // The balance only needs one refresh, however many txs changed:
         ABC_DebugLog("BalanceUpdate callback: wallet %s, txid: %s",
-                     wallet.id().c_str(), info.txid.c_str());
-        tABC_AsyncBitCoinInfo async;
-        async.pData = pData;
+                     wallet.id().c_str(), saved.front().first.c_str());
         async.eventType = ABC_AsyncEventType_BalanceUpdate;
-        Status().toError(async.status, ABC_HERE());
-        async.szWalletUUID = wallet.id().c_str();
-        async.szTxID = info.txid.c_str();
-        async.sweepSatoshi = 0;
+        async.szTxID = saved.front().first.c_str();
         fCallback(&async);
     }
+    else
+    {
+        // Without batching, the GUI sees one event per transaction,
+        // just as if they had arrived one at a time:
+        for (const auto &tx: saved)
+        {
+            if (batch && !tx.second)
+                continue;
+
+            ABC_DebugLog("%s callback: wallet %s, txid: %s",
+                         tx.second ? "IncomingBitCoin" : "BalanceUpdate",
+                         wallet.id().c_str(), tx.first.c_str());
+            async.eventType = tx.second ?
+                              ABC_AsyncEventType_IncomingBitCoin :
+                              ABC_AsyncEventType_BalanceUpdate;
+            async.szTxID = tx.first.c_str();
+            fCallback(&async);
+        }
+    }
 
     return Status();
 }
@@ -9,6 +9,7 @@
 #define ABCD_WALLET_RECEIVE_HPP
 
 #include "../util/Status.hpp"
+#include <list>
 
 namespace abcd {
 
@@ -16,10 +17,15 @@ struct TxInfo;
 class Wallet;
 
 /**
- * Updates the wallet when a new transaction comes in from the network.
+ * Updates the wallet when new transactions come in from the network.
+ * Each new transaction gets an IncomingBitCoin event,
+ * and each known one gets a BalanceUpdate.
+ * With `batch` set, several new ones share an IncomingBitCoinBatch event,
+ * the known ones ride along with the new ones,
+ * and if nothing is new, the GUI gets a single BalanceUpdate.
  */
 Status
-onReceive(Wallet &wallet, const TxInfo &info,
+onReceive(Wallet &wallet, const std::list<TxInfo> &infos, bool batch,
           tABC_BitCoin_Event_Callback fCallback, void *pData);
 
 } // namespace abcd
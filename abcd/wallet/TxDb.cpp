@@ -11,7 +11,7 @@
 #include "../json/JsonObject.hpp"
 #include "../util/Debug.hpp"
 #include "../util/FileIO.hpp"
-#include <dirent.h>
+#include "../util/Parallel.hpp"
 
 namespace abcd {
 
@@ -120,44 +120,49 @@ TxDb::load()
     txs_.clear();
     files_.clear();
 
-    // Open the directory:
-    DIR *dir = opendir(dir_.c_str());
-    if (dir)
+    // Decrypt and parse the files in parallel:
+    const auto names = fileListJson(dir_);
+    struct Loaded
     {
-        struct dirent *de;
-        while (nullptr != (de = readdir(dir)))
+        TxMeta tx;
+        TxJson json;
+        bool ok = false;
+    };
+    std::vector<Loaded> loaded(names.size());
+    parallelFor(names.size(), [this, &names, &loaded](size_t i)
+    {
+        auto &out = loaded[i];
+        out.ok = out.json.load(dir_ + names[i], wallet_.dataKey()).log() &&
+                 out.json.unpack(out.tx).log();
+    });
+
+    // Add them to the database in directory order:
+    for (size_t n = 0; n < names.size(); ++n)
+    {
+        if (!loaded[n].ok)
+            continue;
+        const auto &name = names[n];
+        const auto &tx = loaded[n].tx;
+
+        if (path(tx) != dir_ + name)
+            ABC_DebugLog("Filename %s does not match transaction", name.c_str());
+
+        // Delete duplicate transactions, if any:
+        auto i = txs_.find(tx.ntxid);
+        if (i != txs_.end())
+        {
+            if (tx.internal)
+                fileDelete(path(i->second)).log();
+            else
+                fileDelete(dir_ + name).log();
+        }
+
+        // Save this transaction if is unique or internal:
+        if (i == txs_.end() || tx.internal)
         {
-            if (!fileIsJson(de->d_name))
-                continue;
-
-            // Try to load the address:
-            TxMeta tx;
-            TxJson json;
-            if (json.load(dir_ + de->d_name, wallet_.dataKey()).log() &&
-                    json.unpack(tx).log())
-            {
-                if (path(tx) != dir_ + de->d_name)
-                    ABC_DebugLog("Filename %s does not match transaction", de->d_name);
-
-                // Delete duplicate transactions, if any:
-                auto i = txs_.find(tx.ntxid);
-                if (i != txs_.end())
-                {
-                    if (tx.internal)
-                        fileDelete(path(i->second)).log();
-                    else
-                        fileDelete(dir_ + de->d_name).log();
-                }
-
-                // Save this transaction if is unique or internal:
-                if (i == txs_.end() || tx.internal)
-                {
-                    txs_[tx.ntxid] = tx;
-                    files_[tx.ntxid] = json;
-                }
-            }
+            txs_[tx.ntxid] = tx;
+            files_[tx.ntxid] = loaded[n].json;
         }
-        closedir(dir);
     }
 
     return Status();
@@ -54,7 +54,8 @@ Wallet::create(std::shared_ptr<Wallet> &result, Account &account,
     ABC_CHECK(out->loadSync());
 
     // Load the transaction cache (failure is fine):
-    if (!out->cache.load().log())
+    if (!out->cache.load().log() &&
+            !out->cache.loadJson(out->paths.cachePathJson()).log())
         out->cache.loadLegacy(out->paths.cachePathOld());
 
     result = std::move(out);
@@ -160,9 +161,9 @@ Wallet::balanceDirty()
 }
 
 Status
-Wallet::sync(bool &dirty)
+Wallet::sync(bool &dirty, SyncStats *stats)
 {
-    ABC_CHECK(syncRepo(paths.syncDir(), syncKey_, dirty));
+    ABC_CHECK(syncRepo(paths.syncDir(), syncKey_, dirty, stats));
     if (dirty)
     {
         std::lock_guard<std::mutex> lock(mutex_);
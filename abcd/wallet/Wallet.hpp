@@ -21,6 +21,7 @@ namespace abcd {
 
 class Account;
 class Cache;
+struct SyncStats;
 
 /**
  * Manages the information stored in the top-level wallet sync directory.
@@ -63,9 +64,10 @@ public:
     /**
      * Syncs the account with the file server.
      * This is a blocking network operation.
+     * @param stats receives timing and change counts, if provided.
      */
     Status
-    sync(bool &dirty);
+    sync(bool &dirty, SyncStats *stats=nullptr);
 
 private:
     mutable std::mutex mutex_;
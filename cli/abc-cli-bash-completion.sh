@@ -23,6 +23,13 @@ _abc_cli_complete()
     address-calculate
     address-list
     address-search
+    benchmark-cache
+    benchmark-http
+    benchmark-reconnect
+    benchmark-scrypt
+    benchmark-stratum
+    benchmark-tx-cache
+    benchmark-wallet-load
     bitid-login
     bitid-sign
     category-add
@@ -32,6 +39,7 @@ _abc_cli_complete()
     change-password-recovery
     check-password
     check-recovery-answers
+    data-sync
     exchange-fetch
     exchange-update
     exchange-validate
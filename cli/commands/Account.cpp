@@ -9,7 +9,9 @@
 #include "../../abcd/account/Account.hpp"
 #include "../../abcd/json/JsonBox.hpp"
 #include "../../abcd/login/Login.hpp"
+#include "../../abcd/wallet/Wallet.hpp"
 #include "../../abcd/util/FileIO.hpp"
+#include "../../abcd/util/Sync.hpp"
 #include "../../abcd/util/Util.hpp"
 #include <iostream>
 
@@ -104,3 +106,56 @@ COMMAND(InitLevel::wallet, CliAccountSync, "account-sync",
 
     return Status();
 }
+
+COMMAND(InitLevel::account, CliDataSync, "data-sync",
+        "")
+{
+    if (argc != 0)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+
+    std::vector<SyncTask> tasks;
+    SyncTask accountTask;
+    accountTask.name = "account";
+    accountTask.sync = [&session](bool &dirty, SyncStats &stats)
+    {
+        return session.account->sync(dirty, &stats);
+    };
+    tasks.push_back(accountTask);
+
+    for (const auto &id: session.account->wallets.list())
+    {
+        std::shared_ptr<Wallet> wallet;
+        ABC_CHECK(Wallet::create(wallet, *session.account, id));
+
+        SyncTask task;
+        task.name = id;
+        task.sync = [wallet](bool &dirty, SyncStats &stats)
+        {
+            return wallet->sync(dirty, &stats);
+        };
+        tasks.push_back(task);
+    }
+
+    syncAll(tasks);
+
+    for (const auto &task: tasks)
+    {
+        std::cout << task.name << ": ";
+        if (!task.status)
+            std::cout << task.status << std::endl;
+        else if (task.stats.skipped)
+            std::cout << task.stats.elapsed.count() << " ms, up to date" <<
+                      std::endl;
+        else
+            std::cout << task.stats.elapsed.count() << " ms, " <<
+                      task.stats.filesChanged << " files changed" <<
+                      (task.stats.pushed ? ", pushed" : "") << std::endl;
+    }
+
+    unsigned skipped, performed;
+    syncCounts(skipped, performed);
+    std::cout << skipped << " syncs skipped, " <<
+              performed << " performed" << std::endl;
+
+    return Status();
+}
@@ -6,9 +6,13 @@
  */
 
 #include "../Command.hpp"
+#include "../../abcd/bitcoin/Derive.hpp"
+#include "../../abcd/util/Parallel.hpp"
 #include "../../abcd/util/Util.hpp"
 #include "../../abcd/wallet/Wallet.hpp"
 #include <bitcoin/bitcoin.hpp>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 
 using namespace abcd;
@@ -77,32 +81,48 @@ COMMAND(InitLevel::wallet, CliAddressCalculate, "address-calculate",
 }
 
 COMMAND(InitLevel::wallet, CliAddressSearch, "address-search",
-        " <addr> <start> <end>")
+        " <addr> <start> <end> [<threads>]")
 {
-    if (argc != 3)
+    if (argc < 3 || 4 < argc)
         return ABC_ERROR(ABC_CC_Error, helpString(*this));
     const auto address = argv[0];
     const auto start = atol(argv[1]);
     const auto end = atol(argv[2]);
+    if (argc == 4)
+        parallelLimitSet(atol(argv[3]));
 
     bc::hd_private_key m(session.wallet->bitcoinKey());
     bc::hd_private_key m0 = m.generate_private_key(0);
     bc::hd_private_key m00 = m0.generate_private_key(0);
 
-    for (long i = start, c = 0; i <= end; i++, ++c)
+    // Derive in large batches, reporting progress after each one:
+    const long batchSize = 100000;
+    const auto searchStart = std::chrono::steady_clock::now();
+    for (long i = start; i <= end; i += batchSize)
     {
-        bc::hd_private_key m00n = m00.generate_private_key(i);
-        if (m00n.address().encoded() == address)
-        {
-            std::cout << "Found " << address << " at " << i << std::endl;
-            break;
-        }
-        if (c == 100000)
+        const auto count = std::min(batchSize, end - i + 1);
+        const auto batchStart = std::chrono::steady_clock::now();
+        const auto addresses = deriveAddresses(m00, i, count);
+        for (long j = 0; j < count; ++j)
         {
-            std::cout << i << std::endl;
-            c = 0;
+            if (addresses[j] == address)
+            {
+                std::cout << "Found " << address << " at " << i + j << std::endl;
+                return Status();
+            }
         }
+
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - batchStart).count();
+        std::cout << i + count - 1 << " (" <<
+                  (ms ? 1000 * count / ms : count) << " keys/s)" << std::endl;
     }
 
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - searchStart).count();
+    const auto total = end - start + 1;
+    std::cout << "Not found, " << (ms ? 1000 * total / ms : total) <<
+              " keys/s overall" << std::endl;
+
     return Status();
 }
@@ -0,0 +1,672 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../Command.hpp"
+#include "../../abcd/account/Account.hpp"
+#include "../../abcd/bitcoin/cache/Cache.hpp"
+#include "../../abcd/bitcoin/network/StratumConnection.hpp"
+#include "../../abcd/crypto/Encoding.hpp"
+#include "../../abcd/crypto/Scrypt.hpp"
+#include "../../abcd/http/HttpRequest.hpp"
+#include "../../abcd/json/JsonArray.hpp"
+#include "../../abcd/json/JsonObject.hpp"
+#include "../../abcd/spend/Outputs.hpp"
+#include "../../abcd/util/FileIO.hpp"
+#include "../../abcd/util/Parallel.hpp"
+#include "../../abcd/wallet/Wallet.hpp"
+#include "../../minilibs/scrypt/crypto_scrypt.h"
+#include <bitcoin/bitcoin.hpp>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <thread>
+
+using namespace abcd;
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr size_t benchmarkAddresses = 20;
+constexpr size_t benchmarkUnconfirmed = 100;
+
+/**
+ * Returns the milliseconds elapsed since the given starting point.
+ */
+static double
+elapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+               Clock::now() - start).count();
+}
+
+static void
+report(const std::string &name, double ms, size_t count)
+{
+    std::cout << name << ": " << ms << " ms";
+    if (count)
+        std::cout << " (" << ms * 1000 / count << " us each)";
+    std::cout << std::endl;
+}
+
+/**
+ * Fills a transaction cache with a synthetic wallet history.
+ * Each transaction spends the change from the one before it,
+ * pays either us or a stranger, and all but the newest are confirmed.
+ */
+static Status
+benchmarkFill(TxCache &txCache, AddressSet &addresses, TxidSet &txids,
+              size_t count)
+{
+    std::vector<bc::script_type> ourScripts;
+    for (size_t i = 0; i < benchmarkAddresses; ++i)
+    {
+        bc::ec_secret secret{{0xff, static_cast<uint8_t>(i + 1)}};
+        bc::payment_address address(bc::payment_address::pubkey_version,
+                                    bc::bitcoin_short_hash(
+                                        bc::secret_to_public_key(secret)));
+        addresses.insert(address.encoded());
+
+        bc::script_type script;
+        ABC_CHECK(outputScriptForAddress(script, address.encoded()));
+        ourScripts.push_back(script);
+    }
+
+    bc::script_type otherScript;
+    ABC_CHECK(outputScriptForAddress(otherScript,
+                                     "1QLbz7JHiBTspS962RLKV8GndWFwi5j6Qr"));
+
+    // The initial funding has no inputs of its own:
+    bc::transaction_type funding
+    {
+        1, 0, {}, {{0, ourScripts[0]}, {0, ourScripts[0]}}
+    };
+    bc::hash_digest previous = bc::hash_transaction(funding);
+    txCache.insert(funding);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Spend the previous change:
+        bc::transaction_type tx{1, 0, {{{previous, 1}, {}, 0xffffffff}}, {}};
+
+        // Every tenth transaction is a receive:
+        const auto &payee = i % 10 ? otherScript : ourScripts[i % 7];
+        tx.outputs.push_back({10000 + i, payee});
+        tx.outputs.push_back({20000 + i, ourScripts[i % benchmarkAddresses]});
+
+        previous = bc::hash_transaction(tx);
+        const auto txid = bc::encode_hash(previous);
+        txids.insert(txid);
+        txCache.insert(tx);
+        if (i + benchmarkUnconfirmed < count)
+            txCache.confirmed(txid, 100000 + i / 10);
+    }
+
+    return Status();
+}
+
+COMMAND(InitLevel::none, CliBenchmarkTxCache, "benchmark-tx-cache",
+        " [<count>]")
+{
+    if (1 < argc)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const size_t count = argc ? atol(argv[0]) : 50000;
+
+    BlockCache blockCache("");
+    TxCache txCache(blockCache);
+    AddressSet addresses;
+    TxidSet txids;
+
+    auto start = Clock::now();
+    ABC_CHECK(benchmarkFill(txCache, addresses, txids, count));
+    report("insert " + std::to_string(count), elapsedMs(start), count);
+
+    // A GUI refresh checks the status of every transaction:
+    start = Clock::now();
+    size_t checked = 0;
+    for (const auto &txid: txids)
+    {
+        if (1000 <= checked)
+            break;
+        TxStatus status;
+        ABC_CHECK(txCache.status(status, txid));
+        ++checked;
+    }
+    report("status", elapsedMs(start), checked);
+
+    start = Clock::now();
+    const auto statuses = txCache.statuses(txids);
+    report("statuses", elapsedMs(start), statuses.size());
+
+    // Building a spend:
+    start = Clock::now();
+    const auto utxos = txCache.utxos(addresses);
+    report("utxos (" + std::to_string(utxos.size()) + " found)",
+           elapsedMs(start), 0);
+
+    // A new block arrives, and the addresses with pending txs need checking.
+    // The old way built a full status for every transaction:
+    start = Clock::now();
+    AddressSet scanned;
+    for (const auto &status: txCache.statuses(txids))
+        if (!status.second.height)
+            for (const auto &io: status.first.ios)
+                scanned.insert(io.address);
+    report("new block, full scan (" + std::to_string(scanned.size()) +
+           " addresses)", elapsedMs(start), 0);
+
+    const size_t blocks = 100;
+    size_t marked = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < blocks; ++i)
+        marked = txCache.unconfirmedAddresses().size();
+    report("new block, unconfirmed index (" + std::to_string(marked) +
+           " addresses)", elapsedMs(start), blocks);
+
+    return Status();
+}
+
+COMMAND(InitLevel::none, CliBenchmarkCache, "benchmark-cache",
+        " <path> [<count>]")
+{
+    if (argc < 1 || 2 < argc)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const std::string path = argv[0];
+    const size_t count = 1 < argc ? atol(argv[1]) : 50000;
+
+    BlockCache blockCache("");
+    Cache cache(path, blockCache);
+    AddressSet addresses;
+    TxidSet txids;
+    ABC_CHECK(benchmarkFill(cache.txs, addresses, txids, count));
+
+    // Spread the history across the address rows:
+    std::vector<TxidSet> rows(addresses.size());
+    size_t i = 0;
+    for (const auto &txid: txids)
+        rows[i++ % rows.size()].insert(txid);
+    i = 0;
+    for (const auto &address: addresses)
+    {
+        cache.addresses.insert(address);
+        cache.addresses.update(address, rows[i++]);
+    }
+
+    auto start = Clock::now();
+    ABC_CHECK(cache.save());
+    report("snapshot", elapsedMs(start), 0);
+
+    DataChunk data;
+    ABC_CHECK(fileLoad(data, path));
+    std::cout << "snapshot size: " << data.size() << " bytes" << std::endl;
+
+    // A steady-state save only writes what changed,
+    // such as a new block confirming some transactions:
+    size_t changed = 0;
+    for (const auto &txid: txids)
+    {
+        if (benchmarkUnconfirmed <= changed++)
+            break;
+        cache.txs.confirmed(txid, 200000);
+    }
+    start = Clock::now();
+    ABC_CHECK(cache.save());
+    report("journal flush", elapsedMs(start), 0);
+    ABC_CHECK(fileLoad(data, path + ".journal"));
+    std::cout << "journal size: " << data.size() << " bytes" << std::endl;
+
+    Cache loaded(path, blockCache);
+    start = Clock::now();
+    ABC_CHECK(loaded.load());
+    report("load", elapsedMs(start), 0);
+
+    // Startup is not over until the GUI has its first balance and list:
+    start = Clock::now();
+    const auto utxos = loaded.txs.utxos(addresses);
+    report("first utxos (" + std::to_string(utxos.size()) + " found)",
+           elapsedMs(start), 0);
+
+    start = Clock::now();
+    const auto statuses = loaded.txs.statuses(txids);
+    report("first statuses", elapsedMs(start), statuses.size());
+
+    return Status();
+}
+
+struct FakeRequestJson:
+    public JsonObject
+{
+    ABC_JSON_CONSTRUCTORS(FakeRequestJson, JsonObject)
+    ABC_JSON_INTEGER(id, "id", 0)
+};
+
+/**
+ * A stand-in stratum server for a single client,
+ * answering every request with the same canned result.
+ * Batches get batch replies, just like a real server.
+ */
+static void
+fakeStratumServer(int listener, std::string result)
+{
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0)
+        return;
+
+    std::string incoming;
+    char buffer[65536];
+    while (true)
+    {
+        auto bytes = recv(fd, buffer, sizeof(buffer), 0);
+        if (bytes <= 0)
+            break;
+        incoming.append(buffer, bytes);
+
+        size_t newline;
+        while (std::string::npos != (newline = incoming.find('\n')))
+        {
+            JsonPtr json;
+            const auto s = json.decode(incoming.substr(0, newline));
+            incoming.erase(0, newline + 1);
+            if (!s)
+                continue;
+
+            auto reply = [&result](JsonPtr request)
+            {
+                return "{\"id\":" +
+                       std::to_string(FakeRequestJson(request).id()) +
+                       ",\"result\":" + result + "}";
+            };
+
+            std::string out;
+            if (json_is_array(json.get()))
+            {
+                JsonArray batch(json);
+                for (size_t i = 0; i < batch.size(); ++i)
+                    out += (i ? "," : "[") + reply(batch[i]);
+                out += "]\n";
+            }
+            else
+            {
+                out = reply(json) + "\n";
+            }
+
+            for (size_t sent = 0; sent < out.size();)
+            {
+                auto bytes = send(fd, out.data() + sent, out.size() - sent, 0);
+                if (bytes <= 0)
+                    break;
+                sent += bytes;
+            }
+        }
+    }
+    close(fd);
+}
+
+COMMAND(InitLevel::none, CliBenchmarkStratum, "benchmark-stratum",
+        " [<count>] [<history-size>]")
+{
+    if (2 < argc)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const size_t count = 0 < argc ? atol(argv[0]) : 2000;
+    const size_t historySize = 1 < argc ? atol(argv[1]) : 100;
+
+    // Every reply is an address history of the requested length:
+    std::string result = "[";
+    for (size_t i = 0; i < historySize; ++i)
+    {
+        bc::hash_digest txid{{static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8)}};
+        result += (i ? ",{\"tx_hash\":\"" : "{\"tx_hash\":\"") +
+                  bc::encode_hash(txid) + "\",\"height\":" +
+                  std::to_string(400000 + i) + "}";
+    }
+    result += "]";
+
+    // Start the server on any free local port:
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+        return ABC_ERROR(ABC_CC_Error, "Cannot create socket");
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), length) ||
+            listen(listener, 1) ||
+            getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length))
+    {
+        close(listener);
+        return ABC_ERROR(ABC_CC_Error, "Cannot start the fake server");
+    }
+    std::thread server(fakeStratumServer, listener, result);
+
+    Status s;
+    size_t replies = 0;
+    size_t wakeups = 0;
+    StratumStats stats;
+    auto start = Clock::now();
+    {
+        StratumConnection connection;
+        s = connection.connect("stratum://127.0.0.1:" +
+                               std::to_string(ntohs(address.sin_port)));
+        if (s)
+        {
+            auto onError = [&s](Status status)
+            {
+                s = status;
+            };
+            auto onReply = [&replies](const AddressHistory &history)
+            {
+                ++replies;
+            };
+
+            connection.windowSet(count);
+            for (size_t i = 0; i < count; ++i)
+                connection.addressHistoryFetch(onError, onReply,
+                                               "1QLbz7JHiBTspS962RLKV8GndWFwi5j6Qr");
+            s = connection.flush();
+        }
+
+        while (s && replies < count)
+        {
+            pollfd item{connection.pollfd(), POLLIN, 0};
+            if (poll(&item, 1, 10000) <= 0)
+            {
+                s = ABC_ERROR(ABC_CC_Error, "Fake server timed out");
+                break;
+            }
+
+            SleepTime sleep;
+            ++wakeups;
+            if (s)
+                s = connection.wakeup(sleep);
+        }
+        stats = connection.stats();
+    }
+    const auto ms = elapsedMs(start);
+
+    server.join();
+    close(listener);
+    ABC_CHECK(s);
+
+    const double megabytes = count * (result.size() + 20) / 1e6;
+    report("history replies", ms, replies);
+    std::cout << "throughput: " << megabytes * 1000 / ms << " MB/s ("
+              << megabytes << " MB)" << std::endl;
+    std::cout << "batches: " << stats.batches << ", wakeups: " << wakeups
+              << ", latency: " << stats.latencyAverage.count() << " ms average, "
+              << stats.latencyMax.count() << " ms max" << std::endl;
+
+    return Status();
+}
+
+/**
+ * The server side of the reconnect benchmark:
+ * each address's history, plus the transactions it lists.
+ */
+struct FakeHistoryServer
+{
+    // Histories are in server order, which the status hash depends on:
+    typedef std::vector<std::pair<std::string, size_t>> History;
+    std::map<std::string, History> histories;
+    std::map<std::string, bc::transaction_type> txs;
+
+    /**
+     * Builds the Electrum status hash the way the server does,
+     * independently of `TxCache::stratumHash`.
+     */
+    std::string
+    statusHash(const std::string &address) const
+    {
+        const auto &history = histories.at(address);
+        if (history.empty())
+            return "";
+
+        std::string status;
+        for (const auto &row: history)
+            status += row.first + ":" + std::to_string(row.second) + ":";
+        return base16Encode(bc::sha256_hash(bc::to_data_chunk(status)));
+    }
+};
+
+/**
+ * Subscribes to an address the way `TxUpdater` does,
+ * fetching its history if the cache asks for it,
+ * and then any transactions the cache is still missing.
+ * @return true if the address history was fetched.
+ */
+static bool
+benchmarkSubscribe(Cache &cache, const FakeHistoryServer &server,
+                   const std::string &address)
+{
+    if (!cache.addresses.updateStratumHash(address,
+                                           server.statusHash(address)))
+        return false;
+
+    TxidSet txids;
+    for (const auto &row: server.histories.at(address))
+    {
+        cache.txs.confirmed(row.first, row.second);
+        txids.insert(row.first);
+    }
+    cache.addresses.update(address, txids);
+
+    time_t sleep;
+    for (const auto &status: cache.addresses.statuses(sleep))
+        for (const auto &txid: status.missingTxids)
+        {
+            cache.txs.insert(server.txs.at(txid));
+            cache.addresses.updateTx(TxidSet{txid});
+        }
+    return true;
+}
+
+COMMAND(InitLevel::none, CliBenchmarkReconnect, "benchmark-reconnect",
+        " [<addresses>] [<used>] [<unconfirmed>]")
+{
+    if (3 < argc)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const size_t count = 0 < argc ? atol(argv[0]) : 200;
+    const size_t used = std::min<size_t>(count, 1 < argc ? atol(argv[1]) : 20);
+    const size_t unconfirmed = std::min<size_t>(used,
+                               2 < argc ? atol(argv[2]) : 4);
+
+    bc::script_type otherScript;
+    ABC_CHECK(outputScriptForAddress(otherScript,
+                                     "1QLbz7JHiBTspS962RLKV8GndWFwi5j6Qr"));
+
+    // Each used address gets a confirmed payment,
+    // and the first few spend it in an unconfirmed transaction:
+    FakeHistoryServer server;
+    std::vector<std::string> addresses;
+    AddressSet pending;
+    for (size_t i = 0; i < count; ++i)
+    {
+        bc::ec_secret secret
+        {
+            {0xfe, static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8)}
+        };
+        bc::payment_address address(bc::payment_address::pubkey_version,
+                                    bc::bitcoin_short_hash(
+                                        bc::secret_to_public_key(secret)));
+        addresses.push_back(address.encoded());
+        auto &history = server.histories[address.encoded()];
+        if (used <= i)
+            continue;
+
+        bc::script_type script;
+        ABC_CHECK(outputScriptForAddress(script, address.encoded()));
+        bc::transaction_type payment{1, 0, {}, {{10000 + i, script}}};
+        const auto paymentId = bc::hash_transaction(payment);
+        server.txs[bc::encode_hash(paymentId)] = payment;
+        history.push_back(std::make_pair(bc::encode_hash(paymentId),
+                                         400000 + i));
+        if (unconfirmed <= i)
+            continue;
+
+        bc::transaction_type spend
+        {
+            1, 0,
+            {{{paymentId, 0}, {}, 0xffffffff}},
+            {{5000, otherScript}, {4000, script}}
+        };
+        const auto spendId = bc::encode_hash(bc::hash_transaction(spend));
+        server.txs[spendId] = spend;
+        history.push_back(std::make_pair(spendId, 0));
+        pending.insert(address.encoded());
+    }
+
+    // First sync, starting from an empty cache:
+    BlockCache blockCache("");
+    Cache cache("", blockCache);
+    for (const auto &address: addresses)
+        cache.addresses.insert(address);
+
+    auto start = Clock::now();
+    size_t fetches = 0;
+    for (const auto &address: addresses)
+        fetches += benchmarkSubscribe(cache, server, address);
+    report("first sync, " + std::to_string(fetches) + " get_history calls",
+           elapsedMs(start), 0);
+
+    // A new block forces the addresses with unconfirmed transactions dirty,
+    // just like the height subscription does:
+    for (const auto &address: pending)
+        cache.addresses.updateStratumHash(address);
+
+    // Reconnecting after a while re-subscribes to everything:
+    start = Clock::now();
+    fetches = 0;
+    for (const auto &address: addresses)
+        fetches += benchmarkSubscribe(cache, server, address);
+    report("reconnect, " + std::to_string(fetches) + " get_history calls",
+           elapsedMs(start), 0);
+
+    return Status();
+}
+
+COMMAND(InitLevel::context, CliBenchmarkHttp, "benchmark-http",
+        " <url> [<count>]")
+{
+    if (argc != 1 && argc != 2)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const std::string url = argv[0];
+    const size_t count = 2 == argc ? atol(argv[1]) : 5;
+
+    // The first request pays for the connection, and the rest reuse it:
+    HttpTiming sum;
+    size_t reused = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        HttpReply reply;
+        ABC_CHECK(HttpRequest().get(reply, url));
+        const auto &t = reply.timing;
+        std::cout << "request " << i << ": " << t.total << " ms (dns " <<
+                  t.dns << ", connect " << t.connect << ", tls " << t.tls <<
+                  ", first byte " << t.firstByte << ")" <<
+                  (t.reused ? " reused" : "") << std::endl;
+
+        if (t.reused)
+            ++reused;
+        sum.dns += t.dns;
+        sum.connect += t.connect;
+        sum.tls += t.tls;
+        sum.firstByte += t.firstByte;
+        sum.total += t.total;
+    }
+
+    if (count)
+        std::cout << "average: " << sum.total / count << " ms (dns " <<
+                  sum.dns / count << ", connect " << sum.connect / count <<
+                  ", tls " << sum.tls / count << ", first byte " <<
+                  sum.firstByte / count << "), " << reused << " of " <<
+                  count << " reused" << std::endl;
+
+    return Status();
+}
+
+COMMAND(InitLevel::none, CliBenchmarkScrypt, "benchmark-scrypt",
+        " [<count>] [<n> <r> <p>]")
+{
+    if (argc != 0 && argc != 1 && argc != 4)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const size_t count = argc ? atol(argv[0]) : 20;
+    ScryptSnrp snrp = usernameSnrp();
+    if (argc == 4)
+    {
+        snrp.n = atol(argv[1]);
+        snrp.r = atol(argv[2]);
+        snrp.p = atol(argv[3]);
+    }
+
+    const crypto_scrypt_backend backends[] =
+    {
+        CRYPTO_SCRYPT_PORTABLE, CRYPTO_SCRYPT_SSE2, CRYPTO_SCRYPT_AVX2
+    };
+    for (auto backend: backends)
+    {
+        const std::string name = crypto_scrypt_backend_name(backend);
+        if (crypto_scrypt_backend_set(backend))
+        {
+            std::cout << name << ": not supported" << std::endl;
+            continue;
+        }
+
+        DataChunk out;
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i)
+            ABC_CHECK(snrp.hash(out, std::string("benchmark")));
+        const auto ms = elapsedMs(start);
+        report(name, ms, count);
+        std::cout << name << ": " << 1000 * count / ms << " hashes/s" <<
+                  std::endl;
+    }
+    crypto_scrypt_backend_set(CRYPTO_SCRYPT_AUTO);
+
+    return Status();
+}
+
+COMMAND(InitLevel::account, CliBenchmarkWalletLoad, "benchmark-wallet-load",
+        " [<threads>]")
+{
+    if (1 < argc)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const size_t threads = argc ? atol(argv[0]) : 0;
+
+    const auto list = session.account->wallets.list();
+    const std::vector<std::string> ids(list.begin(), list.end());
+
+    // Load every wallet from scratch, bypassing the login cache:
+    auto loadAll = [&session, &ids]()
+    {
+        std::vector<Status> results(ids.size());
+        parallelFor(ids.size(), [&session, &ids, &results](size_t i)
+        {
+            std::shared_ptr<Wallet> wallet;
+            results[i] = Wallet::create(wallet, *session.account, ids[i]);
+        });
+        for (const auto &s: results)
+            ABC_CHECK(s);
+        return Status();
+    };
+
+    // Warm up the disk cache, so both runs start out equal:
+    ABC_CHECK(loadAll());
+
+    parallelLimitSet(1);
+    auto start = Clock::now();
+    ABC_CHECK(loadAll());
+    report("sequential load", elapsedMs(start), ids.size());
+
+    parallelLimitSet(threads);
+    start = Clock::now();
+    ABC_CHECK(loadAll());
+    report("parallel load", elapsedMs(start), ids.size());
+
+    return Status();
+}
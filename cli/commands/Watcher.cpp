@@ -29,6 +29,9 @@ eventCallback(const tABC_AsyncBitCoinInfo *pInfo)
     case ABC_AsyncEventType_IncomingBitCoin:
         std::cout << "Incoming transaction" << std::endl;
         break;
+    case ABC_AsyncEventType_IncomingBitCoinBatch:
+        std::cout << pInfo->countTxIDs << " incoming transactions" << std::endl;
+        break;
     case ABC_AsyncEventType_BlockHeightChange:
         std::cout << "Block height change" << std::endl;
         break;
@@ -80,6 +83,7 @@ WatcherThread::init(const Session &session)
                                    session.password.c_str(),
                                    session.uuid.c_str(),
                                    &error));
+    ABC_CHECK_OLD(ABC_WatcherBatchEvents(session.uuid.c_str(), true, &error));
     thread_ = new std::thread(watcherThread, session.uuid.c_str());
     ABC_CHECK_OLD(ABC_WatcherConnect(session.uuid.c_str(), &error));
     return Status();
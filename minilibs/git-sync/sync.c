@@ -320,6 +320,73 @@ exit:
     return e;
 }
 
+/**
+ * Finds the commit the server's master branch points to,
+ * or leaves the id zero if the server has no master branch yet.
+ */
+static int sync_remote_master(git_oid *out,
+                              git_remote *remote)
+{
+    int e = 0;
+    const git_remote_head **heads = NULL;
+    size_t count = 0;
+    size_t i;
+
+    git_check(git_remote_ls(&heads, &count, remote));
+    for (i = 0; i < count; ++i)
+    {
+        if (!strcmp(heads[i]->name, SYNC_REF_MASTER))
+        {
+            git_oid_cpy(out, &heads[i]->oid);
+            break;
+        }
+    }
+
+exit:
+    return e;
+}
+
+/**
+ * Checks whether a sync would do anything.
+ */
+int sync_check(git_repository *repo,
+               const char *server,
+               int *up_to_date)
+{
+    int e = 0;
+    git_remote *remote = NULL;
+    git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+    git_oid master_id = {{0}};
+    git_oid incoming_id = {{0}};
+    git_oid server_id = {{0}};
+    int local_dirty = 0;
+
+    *up_to_date = 0;
+
+    // Local checks first, since they don't need the network:
+    git_check(sync_lookup_soft(&master_id, repo, SYNC_REF_MASTER));
+    git_check(sync_lookup_soft(&incoming_id, repo, SYNC_REF_REMOTE));
+    if (git_oid_cmp(&master_id, &incoming_id))
+        goto exit;
+    git_check(sync_local_dirty(&local_dirty, repo, &master_id));
+    if (local_dirty)
+        goto exit;
+
+    // The ref advertisement is enough to see if the server has moved:
+    git_check(git_remote_create_anonymous(&remote, repo, server));
+    git_check(git_remote_connect(remote, GIT_DIRECTION_FETCH, &callbacks));
+    git_check(sync_remote_master(&server_id, remote));
+    *up_to_date = !git_oid_cmp(&server_id, &incoming_id);
+
+exit:
+    if (remote)
+    {
+        git_remote_disconnect(remote);
+        git_remote_free(remote);
+    }
+    return e;
+}
+
 /**
  * Fetches the contents of the server into the "incoming" branch.
  */
@@ -460,6 +527,11 @@ int sync_push(git_repository *repo,
     git_check(git_remote_create_anonymous(&remote, repo, server));
     git_check(git_remote_push(remote, &refspecs, &options));
 
+    // The server now matches master, so remember that for sync_check:
+    git_oid master_id;
+    git_check(git_reference_name_to_id(&master_id, repo, SYNC_REF_MASTER));
+    git_check(sync_fast_forward(repo, SYNC_REF_REMOTE, &master_id));
+
 exit:
     if (remote)     git_remote_free(remote);
     return e;
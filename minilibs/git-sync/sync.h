@@ -17,6 +17,17 @@
 extern "C" {
 #endif
 
+/**
+ * Determines whether a sync would be a no-op, without downloading anything.
+ * This compares the server's advertised master branch with the local
+ * "incoming" branch, and also checks for local changes and unpushed commits.
+ * @param up_to_date set to 1 if fetching, merging, and pushing
+ * would all do nothing.
+ */
+int sync_check(git_repository *repo,
+               const char *server,
+               int *up_to_date);
+
 /**
  * Fetches the contents of the server into the "incoming" branch.
  */
@@ -38,6 +38,24 @@ static int create_file(const char *path, const char *contents)
     return 0;
 }
 
+static int expect_up_to_date(git_repository *repo, const char *server,
+                             int expected)
+{
+    int e = 0;
+    int up_to_date;
+
+    CHECK(sync_check(repo, server, &up_to_date));
+    if (up_to_date != expected)
+    {
+        fprintf(stderr, "sync_check returned %d, expected %d\n",
+                up_to_date, expected);
+        e = -1;
+    }
+
+exit:
+    return e;
+}
+
 static int do_sync(git_repository *repo, const char *server)
 {
     int e = 0;
@@ -110,6 +128,22 @@ int main(int argc, char *argv[])
 
     // TODO: Verify this in code
 
+    // Both sides are in sync, so checks should pass without a fetch:
+    CHECK(do_sync(repo_b, SERVER));
+    CHECK(expect_up_to_date(repo_a, SERVER, 1));
+    CHECK(expect_up_to_date(repo_b, SERVER, 1));
+
+    // Local changes:
+    CHECK(create_file(REPO_A "/d.txt", "a\n"));
+    CHECK(expect_up_to_date(repo_a, SERVER, 0));
+    CHECK(do_sync(repo_a, SERVER));
+    CHECK(expect_up_to_date(repo_a, SERVER, 1));
+
+    // Remote changes:
+    CHECK(expect_up_to_date(repo_b, SERVER, 0));
+    CHECK(do_sync(repo_b, SERVER));
+    CHECK(expect_up_to_date(repo_b, SERVER, 1));
+
 exit:
     if (repo_a) git_repository_free(repo_a);
     if (repo_b) git_repository_free(repo_b);
@@ -29,35 +29,57 @@
 
 #include "crypto_scrypt.h"
 #include "sysendian.h"
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 
-static void blkcpy(uint8_t *, uint8_t *, size_t);
-static void blkxor(uint8_t *, uint8_t *, size_t);
-static void salsa20_8(uint8_t[64]);
-static void blockmix_salsa8(uint8_t *, uint8_t *, size_t);
-static uint64_t integerify(uint8_t *, size_t);
-static void smix(uint8_t *, size_t, uint64_t, uint8_t *, uint8_t *);
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define HAVE_AVX2 1
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+/*
+ * Working memory is aligned for the vector kernels.  XY holds X, Y and a
+ * 64-byte scratch block.
+ */
+#define SCRYPT_ALIGN 64
+#define XY_SIZE(r) (256 * (r) + 64)
+
+typedef void (*smix_fn)(uint8_t *, size_t, uint64_t, void *, void *);
+
+/*
+ * Portable kernel.
+ * Blocks are kept as host-order 32-bit words for the whole of smix, so the
+ * byte order only gets converted on the way in and out.
+ */
 
 static void
-blkcpy(uint8_t * dest, uint8_t * src, size_t len)
+blkcpy(uint32_t * dest, const uint32_t * src, size_t len)
 {
-	size_t i;
 
-	for (i = 0; i < len; i++)
-		dest[i] = src[i];
+	memcpy(dest, src, len);
 }
 
 static void
-blkxor(uint8_t * dest, uint8_t * src, size_t len)
+blkxor(uint32_t * dest, const uint32_t * src, size_t len)
 {
 	size_t i;
 
-	for (i = 0; i < len; i++)
+	for (i = 0; i < len / 4; i++)
 		dest[i] ^= src[i];
 }
 
@@ -66,19 +88,14 @@ blkxor(uint8_t * dest, uint8_t * src, size_t len)
  * Apply the salsa20/8 core to the provided block.
  */
 static void
-salsa20_8(uint8_t B[64])
+salsa20_8(uint32_t B[16])
 {
-	uint32_t B32[16];
 	uint32_t x[16];
 	size_t i;
 
-	/* Convert little-endian values in. */
+	/* Compute x = doubleround^4(B). */
 	for (i = 0; i < 16; i++)
-		B32[i] = le32dec(&B[i * 4]);
-
-	/* Compute x = doubleround^4(B32). */
-	for (i = 0; i < 16; i++)
-		x[i] = B32[i];
+		x[i] = B[i];
 	for (i = 0; i < 8; i += 2) {
 #define R(a,b) (((a) << (b)) | ((a) >> (32 - (b))))
 		/* Operate on columns. */
@@ -109,44 +126,40 @@ salsa20_8(uint8_t B[64])
 #undef R
 	}
 
-	/* Compute B32 = B32 + x. */
+	/* Compute B = B + x. */
 	for (i = 0; i < 16; i++)
-		B32[i] += x[i];
-
-	/* Convert little-endian values out. */
-	for (i = 0; i < 16; i++)
-		le32enc(&B[4 * i], B32[i]);
+		B[i] += x[i];
 }
 
 /**
- * blockmix_salsa8(B, Y, r):
+ * blockmix_salsa8(B, Y, X, r):
  * Compute B = BlockMix_{salsa20/8, r}(B).  The input B must be 128r bytes in
- * length; the temporary space Y must also be the same size.
+ * length; the temporary space Y must also be the same size, and X must be
+ * 64 bytes.
  */
 static void
-blockmix_salsa8(uint8_t * B, uint8_t * Y, size_t r)
+blockmix_salsa8(uint32_t * B, uint32_t * Y, uint32_t * X, size_t r)
 {
-	uint8_t X[64];
 	size_t i;
 
 	/* 1: X <-- B_{2r - 1} */
-	blkcpy(X, &B[(2 * r - 1) * 64], 64);
+	blkcpy(X, &B[(2 * r - 1) * 16], 64);
 
 	/* 2: for i = 0 to 2r - 1 do */
 	for (i = 0; i < 2 * r; i++) {
 		/* 3: X <-- H(X \xor B_i) */
-		blkxor(X, &B[i * 64], 64);
+		blkxor(X, &B[i * 16], 64);
 		salsa20_8(X);
 
 		/* 4: Y_i <-- X */
-		blkcpy(&Y[i * 64], X, 64);
+		blkcpy(&Y[i * 16], X, 64);
 	}
 
 	/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
 	for (i = 0; i < r; i++)
-		blkcpy(&B[i * 64], &Y[(i * 2) * 64], 64);
+		blkcpy(&B[i * 16], &Y[(i * 2) * 16], 64);
 	for (i = 0; i < r; i++)
-		blkcpy(&B[(i + r) * 64], &Y[(i * 2 + 1) * 64], 64);
+		blkcpy(&B[(i + r) * 16], &Y[(i * 2 + 1) * 16], 64);
 }
 
 /**
@@ -154,37 +167,41 @@ blockmix_salsa8(uint8_t * B, uint8_t * Y, size_t r)
  * Return the result of parsing B_{2r-1} as a little-endian integer.
  */
 static uint64_t
-integerify(uint8_t * B, size_t r)
+integerify(const uint32_t * B, size_t r)
 {
-	uint8_t * X = &B[(2 * r - 1) * 64];
+	const uint32_t * X = &B[(2 * r - 1) * 16];
 
-	return (le64dec(X));
+	return (((uint64_t)(X[1]) << 32) + X[0]);
 }
 
 /**
- * smix(B, r, N, V, XY):
+ * smix_portable(B, r, N, V, XY):
  * Compute B = SMix_r(B, N).  The input B must be 128r bytes in length; the
  * temporary storage V must be 128rN bytes in length; the temporary storage
- * XY must be 256r bytes in length.  The value N must be a power of 2.
+ * XY must be XY_SIZE(r) bytes in length.  The value N must be a power of 2.
  */
 static void
-smix(uint8_t * B, size_t r, uint64_t N, uint8_t * V, uint8_t * XY)
+smix_portable(uint8_t * B, size_t r, uint64_t N, void * V, void * XY)
 {
-	uint8_t * X = XY;
-	uint8_t * Y = &XY[128 * r];
+	uint32_t * X = XY;
+	uint32_t * Y = &X[32 * r];
+	uint32_t * Z = &X[64 * r];
+	uint32_t * V32 = V;
 	uint64_t i;
 	uint64_t j;
+	size_t k;
 
 	/* 1: X <-- B */
-	blkcpy(X, B, 128 * r);
+	for (k = 0; k < 32 * r; k++)
+		X[k] = le32dec(&B[4 * k]);
 
 	/* 2: for i = 0 to N - 1 do */
 	for (i = 0; i < N; i++) {
 		/* 3: V_i <-- X */
-		blkcpy(&V[i * (128 * r)], X, 128 * r);
+		blkcpy(&V32[i * (32 * r)], X, 128 * r);
 
 		/* 4: X <-- H(X) */
-		blockmix_salsa8(X, Y, r);
+		blockmix_salsa8(X, Y, Z, r);
 	}
 
 	/* 6: for i = 0 to N - 1 do */
@@ -193,12 +210,504 @@ smix(uint8_t * B, size_t r, uint64_t N, uint8_t * V, uint8_t * XY)
 		j = integerify(X, r) & (N - 1);
 
 		/* 8: X <-- H(X \xor V_j) */
-		blkxor(X, &V[j * (128 * r)], 128 * r);
-		blockmix_salsa8(X, Y, r);
+		blkxor(X, &V32[j * (32 * r)], 128 * r);
+		blockmix_salsa8(X, Y, Z, r);
 	}
 
 	/* 10: B' <-- X */
-	blkcpy(B, X, 128 * r);
+	for (k = 0; k < 32 * r; k++)
+		le32enc(&B[4 * k], X[k]);
+}
+
+#ifdef HAVE_SSE2
+/*
+ * SSE2 kernel.
+ * Each 64-byte block is stored with its words permuted along the salsa20
+ * diagonals, so the column and row rounds become whole-register operations.
+ * Word i of a stored block holds word (5i mod 16) of the real block.
+ */
+
+static ALWAYS_INLINE void
+blkcpy_sse2(__m128i * dest, const __m128i * src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len / 16; i++)
+		dest[i] = src[i];
+}
+
+static ALWAYS_INLINE void
+blkxor_sse2(__m128i * dest, const __m128i * src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len / 16; i++)
+		dest[i] = _mm_xor_si128(dest[i], src[i]);
+}
+
+static ALWAYS_INLINE void
+salsa20_8_sse2(__m128i B[4])
+{
+	__m128i X0, X1, X2, X3;
+	__m128i T;
+	size_t i;
+
+	X0 = B[0];
+	X1 = B[1];
+	X2 = B[2];
+	X3 = B[3];
+
+	for (i = 0; i < 8; i += 2) {
+#define R(x, t, b) \
+	x = _mm_xor_si128(x, _mm_slli_epi32(t, b)); \
+	x = _mm_xor_si128(x, _mm_srli_epi32(t, 32 - b))
+		/* Operate on "columns". */
+		T = _mm_add_epi32(X0, X3);
+		R(X1, T, 7);
+		T = _mm_add_epi32(X1, X0);
+		R(X2, T, 9);
+		T = _mm_add_epi32(X2, X1);
+		R(X3, T, 13);
+		T = _mm_add_epi32(X3, X2);
+		R(X0, T, 18);
+
+		/* Rearrange data. */
+		X1 = _mm_shuffle_epi32(X1, 0x93);
+		X2 = _mm_shuffle_epi32(X2, 0x4E);
+		X3 = _mm_shuffle_epi32(X3, 0x39);
+
+		/* Operate on "rows". */
+		T = _mm_add_epi32(X0, X1);
+		R(X3, T, 7);
+		T = _mm_add_epi32(X3, X0);
+		R(X2, T, 9);
+		T = _mm_add_epi32(X2, X3);
+		R(X1, T, 13);
+		T = _mm_add_epi32(X1, X2);
+		R(X0, T, 18);
+
+		/* Rearrange data. */
+		X1 = _mm_shuffle_epi32(X1, 0x39);
+		X2 = _mm_shuffle_epi32(X2, 0x4E);
+		X3 = _mm_shuffle_epi32(X3, 0x93);
+#undef R
+	}
+
+	B[0] = _mm_add_epi32(B[0], X0);
+	B[1] = _mm_add_epi32(B[1], X1);
+	B[2] = _mm_add_epi32(B[2], X2);
+	B[3] = _mm_add_epi32(B[3], X3);
+}
+
+/**
+ * blockmix_salsa8_sse2(Bin, Bout, X, r):
+ * Compute Bout = BlockMix_{salsa20/8, r}(Bin).  The input Bin must be 128r
+ * bytes in length; the output Bout must also be the same size, and the
+ * temporary space X must be 64 bytes.
+ */
+static ALWAYS_INLINE void
+blockmix_salsa8_sse2(const __m128i * Bin, __m128i * Bout, __m128i * X,
+    size_t r)
+{
+	size_t i;
+
+	/* 1: X <-- B_{2r - 1} */
+	blkcpy_sse2(X, &Bin[8 * r - 4], 64);
+
+	/* 2: for i = 0 to 2r - 1 do */
+	for (i = 0; i < r; i++) {
+		/* 3: X <-- H(X \xor B_i) */
+		blkxor_sse2(X, &Bin[i * 8], 64);
+		salsa20_8_sse2(X);
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		blkcpy_sse2(&Bout[i * 4], X, 64);
+
+		/* 3: X <-- H(X \xor B_i) */
+		blkxor_sse2(X, &Bin[i * 8 + 4], 64);
+		salsa20_8_sse2(X);
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		blkcpy_sse2(&Bout[(r + i) * 4], X, 64);
+	}
+}
+
+static ALWAYS_INLINE uint64_t
+integerify_sse2(const void * B, size_t r)
+{
+	const uint32_t * X = (const void *)((uintptr_t)(B) + (2 * r - 1) * 64);
+
+	return (((uint64_t)(X[13]) << 32) + X[0]);
+}
+
+/**
+ * smix_sse2_body(B, r, N, V, XY):
+ * Same contract as smix_portable, except that N must be at least 2 and V and
+ * XY must be 16-byte aligned.  The body is inlined into one function per
+ * instruction set, so the AVX2 copy gets VEX-encoded code throughout.
+ */
+static ALWAYS_INLINE void
+smix_sse2_body(uint8_t * B, size_t r, uint64_t N, void * V, void * XY)
+{
+	__m128i * X = XY;
+	__m128i * Y = (void *)((uintptr_t)(XY) + 128 * r);
+	__m128i * Z = (void *)((uintptr_t)(XY) + 256 * r);
+	uint32_t * X32 = (void *)X;
+	uint64_t i, j;
+	size_t k;
+
+	/* 1: X <-- B */
+	for (k = 0; k < 2 * r; k++) {
+		for (i = 0; i < 16; i++) {
+			X32[k * 16 + i] =
+			    le32dec(&B[(k * 16 + (i * 5 % 16)) * 4]);
+		}
+	}
+
+	/* 2: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		/* 3: V_i <-- X */
+		blkcpy_sse2((void *)((uintptr_t)(V) + i * 128 * r), X, 128 * r);
+
+		/* 4: X <-- H(X) */
+		blockmix_salsa8_sse2(X, Y, Z, r);
+
+		/* 3: V_i <-- X */
+		blkcpy_sse2((void *)((uintptr_t)(V) + (i + 1) * 128 * r),
+		    Y, 128 * r);
+
+		/* 4: X <-- H(X) */
+		blockmix_salsa8_sse2(Y, X, Z, r);
+	}
+
+	/* 6: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		/* 7: j <-- Integerify(X) mod N */
+		j = integerify_sse2(X, r) & (N - 1);
+
+		/* 8: X <-- H(X \xor V_j) */
+		blkxor_sse2(X, (void *)((uintptr_t)(V) + j * 128 * r), 128 * r);
+		blockmix_salsa8_sse2(X, Y, Z, r);
+
+		/* 7: j <-- Integerify(X) mod N */
+		j = integerify_sse2(Y, r) & (N - 1);
+
+		/* 8: X <-- H(X \xor V_j) */
+		blkxor_sse2(Y, (void *)((uintptr_t)(V) + j * 128 * r), 128 * r);
+		blockmix_salsa8_sse2(Y, X, Z, r);
+	}
+
+	/* 10: B' <-- X */
+	for (k = 0; k < 2 * r; k++) {
+		for (i = 0; i < 16; i++) {
+			le32enc(&B[(k * 16 + (i * 5 % 16)) * 4],
+			    X32[k * 16 + i]);
+		}
+	}
+}
+
+static void
+smix_sse2(uint8_t * B, size_t r, uint64_t N, void * V, void * XY)
+{
+
+	smix_sse2_body(B, r, N, V, XY);
+}
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+static void
+smix_avx2(uint8_t * B, size_t r, uint64_t N, void * V, void * XY)
+{
+
+	smix_sse2_body(B, r, N, V, XY);
+}
+#endif
+#endif /* HAVE_SSE2 */
+
+static enum crypto_scrypt_backend backend_forced = CRYPTO_SCRYPT_AUTO;
+
+int
+crypto_scrypt_backend_supported(enum crypto_scrypt_backend backend)
+{
+
+	switch (backend) {
+	case CRYPTO_SCRYPT_AUTO:
+	case CRYPTO_SCRYPT_PORTABLE:
+		return (1);
+#ifdef HAVE_SSE2
+	case CRYPTO_SCRYPT_SSE2:
+		return (1);
+#ifdef HAVE_AVX2
+	case CRYPTO_SCRYPT_AVX2:
+		__builtin_cpu_init();
+		return (__builtin_cpu_supports("avx2"));
+#endif
+#endif
+	default:
+		return (0);
+	}
+}
+
+static enum crypto_scrypt_backend
+backend_current(void)
+{
+
+	if (backend_forced != CRYPTO_SCRYPT_AUTO)
+		return (backend_forced);
+	if (crypto_scrypt_backend_supported(CRYPTO_SCRYPT_AVX2))
+		return (CRYPTO_SCRYPT_AVX2);
+	if (crypto_scrypt_backend_supported(CRYPTO_SCRYPT_SSE2))
+		return (CRYPTO_SCRYPT_SSE2);
+	return (CRYPTO_SCRYPT_PORTABLE);
+}
+
+int
+crypto_scrypt_backend_set(enum crypto_scrypt_backend backend)
+{
+
+	if (!crypto_scrypt_backend_supported(backend))
+		return (-1);
+	backend_forced = backend;
+	return (0);
+}
+
+const char *
+crypto_scrypt_backend_name(enum crypto_scrypt_backend backend)
+{
+
+	switch (backend == CRYPTO_SCRYPT_AUTO ? backend_current() : backend) {
+	case CRYPTO_SCRYPT_PORTABLE:
+		return ("portable");
+	case CRYPTO_SCRYPT_SSE2:
+		return ("sse2");
+	case CRYPTO_SCRYPT_AVX2:
+		return ("avx2");
+	default:
+		return ("unknown");
+	}
+}
+
+/**
+ * smix_select(N):
+ * Return the kernel to use for this call.  The vector kernels work on two
+ * blocks per loop iteration, so N = 1 always takes the portable path.
+ */
+static smix_fn
+smix_select(uint64_t N)
+{
+
+	if (N < 2)
+		return (smix_portable);
+	switch (backend_current()) {
+#ifdef HAVE_SSE2
+	case CRYPTO_SCRYPT_SSE2:
+		return (smix_sse2);
+#ifdef HAVE_AVX2
+	case CRYPTO_SCRYPT_AVX2:
+		return (smix_avx2);
+#endif
+#endif
+	default:
+		return (smix_portable);
+	}
+}
+
+/*
+ * Per-thread scratch arena.
+ * Each thread keeps a few recently-freed working buffers, so back-to-back
+ * hashes on the same thread skip the allocator and the page faults that
+ * come with fresh memory.  Sizes are rounded up to one of four classes per
+ * power of two, which wastes at most 25%.  Buffers hold password-derived
+ * state, so they get wiped before going back to the arena or the system.
+ * The cap keeps default-sized hashes cached, but lets the largest ones go.
+ */
+#define ARENA_SLOTS 4
+#define ARENA_MAX_BYTES ((size_t)(32) * 1024 * 1024)
+
+struct arena {
+	size_t size[ARENA_SLOTS];
+	void * buf[ARENA_SLOTS];
+	size_t bytes;
+};
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static int arena_ok;
+
+/**
+ * arena_wipe(p, size):
+ * Clear and free memory from arena_alloc(size).
+ */
+static void
+arena_wipe(void * p, size_t size)
+{
+
+	if (p == NULL)
+		return;
+	OPENSSL_cleanse(p, size);
+	free(p);
+}
+
+static void
+arena_destroy(void * p)
+{
+	struct arena * a = p;
+	size_t i;
+
+	for (i = 0; i < ARENA_SLOTS; i++)
+		arena_wipe(a->buf[i], a->size[i]);
+	free(a);
+}
+
+static void
+arena_init(void)
+{
+
+	arena_ok = !pthread_key_create(&arena_key, arena_destroy);
+}
+
+/**
+ * arena_get(create):
+ * Return the calling thread's arena, or NULL if there isn't one.
+ */
+static struct arena *
+arena_get(int create)
+{
+	struct arena * a;
+
+	pthread_once(&arena_once, arena_init);
+	if (!arena_ok)
+		return (NULL);
+
+	a = pthread_getspecific(arena_key);
+	if (a == NULL && create) {
+		if ((a = calloc(1, sizeof(struct arena))) == NULL)
+			return (NULL);
+		if (pthread_setspecific(arena_key, a)) {
+			free(a);
+			return (NULL);
+		}
+	}
+	return (a);
+}
+
+static size_t
+arena_round(size_t size)
+{
+	size_t step = 64;
+
+	while (step * 8 <= size)
+		step *= 2;
+	return ((size + step - 1) / step * step);
+}
+
+/**
+ * arena_alloc(size):
+ * Return SCRYPT_ALIGN-aligned memory of at least size bytes, or NULL.
+ */
+static void *
+arena_alloc(size_t size)
+{
+	struct arena * a = arena_get(0);
+	void * p;
+	size_t i;
+
+	size = arena_round(size);
+	if (a != NULL) {
+		for (i = 0; i < ARENA_SLOTS; i++) {
+			if (a->buf[i] != NULL && a->size[i] == size) {
+				p = a->buf[i];
+				a->buf[i] = NULL;
+				a->bytes -= size;
+				return (p);
+			}
+		}
+	}
+
+	if (posix_memalign(&p, SCRYPT_ALIGN, size))
+		return (NULL);
+	return (p);
+}
+
+/**
+ * arena_free(p, size):
+ * Give memory from arena_alloc(size) back to the calling thread's arena,
+ * or to the system if the arena is full.
+ */
+static void
+arena_free(void * p, size_t size)
+{
+	struct arena * a = arena_get(1);
+	size_t i;
+
+	size = arena_round(size);
+	if (a != NULL && a->bytes + size <= ARENA_MAX_BYTES) {
+		for (i = 0; i < ARENA_SLOTS; i++) {
+			if (a->buf[i] == NULL) {
+				OPENSSL_cleanse(p, size);
+				a->buf[i] = p;
+				a->size[i] = size;
+				a->bytes += size;
+				return;
+			}
+		}
+	}
+	arena_wipe(p, size);
+}
+
+void
+crypto_scrypt_arena_release(void)
+{
+	struct arena * a = arena_get(0);
+	size_t i;
+
+	if (a == NULL)
+		return;
+	for (i = 0; i < ARENA_SLOTS; i++) {
+		arena_wipe(a->buf[i], a->size[i]);
+		a->buf[i] = NULL;
+	}
+	a->bytes = 0;
+}
+
+/* State shared by the mixing lanes of one hash. */
+struct lanes {
+	smix_fn smix;
+	uint8_t * B;
+	size_t r;
+	uint64_t N;
+	int * failed;
+};
+
+/**
+ * lane_run(state, i):
+ * Compute B_i <-- MF(B_i, N), using working memory from this thread's arena.
+ */
+static void
+lane_run(void * state, uint32_t i)
+{
+	struct lanes * l = state;
+	size_t Vsize = (size_t)((uint64_t)(128) * l->r * l->N);
+	void * V;
+	void * XY;
+
+	if ((XY = arena_alloc(XY_SIZE(l->r))) == NULL)
+		goto err0;
+	if ((V = arena_alloc(Vsize)) == NULL)
+		goto err1;
+
+	l->smix(&l->B[i * 128 * l->r], l->r, l->N, V, XY);
+
+	arena_free(V, Vsize);
+	arena_free(XY, XY_SIZE(l->r));
+	return;
+
+err1:
+	arena_free(XY, XY_SIZE(l->r));
+err0:
+	l->failed[i] = 1;
 }
 
 /**
@@ -215,9 +724,20 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
     const uint8_t * salt, size_t saltlen, uint64_t N, uint32_t r, uint32_t p,
     uint8_t * buf, size_t buflen)
 {
+
+	return (crypto_scrypt_foreach(passwd, passwdlen, salt, saltlen,
+	    N, r, p, buf, buflen, NULL, NULL));
+}
+
+int
+crypto_scrypt_foreach(const uint8_t * passwd, size_t passwdlen,
+    const uint8_t * salt, size_t saltlen, uint64_t N, uint32_t r, uint32_t p,
+    uint8_t * buf, size_t buflen, crypto_scrypt_foreach_fn foreach,
+    void * ctx)
+{
+	struct lanes l;
 	uint8_t * B;
-	uint8_t * V;
-	uint8_t * XY;
+	int * failed;
 	uint32_t i;
 
 	/* Sanity-check parameters. */
@@ -247,10 +767,8 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 	/* Allocate memory. */
 	if ((B = malloc(128 * r * p)) == NULL)
 		goto err0;
-	if ((XY = malloc(256 * r)) == NULL)
+	if ((failed = calloc(p, sizeof(int))) == NULL)
 		goto err1;
-	if ((V = malloc((unsigned long)((uint64_t) 128 * r * (uint64_t) N))) == NULL)
-		goto err2;
 
 	/* 1: (B_0 ... B_{p-1}) <-- PBKDF2(P, S, 1, p * MFLen) */
 	if (!PKCS5_PBKDF2_HMAC((char *)passwd, passwdlen, salt, saltlen,
@@ -258,9 +776,23 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 		goto err2;
 
 	/* 2: for i = 0 to p - 1 do */
+	/* 3: B_i <-- MF(B_i, N) */
+	l.smix = smix_select(N);
+	l.B = B;
+	l.r = r;
+	l.N = N;
+	l.failed = failed;
+	if (foreach != NULL) {
+		foreach(ctx, p, lane_run, &l);
+	} else {
+		for (i = 0; i < p; i++)
+			lane_run(&l, i);
+	}
 	for (i = 0; i < p; i++) {
-		/* 3: B_i <-- MF(B_i, N) */
-		smix(&B[i * 128 * r], r, N, V, XY);
+		if (failed[i]) {
+			errno = ENOMEM;
+			goto err2;
+		}
 	}
 
 	/* 5: DK <-- PBKDF2(P, B, 1, dkLen) */
@@ -269,15 +801,14 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 		goto err2;
 
 	/* Free memory. */
-	free(V);
-	free(XY);
+	free(failed);
 	free(B);
 
 	/* Success! */
 	return (0);
 
 err2:
-	free(XY);
+	free(failed);
 err1:
 	free(B);
 err0:
@@ -48,6 +48,68 @@ extern "C" {
 int crypto_scrypt(const uint8_t *, size_t, const uint8_t *, size_t, uint64_t,
     uint32_t, uint32_t, uint8_t *, size_t);
 
+/**
+ * Salsa20/8 kernels for the memory-hard mixing step.
+ * CRYPTO_SCRYPT_AUTO picks the fastest one the CPU supports.
+ */
+enum crypto_scrypt_backend {
+	CRYPTO_SCRYPT_AUTO = 0,
+	CRYPTO_SCRYPT_PORTABLE,
+	CRYPTO_SCRYPT_SSE2,
+	CRYPTO_SCRYPT_AVX2
+};
+
+/**
+ * crypto_scrypt_backend_set(backend):
+ * Force crypto_scrypt to use a particular kernel.  This is meant for
+ * benchmarks and tests, and must not race with running hashes.
+ *
+ * Return 0 on success; or -1 if the CPU cannot run that kernel.
+ */
+int crypto_scrypt_backend_set(enum crypto_scrypt_backend);
+
+/**
+ * crypto_scrypt_backend_supported(backend):
+ * Return non-zero if this build and CPU can run the given kernel.
+ */
+int crypto_scrypt_backend_supported(enum crypto_scrypt_backend);
+
+/**
+ * crypto_scrypt_backend_name(backend):
+ * Return a printable name for a kernel.  CRYPTO_SCRYPT_AUTO gives the name
+ * of the kernel crypto_scrypt would use right now.
+ */
+const char * crypto_scrypt_backend_name(enum crypto_scrypt_backend);
+
+/**
+ * A function that runs lane(state, i) once for each i in [0, count).
+ * The calls may happen concurrently, and must all finish before returning.
+ */
+typedef void (*crypto_scrypt_lane_fn)(void *, uint32_t);
+typedef void (*crypto_scrypt_foreach_fn)(void *, uint32_t,
+    crypto_scrypt_lane_fn, void *);
+
+/**
+ * crypto_scrypt_foreach(passwd, passwdlen, salt, saltlen, N, r, p, buf,
+ *     buflen, foreach, ctx):
+ * Same as crypto_scrypt, but hand the p independent mixing lanes to
+ * foreach(ctx, ...), which may spread them across threads.  Each lane
+ * takes 128rN bytes of working memory from its thread's arena.  If foreach
+ * is NULL, the lanes run one after another on the calling thread.
+ *
+ * Return 0 on success; or -1 on error.
+ */
+int crypto_scrypt_foreach(const uint8_t *, size_t, const uint8_t *, size_t,
+    uint64_t, uint32_t, uint32_t, uint8_t *, size_t,
+    crypto_scrypt_foreach_fn, void *);
+
+/**
+ * crypto_scrypt_arena_release():
+ * Wipe and free the working memory the calling thread keeps between hashes.
+ * Other threads release theirs when they exit.
+ */
+void crypto_scrypt_arena_release(void);
+
 #ifdef __cplusplus
 }
 #endif
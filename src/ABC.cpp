@@ -22,6 +22,7 @@
 #include "../abcd/bitcoin/cache/Cache.hpp"
 #include "../abcd/bitcoin/WatcherBridge.hpp"
 #include "../abcd/crypto/Encoding.hpp"
+#include "../abcd/crypto/Scrypt.hpp"
 #include "../abcd/crypto/Random.hpp"
 #include "../abcd/exchange/ExchangeCache.hpp"
 #include "../abcd/http/Http.hpp"
@@ -854,6 +855,19 @@ exit:
     return cc;
 }
 
+tABC_CC ABC_WalletLoadAll(const char *szUserName,
+                          tABC_Error *pError)
+{
+    ABC_PROLOG();
+
+    {
+        ABC_CHECK_NEW(cacheWalletsLoad(szUserName));
+    }
+
+exit:
+    return cc;
+}
+
 tABC_CC ABC_WalletRemove(const char *szUserName,
                          const char *szWalletUUID,
                          tABC_Error *pError)
@@ -931,6 +945,54 @@ tABC_CC ABC_ClearKeyCache(tABC_Error *pError)
     ABC_PROLOG();
 
     cacheLogout();
+    scryptCacheClear();
+
+exit:
+    return cc;
+}
+
+tABC_CC ABC_SetLoginCacheLimits(unsigned int maxUsers,
+                                unsigned int idleSeconds,
+                                tABC_Error *pError)
+{
+    ABC_PROLOG();
+
+    cacheLimitsSet(maxUsers, std::chrono::seconds(idleSeconds));
+
+exit:
+    return cc;
+}
+
+tABC_CC ABC_LoginCacheStats(unsigned int *pUsers,
+                            unsigned int *pHits,
+                            unsigned int *pMisses,
+                            unsigned int *pEvictions,
+                            tABC_Error *pError)
+{
+    ABC_PROLOG();
+
+    {
+        const auto stats = cacheStats();
+        if (pUsers)
+            *pUsers = stats.sessions;
+        if (pHits)
+            *pHits = stats.hits;
+        if (pMisses)
+            *pMisses = stats.misses;
+        if (pEvictions)
+            *pEvictions = stats.evictions;
+    }
+
+exit:
+    return cc;
+}
+
+tABC_CC ABC_SetScryptCache(unsigned int lifetimeSeconds,
+                           tABC_Error *pError)
+{
+    ABC_PROLOG();
+
+    ABC_CHECK_NEW(scryptCacheSet(std::chrono::seconds(lifetimeSeconds)));
 
 exit:
     return cc;
@@ -2738,6 +2800,24 @@ exit:
     return cc;
 }
 
+tABC_CC ABC_DataSyncAll(const char *szUserName,
+                        const char *szPassword,
+                        bool *pbDirty,
+                        tABC_Error *pError)
+{
+    ABC_PROLOG();
+    ABC_CHECK_NULL(pbDirty);
+
+    {
+        bool dirty = false;
+        ABC_CHECK_NEW(cacheSyncAll(szUserName, dirty));
+        *pbDirty = dirty;
+    }
+
+exit:
+    return cc;
+}
+
 /**
  * Start the watcher for a wallet
  *
@@ -2765,6 +2845,8 @@ exit:
  * Runs the watcher update loop. This function will run for an arbitrarily
  * long amount of time as it works to keep the watcher up-to-date with the
  * network. To cause the function to return, call ABC_WatcherStop.
+ * The work happens on a shared background thread,
+ * but the wallet's events are delivered on the thread calling this function.
  *
  * @param szWalletUUID The wallet watcher to use
  */
@@ -2786,6 +2868,59 @@ exit:
     return cc;
 }
 
+/**
+ * Starts keeping the wallet up-to-date with the network,
+ * but returns immediately rather than blocking like ABC_WatcherLoop.
+ * Every wallet shares the same background thread and server connections,
+ * so this is the better choice when running many wallets at once.
+ * Call ABC_WatcherStop to stop the updates.
+ * Events are delivered on the shared background thread,
+ * so the callback should hand them off rather than doing slow work.
+ *
+ * @param szWalletUUID The wallet watcher to use
+ */
+tABC_CC ABC_WatcherListen(const char *szWalletUUID,
+                          tABC_BitCoin_Event_Callback fAsyncBitCoinEventCallback,
+                          void *pData,
+                          tABC_Error *pError)
+{
+    ABC_PROLOG();
+    ABC_CHECK_NULL(fAsyncBitCoinEventCallback);
+
+    {
+        ABC_GET_WALLET_N();
+        ABC_CHECK_NEW(bridgeWatcherListen(*wallet,
+                                          fAsyncBitCoinEventCallback, pData));
+    }
+
+exit:
+    return cc;
+}
+
+/**
+ * Chooses how the watcher reports new transactions that arrive together.
+ * By default, each new transaction gets its own IncomingBitCoin event.
+ * With batching on, two or more new transactions arriving together
+ * produce a single IncomingBitCoinBatch event listing them all,
+ * so the GUI can redraw once.
+ *
+ * @param szWalletUUID The wallet watcher to use
+ * @param bBatch       True to receive IncomingBitCoinBatch events
+ */
+tABC_CC ABC_WatcherBatchEvents(const char *szWalletUUID, bool bBatch,
+                               tABC_Error *pError)
+{
+    ABC_PROLOG();
+
+    {
+        ABC_GET_WALLET_N();
+        ABC_CHECK_NEW(bridgeWatcherBatchEvents(*wallet, bBatch));
+    }
+
+exit:
+    return cc;
+}
+
 tABC_CC ABC_WatcherConnect(const char *szWalletUUID, tABC_Error *pError)
 {
     ABC_PROLOG();
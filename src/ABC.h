@@ -195,6 +195,9 @@ typedef enum eABC_AsyncEventType
     ABC_AsyncEventType_AddressCheckDone,
     ABC_AsyncEventType_IncomingSweep,
     ABC_AsyncEventType_TransactionUpdate,
+    /** Several new transactions arrived together.
+     * Only sent to wallets that opt in with ABC_WatcherBatchEvents. */
+    ABC_AsyncEventType_IncomingBitCoinBatch,
 } tABC_AsyncEventType;
 
 /**
@@ -234,6 +237,12 @@ typedef struct sABC_AsyncBitCoinInfo
 
     /** The amount swept, if this is a sweep. */
     int64_t sweepSatoshi;
+
+    /** If the event involved several transactions, these are their IDs. */
+    const char **aszTxIDs;
+
+    /** The number of entries in aszTxIDs. */
+    unsigned int countTxIDs;
 } tABC_AsyncBitCoinInfo;
 
 /**
@@ -532,6 +541,44 @@ tABC_CC ABC_IsTestNet(bool *pResult, tABC_Error *pError);
 /* === All data at once: === */
 tABC_CC ABC_ClearKeyCache(tABC_Error *pError);
 
+/**
+ * Sets how many users can stay logged in at once.
+ * Once the limit is reached, the least-recently used user gets logged out.
+ * @param maxUsers              The most users to keep in memory
+ * @param idleSeconds           Logs out users that go unused this long,
+ *                              or never if this is zero
+ */
+tABC_CC ABC_SetLoginCacheLimits(unsigned int maxUsers,
+                                unsigned int idleSeconds,
+                                tABC_Error *pError);
+
+/**
+ * Reads the login cache counters, which start at zero when the library does.
+ * Any of the pointers can be null if the caller doesn't need that value.
+ * @param pUsers                Receives how many users are in memory now
+ * @param pHits                 Receives how many lookups found their user
+ *                              already loaded
+ * @param pMisses               Receives how many lookups had to load
+ *                              their user from disk
+ * @param pEvictions            Receives how many users were logged out
+ *                              for being idle or not fitting
+ */
+tABC_CC ABC_LoginCacheStats(unsigned int *pUsers,
+                            unsigned int *pHits,
+                            unsigned int *pMisses,
+                            unsigned int *pEvictions,
+                            tABC_Error *pError);
+
+/**
+ * Remembers scrypt results in locked memory for a while,
+ * so repeated password and PIN checks return immediately.
+ * ABC_ClearKeyCache wipes these results too.
+ * @param lifetimeSeconds       How long to keep results,
+ *                              or zero to turn the cache off (the default)
+ */
+tABC_CC ABC_SetScryptCache(unsigned int lifetimeSeconds,
+                           tABC_Error *pError);
+
 /* === General info: === */
 
 /**
@@ -1097,6 +1144,14 @@ tABC_CC ABC_WalletLoad(const char *szUserName,
                        const char *szWalletUUID,
                        tABC_Error *pError);
 
+/**
+ * Loads every wallet in the account into memory, several at a time.
+ * Calls to `ABC_WalletLoad` on other threads return as soon as
+ * their particular wallet is ready.
+ */
+tABC_CC ABC_WalletLoadAll(const char *szUserName,
+                          tABC_Error *pError);
+
 /**
  * Obtains the wallet's text name.
  */
@@ -1164,6 +1219,18 @@ tABC_CC ABC_DataSyncWallet(const char *szUserName,
                            bool *pbDirty,
                            tABC_Error *pError);
 
+/**
+ * Syncs the account repo and every wallet repo at once,
+ * instead of one `ABC_DataSyncAccount` / `ABC_DataSyncWallet` at a time.
+ * This only moves repo data, so it does not check for password changes.
+ * Per-repo timings and change counts go to the log.
+ * @param pbDirty   Set to true if any repo changed
+ */
+tABC_CC ABC_DataSyncAll(const char *szUserName,
+                        const char *szPassword,
+                        bool *pbDirty,
+                        tABC_Error *pError);
+
 /* === Receiving: === */
 tABC_CC ABC_CreateReceiveRequest(const char *szUserName,
                                  const char *szPassword,
@@ -1358,13 +1425,24 @@ tABC_CC ABC_WatcherStart(const char *szUserName,
                          const char *szWalletUUID,
                          tABC_Error *pError);
 
+/** Blocks until ABC_WatcherStop, delivering events on the calling thread. */
 tABC_CC ABC_WatcherLoop(const char *szWalletUUID,
                         tABC_BitCoin_Event_Callback fAsyncBitCoinEventCallback,
                         void *pData,
                         tABC_Error *pError);
 
+/** Returns at once. Events arrive on the shared watcher thread,
+ * so the callback should hand them off rather than block. */
+tABC_CC ABC_WatcherListen(const char *szWalletUUID,
+                          tABC_BitCoin_Event_Callback fAsyncBitCoinEventCallback,
+                          void *pData,
+                          tABC_Error *pError);
+
 tABC_CC ABC_WatcherConnect(const char *szWalletUUID, tABC_Error *pError);
 
+tABC_CC ABC_WatcherBatchEvents(const char *szWalletUUID, bool bBatch,
+                               tABC_Error *pError);
+
 tABC_CC ABC_PrioritizeAddress(const char *szUserName, const char *szPassword,
                               const char *szWalletUUID, const char *szAddress,
                               tABC_Error *pError);
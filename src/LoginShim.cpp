@@ -14,11 +14,34 @@
 #include "../abcd/login/LoginRecovery2.hpp"
 #include "../abcd/login/LoginStore.hpp"
 #include "../abcd/wallet/Wallet.hpp"
+#include "../abcd/bitcoin/cache/Cache.hpp"
+#include "../abcd/util/Debug.hpp"
+#include "../abcd/util/Parallel.hpp"
+#include "../abcd/util/Sync.hpp"
+#include <condition_variable>
+#include <list>
 #include <map>
 #include <mutex>
+#include <set>
+#include <vector>
 
 namespace abcd {
 
+constexpr size_t sessionLimitDefault = 8;
+
+/**
+ * Everything we have decrypted for one user.
+ */
+struct Session
+{
+    std::shared_ptr<LoginStore> store;
+    std::shared_ptr<Login> login;
+    std::shared_ptr<Account> account;
+    std::map<std::string, std::shared_ptr<Wallet>> wallets;
+    std::chrono::steady_clock::time_point lastUsed;
+};
+typedef std::list<Session> SessionList;
+
 // This mutex protects the shared_ptr caches themselves.
 // Using a reference count ensures that any objects still in use
 // on another thread will not be destroyed during a cache update.
@@ -26,54 +49,291 @@ namespace abcd {
 // not when using the objects inside.
 // The cached objects must provide their own thread safety.
 static std::mutex gLoginMutex;
-static std::shared_ptr<LoginStore> gLoginStoreCache;
-static std::shared_ptr<Login> gLoginCache;
-static std::shared_ptr<Account> gAccountCache;
-static std::map<std::string, std::shared_ptr<Wallet>> gWalletCache;
+
+// The most recently used session is at the front,
+// and the index finds sessions by their fixed username:
+static SessionList gSessions;
+static std::map<std::string, SessionList::iterator> gSessionIndex;
+static size_t gSessionLimit = sessionLimitDefault;
+static std::chrono::seconds gSessionIdle(0);
+static LoginCacheStats gStats;
+
+// Users with a store, login, or account being loaded outside the mutex:
+static std::set<std::string> gUsersLoading;
+static std::condition_variable gUserLoaded;
+
+// Wallets being loaded outside the mutex, by id:
+static std::set<std::string> gWalletsLoading;
+static std::condition_variable gWalletLoaded;
+
+/**
+ * Drops a session from the cache.
+ * The caller should already be holding the login mutex.
+ * @return the session after the erased one.
+ */
+static SessionList::iterator
+sessionErase(SessionList::iterator i)
+{
+    gSessionIndex.erase(i->store->username());
+    return gSessions.erase(i);
+}
+
+/**
+ * Returns true if any of the session's objects are in use elsewhere,
+ * such as by another thread or a running watcher.
+ * Evicting such a session would let a second copy load,
+ * with both copies writing the same files.
+ * The caller should already be holding the login mutex.
+ */
+static bool
+sessionBusy(const Session &session)
+{
+    // Each object holds its parent, so some references are our own:
+    const long accountRefs = 1 + session.wallets.size();
+    const long loginRefs = 1 + !!session.account;
+    const long storeRefs = 1 + !!session.login;
+
+    for (const auto &wallet: session.wallets)
+        if (1 < wallet.second.use_count())
+            return true;
+    return (session.account && accountRefs < session.account.use_count()) ||
+           (session.login && loginRefs < session.login.use_count()) ||
+           storeRefs < session.store.use_count();
+}
 
 /**
- * Clears the cached login.
+ * Evicts sessions that have sat idle for too long,
+ * or that no longer fit in the cache.
+ * Busy sessions stay, even if that leaves the cache over its limit,
+ * and so does the `keep` session, which the caller is about to return.
  * The caller should already be holding the login mutex.
  */
 static void
-cacheClear()
+sessionPrune(const Session *keep=nullptr,
+             std::chrono::steady_clock::time_point now=
+                 std::chrono::steady_clock::now())
+{
+    auto i = gSessions.end();
+    while (gSessions.begin() != i)
+    {
+        --i;
+        if (gSessions.size() <= gSessionLimit &&
+                (!gSessionIdle.count() || now < i->lastUsed + gSessionIdle))
+            break;
+        if (keep == &*i || sessionBusy(*i))
+            continue;
+
+        ABC_DebugLog("Evicting cached login for %s",
+                     i->store->username().c_str());
+        i = sessionErase(i);
+        ++gStats.evictions;
+    }
+}
+
+/**
+ * Finds the session that goes with a store,
+ * bringing it back if it has been evicted in the meantime.
+ * The caller should already be holding the login mutex.
+ */
+static Session &
+sessionFor(const std::shared_ptr<LoginStore> &store)
+{
+    auto i = gSessionIndex.find(store->username());
+    if (gSessionIndex.end() == i)
+    {
+        Session session;
+        session.store = store;
+        gSessions.push_front(session);
+        i = gSessionIndex.emplace(store->username(), gSessions.begin()).first;
+    }
+    else
+    {
+        gSessions.splice(gSessions.begin(), gSessions, i->second);
+    }
+
+    gSessions.front().lastUsed = std::chrono::steady_clock::now();
+    return gSessions.front();
+}
+
+/**
+ * Finds the session for a logged-in user,
+ * bringing it back if it has been evicted in the meantime.
+ * The caller should already be holding the login mutex.
+ */
+static Session &
+sessionFor(const std::shared_ptr<Login> &login)
+{
+    auto &session = sessionFor(login->store.shared_from_this());
+    if (!session.login)
+        session.login = login;
+    return session;
+}
+
+/**
+ * Retrieves one of a session's objects, creating it if necessary.
+ * The creation runs outside the mutex, so other users stay responsive,
+ * but anybody loading something for the same user waits their turn.
+ */
+template<typename T, typename Create>
+static Status
+sessionLoad(std::shared_ptr<T> &result,
+            const std::shared_ptr<LoginStore> &store,
+            std::shared_ptr<T> Session::*member, Create create)
 {
-    gLoginStoreCache.reset();
-    gLoginCache.reset();
-    gAccountCache.reset();
-    gWalletCache.clear();
+    const std::string username = store->username();
+
+    // Try to return the object from the cache:
+    {
+        std::unique_lock<std::mutex> lock(gLoginMutex);
+        while (gUsersLoading.count(username))
+            gUserLoaded.wait(lock);
+
+        auto &session = sessionFor(store);
+        if (session.*member)
+        {
+            result = session.*member;
+            return Status();
+        }
+        gUsersLoading.insert(username);
+    }
+
+    // Create the object:
+    std::shared_ptr<T> out;
+    const Status s = create(out);
+
+    // Add to the cache, and wake up anybody waiting for it:
+    std::lock_guard<std::mutex> lock(gLoginMutex);
+    gUsersLoading.erase(username);
+    gUserLoaded.notify_all();
+    ABC_CHECK(s);
+
+    auto &session = sessionFor(store);
+    if (!(session.*member))
+        session.*member = out;
+    result = session.*member;
+    return Status();
+}
+
+/**
+ * Retrieves a wallet from the cache, loading it if necessary.
+ * If another thread is already loading the wallet, this waits for it.
+ */
+static Status
+walletLoad(std::shared_ptr<Wallet> &result,
+           const std::shared_ptr<Account> &account, const std::string &id)
+{
+    // Try to return the wallet from the cache:
+    {
+        std::unique_lock<std::mutex> lock(gLoginMutex);
+        while (gWalletsLoading.count(id))
+            gWalletLoaded.wait(lock);
+
+        auto &wallets = sessionFor(account->login.shared_from_this()).wallets;
+        auto i = wallets.find(id);
+        if (i != wallets.end())
+        {
+            result = i->second;
+            return Status();
+        }
+        gWalletsLoading.insert(id);
+    }
+
+    // Load the wallet:
+    std::shared_ptr<Wallet> out;
+    const auto s = Wallet::create(out, *account, id);
+
+    // Add to the cache, and wake up anybody waiting for it:
+    std::lock_guard<std::mutex> lock(gLoginMutex);
+    gWalletsLoading.erase(id);
+    gWalletLoaded.notify_all();
+    ABC_CHECK(s);
+    sessionFor(account->login.shared_from_this()).wallets[id] = out;
+
+    result = std::move(out);
+    return Status();
 }
 
 void
 cacheLogout()
 {
     std::lock_guard<std::mutex> lock(gLoginMutex);
-    cacheClear();
+    gSessionIndex.clear();
+    gSessions.clear();
 }
 
-Status
-cacheLoginStore(std::shared_ptr<LoginStore> &result, const char *szUserName)
+void
+cacheLimitsSet(size_t sessions, std::chrono::seconds idle)
 {
     std::lock_guard<std::mutex> lock(gLoginMutex);
+    gSessionLimit = sessions ? sessions : 1;
+    gSessionIdle = idle;
+    sessionPrune();
+}
 
-    // Clear the cache if the username has changed:
-    if (szUserName && gLoginStoreCache)
-    {
-        std::string fixed;
-        ABC_CHECK(LoginStore::fixUsername(fixed, szUserName));
-        if (gLoginStoreCache->username() != fixed)
-            cacheClear();
-    }
+void
+cachePrune(std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(gLoginMutex);
+    sessionPrune(nullptr, now);
+}
 
-    // Load the new store, if necessary:
-    if (!gLoginStoreCache)
+LoginCacheStats
+cacheStats()
+{
+    std::lock_guard<std::mutex> lock(gLoginMutex);
+    auto out = gStats;
+    out.sessions = gSessions.size();
+    return out;
+}
+
+Status
+cacheLoginStore(std::shared_ptr<LoginStore> &result, const char *szUserName)
+{
+    std::string fixed;
     {
+        std::unique_lock<std::mutex> lock(gLoginMutex);
+        sessionPrune();
+
+        // Without a username, use whoever was around last:
         if (!szUserName)
-            return ABC_ERROR(ABC_CC_NULLPtr, "No user name");
-        ABC_CHECK(LoginStore::create(gLoginStoreCache, szUserName));
+        {
+            if (gSessions.empty())
+                return ABC_ERROR(ABC_CC_NULLPtr, "No user name");
+
+            gSessions.front().lastUsed = std::chrono::steady_clock::now();
+            result = gSessions.front().store;
+            ++gStats.hits;
+            return Status();
+        }
+
+        ABC_CHECK(LoginStore::fixUsername(fixed, szUserName));
+        while (gUsersLoading.count(fixed))
+            gUserLoaded.wait(lock);
+
+        auto i = gSessionIndex.find(fixed);
+        if (gSessionIndex.end() != i)
+        {
+            result = sessionFor(i->second->store).store;
+            ++gStats.hits;
+            return Status();
+        }
+        gUsersLoading.insert(fixed);
     }
 
-    result = gLoginStoreCache;
+    // Load the new store, which involves a scrypt:
+    std::shared_ptr<LoginStore> store;
+    const Status s = LoginStore::create(store, szUserName);
+
+    std::lock_guard<std::mutex> lock(gLoginMutex);
+    gUsersLoading.erase(fixed);
+    gUserLoaded.notify_all();
+    ABC_CHECK(s);
+
+    auto &session = sessionFor(store);
+    result = session.store;
+    ++gStats.misses;
+    sessionPrune(&session);
+
     return Status();
 }
 
@@ -85,14 +345,11 @@ cacheLoginNew(std::shared_ptr<Login> &result,
     ABC_CHECK(cacheLoginStore(store, szUserName));
 
     // Log the user in, if necessary:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    if (!gLoginCache)
+    return sessionLoad(result, store, &Session::login,
+                       [&](std::shared_ptr<Login> &out)
     {
-        ABC_CHECK(Login::createNew(gLoginCache, *store, szPassword));
-    }
-
-    result = gLoginCache;
-    return Status();
+        return Login::createNew(out, *store, szPassword);
+    });
 }
 
 Status
@@ -104,14 +361,11 @@ cacheLoginPassword(std::shared_ptr<Login> &result,
     ABC_CHECK(cacheLoginStore(store, szUserName));
 
     // Log the user in, if necessary:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    if (!gLoginCache)
+    return sessionLoad(result, store, &Session::login,
+                       [&](std::shared_ptr<Login> &out)
     {
-        ABC_CHECK(loginPassword(gLoginCache, *store, password, authError));
-    }
-
-    result = gLoginCache;
-    return Status();
+        return loginPassword(out, *store, password, authError);
+    });
 }
 
 Status
@@ -123,15 +377,11 @@ cacheLoginRecovery(std::shared_ptr<Login> &result,
     ABC_CHECK(cacheLoginStore(store, szUserName));
 
     // Log the user in, if necessary:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    if (!gLoginCache)
+    return sessionLoad(result, store, &Session::login,
+                       [&](std::shared_ptr<Login> &out)
     {
-        ABC_CHECK(loginRecovery(gLoginCache, *store, recoveryAnswers,
-                                authError));
-    }
-
-    result = gLoginCache;
-    return Status();
+        return loginRecovery(out, *store, recoveryAnswers, authError);
+    });
 }
 
 Status
@@ -144,15 +394,12 @@ cacheLoginRecovery2(std::shared_ptr<Login> &result,
     ABC_CHECK(cacheLoginStore(store, szUserName));
 
     // Log the user in, if necessary:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    if (!gLoginCache)
+    return sessionLoad(result, store, &Session::login,
+                       [&](std::shared_ptr<Login> &out)
     {
-        ABC_CHECK(loginRecovery2(gLoginCache, *store, recovery2Key, answers,
-                                 authError));
-    }
-
-    result = gLoginCache;
-    return Status();
+        return loginRecovery2(out, *store, recovery2Key, answers,
+                              authError);
+    });
 }
 
 Status
@@ -164,14 +411,11 @@ cacheLoginPin(std::shared_ptr<Login> &result,
     ABC_CHECK(cacheLoginStore(store, szUserName));
 
     // Log the user in, if necessary:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    if (!gLoginCache)
+    return sessionLoad(result, store, &Session::login,
+                       [&](std::shared_ptr<Login> &out)
     {
-        ABC_CHECK(loginPin(gLoginCache, *store, pin, authError));
-    }
-
-    result = gLoginCache;
-    return Status();
+        return loginPin(out, *store, pin, authError);
+    });
 }
 
 Status
@@ -182,14 +426,11 @@ cacheLoginKey(std::shared_ptr<Login> &result,
     ABC_CHECK(cacheLoginStore(store, szUserName));
 
     // Log the user in, if necessary:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    if (!gLoginCache)
+    return sessionLoad(result, store, &Session::login,
+                       [&](std::shared_ptr<Login> &out)
     {
-        ABC_CHECK(Login::createOffline(gLoginCache, *store, key));
-    }
-
-    result = gLoginCache;
-    return Status();
+        return Login::createOffline(out, *store, key);
+    });
 }
 
 Status
@@ -198,12 +439,15 @@ cacheLogin(std::shared_ptr<Login> &result, const char *szUserName)
     std::shared_ptr<LoginStore> store;
     ABC_CHECK(cacheLoginStore(store, szUserName));
 
-    // Verify that the user is logged in:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    if (!gLoginCache)
+    // Verify that the user is logged in, once any login in progress is done:
+    std::unique_lock<std::mutex> lock(gLoginMutex);
+    while (gUsersLoading.count(store->username()))
+        gUserLoaded.wait(lock);
+    auto &session = sessionFor(store);
+    if (!session.login)
         return ABC_ERROR(ABC_CC_AccountDoesNotExist, "Not logged in");
 
-    result = gLoginCache;
+    result = session.login;
     return Status();
 }
 
@@ -214,12 +458,12 @@ cacheAccount(std::shared_ptr<Account> &result, const char *szUserName)
     ABC_CHECK(cacheLogin(login, szUserName));
 
     // Create the object, if necessary:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    if (!gAccountCache)
-        ABC_CHECK(Account::create(gAccountCache, *login));
-
-    result = gAccountCache;
-    return Status();
+    return sessionLoad(result, login->store.shared_from_this(),
+                       &Session::account,
+                       [&](std::shared_ptr<Account> &out)
+    {
+        return Account::create(out, *login);
+    });
 }
 
 Status
@@ -235,7 +479,7 @@ cacheWalletNew(std::shared_ptr<Wallet> &result, const char *szUserName,
 
     // Add to the cache:
     std::lock_guard<std::mutex> lock(gLoginMutex);
-    gWalletCache[out->id()] = out;
+    sessionFor(account->login.shared_from_this()).wallets[out->id()] = out;
 
     result = std::move(out);
     return Status();
@@ -245,33 +489,91 @@ Status
 cacheWallet(std::shared_ptr<Wallet> &result, const char *szUserName,
             const char *szUUID)
 {
+    // Without a username, the wallet id tells us whose wallet this is:
+    if (!szUserName && szUUID)
+    {
+        std::lock_guard<std::mutex> lock(gLoginMutex);
+        for (auto &session: gSessions)
+        {
+            auto i = session.wallets.find(szUUID);
+            if (i != session.wallets.end())
+            {
+                result = sessionFor(session.store).wallets[szUUID];
+                ++gStats.hits;
+                return Status();
+            }
+        }
+    }
+
     std::shared_ptr<Account> account;
     ABC_CHECK(cacheAccount(account, szUserName));
 
     if (!szUUID)
         return ABC_ERROR(ABC_CC_NULLPtr, "No wallet id");
-    std::string id = szUUID;
 
-    // Try to return the wallet from the cache:
+    return walletLoad(result, account, szUUID);
+}
+
+Status
+cacheWalletsLoad(const char *szUserName)
+{
+    std::shared_ptr<Account> account;
+    ABC_CHECK(cacheAccount(account, szUserName));
+
+    const auto list = account->wallets.list();
+    const std::vector<std::string> ids(list.begin(), list.end());
+    parallelFor(ids.size(), [&account, &ids](size_t i)
     {
-        std::lock_guard<std::mutex> lock(gLoginMutex);
-        auto i = gWalletCache.find(id);
-        if (i != gWalletCache.end())
+        std::shared_ptr<Wallet> wallet;
+        walletLoad(wallet, account, ids[i]).log();
+    });
+
+    return Status();
+}
+
+Status
+cacheSyncAll(const char *szUserName, bool &dirty)
+{
+    std::shared_ptr<Account> account;
+    ABC_CHECK(cacheAccount(account, szUserName));
+    ABC_CHECK(cacheWalletsLoad(szUserName));
+
+    std::vector<SyncTask> tasks;
+    SyncTask accountTask;
+    accountTask.name = "account";
+    accountTask.sync = [account](bool &dirty, SyncStats &stats)
+    {
+        return account->sync(dirty, &stats);
+    };
+    tasks.push_back(accountTask);
+
+    for (const auto &id: account->wallets.list())
+    {
+        std::shared_ptr<Wallet> wallet;
+        if (!walletLoad(wallet, account, id).log())
+            continue;
+
+        bool archived = false;
+        account->wallets.archived(archived, id).log();
+        if (archived && wallet->cache.addressCheckDoneGet())
+            continue;
+
+        SyncTask task;
+        task.name = "wallet " + id;
+        task.sync = [wallet](bool &dirty, SyncStats &stats)
         {
-            result = i->second;
-            return Status();
-        }
+            return wallet->sync(dirty, &stats);
+        };
+        tasks.push_back(task);
     }
 
-    // Load the wallet:
-    std::shared_ptr<Wallet> out;
-    ABC_CHECK(Wallet::create(out, *account, id));
+    syncAll(tasks);
 
-    // Add to the cache:
-    std::lock_guard<std::mutex> lock(gLoginMutex);
-    gWalletCache[id] = out;
-
-    result = std::move(out);
+    dirty = false;
+    for (const auto &task: tasks)
+        dirty = dirty || task.dirty;
+    for (const auto &task: tasks)
+        ABC_CHECK(task.status);
     return Status();
 }
 
@@ -287,11 +589,12 @@ cacheWalletRemove(const char *szUserName, const char *szUUID)
 
     // remove the wallet from the cache:
     std::lock_guard<std::mutex> lock(gLoginMutex);
-    auto i = gWalletCache.find(id);
-    if (i != gWalletCache.end())
+    auto &wallets = sessionFor(account->login.shared_from_this()).wallets;
+    auto i = wallets.find(id);
+    if (i != wallets.end())
     {
         ABC_CHECK(account->wallets.remove(id));
-        gWalletCache.erase(i);
+        wallets.erase(i);
     }
     return Status();
 }
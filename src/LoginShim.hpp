@@ -17,6 +17,7 @@
 
 #include "../abcd/util/Data.hpp"
 #include "../abcd/util/Status.hpp"
+#include <chrono>
 #include <memory>
 
 namespace abcd {
@@ -27,15 +28,54 @@ class LoginStore;
 class Wallet;
 struct AuthError;
 
+/**
+ * Counters for the login cache.
+ */
+struct LoginCacheStats
+{
+    /** Users currently held in the cache. */
+    size_t sessions = 0;
+    /** Lookups that found their user already loaded. */
+    size_t hits = 0;
+    /** Lookups that had to load their user from disk. */
+    size_t misses = 0;
+    /** Users dropped for being idle or for not fitting. */
+    size_t evictions = 0;
+};
+
 /**
  * Clears all cached login objects.
  */
 void
 cacheLogout();
 
+/**
+ * Sets how many users can stay logged in at once.
+ * Once the cache is full, the least-recently used user gets logged out.
+ * @param idle log out users that go unused for this long,
+ * or never if this is zero.
+ */
+void
+cacheLimitsSet(size_t sessions, std::chrono::seconds idle);
+
+/**
+ * Logs out users that have gone unused for too long,
+ * as judged at the given time.
+ * Lookups already do this, so this is mostly useful for testing.
+ */
+void
+cachePrune(std::chrono::steady_clock::time_point now=
+               std::chrono::steady_clock::now());
+
+/**
+ * Reads the cache counters.
+ */
+LoginCacheStats
+cacheStats();
+
 /**
  * Loads the store for the given user into the cache.
- * If the username is null, the function returns whatever is cached.
+ * If the username is null, the function returns the most recent user.
  */
 Status
 cacheLoginStore(std::shared_ptr<LoginStore> &result, const char *szUserName);
@@ -88,13 +128,13 @@ cacheLoginKey(std::shared_ptr<Login> &result,
               const char *szUserName, DataSlice key);
 
 /**
- * Retrieves the cached login, assuming the username still matches.
+ * Retrieves the cached login for the user.
  */
 Status
 cacheLogin(std::shared_ptr<Login> &result, const char *szUserName);
 
 /**
- * Retrieves the cached account, assuming the username still matches.
+ * Retrieves the cached account for the user.
  */
 Status
 cacheAccount(std::shared_ptr<Account> &result, const char *szUserName);
@@ -107,13 +147,31 @@ cacheWalletNew(std::shared_ptr<Wallet> &result, const char *szUserName,
                const std::string &name, int currency);
 
 /**
- * Retrieves a wallet for the currently logged-in user.
+ * Retrieves a wallet for the given user.
+ * If the username is null, whichever user has the wallet loaded is used.
  * Verifies that the passed-in wallet id is not a null pointer.
  */
 Status
 cacheWallet(std::shared_ptr<Wallet> &result, const char *szUserName,
             const char *szUUID);
 
+/**
+ * Loads every wallet in the account into the cache, several at a time.
+ * Each wallet is available to other threads as soon as it finishes.
+ */
+Status
+cacheWalletsLoad(const char *szUserName);
+
+/**
+ * Syncs the account and all of its wallets, several repos at a time.
+ * Wallets that are not in the cache yet get loaded first.
+ * Archived wallets that have finished their address check are skipped,
+ * the same as in `ABC_DataSyncWallet`.
+ * @param dirty set to true if any repo changed.
+ */
+Status
+cacheSyncAll(const char *szUserName, bool &dirty);
+
 /**
  * Removes a wallet from file and cache.
  */
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/cache/AddressCache.hpp"
+#include "../abcd/bitcoin/cache/BlockCache.hpp"
+#include "../abcd/bitcoin/cache/CacheFile.hpp"
+#include "../abcd/bitcoin/cache/TxCache.hpp"
+#include "../minilibs/catch/catch.hpp"
+
+TEST_CASE("Address cache completion", "[bitcoin][database]")
+{
+    abcd::BlockCache blockCache("");
+    abcd::TxCache txCache(blockCache);
+    abcd::AddressCache addressCache(txCache);
+
+    std::vector<std::string> txs, completes;
+    addressCache.onTxSet([&txs](const abcd::TxidSet &txids)
+    {
+        txs.insert(txs.end(), txids.begin(), txids.end());
+    });
+    addressCache.onCompleteSet([&completes](const std::string &address)
+    {
+        completes.push_back(address);
+    });
+
+    // A child transaction and the parent it spends from:
+    bc::transaction_type parent{1, 0, {}, {{1000, bc::script_type()}}};
+    const auto parentId = bc::hash_transaction(parent);
+    bc::transaction_type child
+    {
+        1, 0,
+        {
+            {{parentId, 0}, {}, 0xffffffff}
+        },
+        {
+            {900, bc::script_type()}
+        }
+    };
+    const auto childId = bc::encode_hash(bc::hash_transaction(child));
+
+    // Both addresses list the child, which we don't have yet:
+    addressCache.insert("a");
+    addressCache.insert("b");
+    addressCache.update("a", abcd::TxidSet{childId});
+    addressCache.update("b", abcd::TxidSet{childId});
+    REQUIRE(txs.empty());
+    REQUIRE(completes.empty());
+    REQUIRE(2 == addressCache.txidAddresses(abcd::TxidSet{childId}).size());
+    time_t sleep;
+    auto statuses = addressCache.statuses(sleep);
+    REQUIRE(2 == statuses.size());
+    REQUIRE(abcd::TxidSet{childId} == statuses.front().missingTxids);
+
+    // The child arrives, but it still needs its parent:
+    txCache.insert(child);
+    addressCache.updateTx(abcd::TxidSet{childId});
+    REQUIRE(txs.empty());
+    REQUIRE(0 == addressCache.progress().first);
+    statuses = addressCache.statuses(sleep);
+    REQUIRE(abcd::TxidSet{bc::encode_hash(parentId)} ==
+            statuses.front().missingTxids);
+
+    // Once the parent arrives, both addresses complete:
+    txCache.insert(parent);
+    addressCache.updateTx(abcd::TxidSet{bc::encode_hash(parentId)});
+    REQUIRE(1 == txs.size());
+    REQUIRE(childId == txs.front());
+    REQUIRE(2 == completes.size());
+    REQUIRE(2 == addressCache.progress().first);
+
+    // Nothing fires twice:
+    addressCache.updateTx(abcd::TxidSet{childId});
+    addressCache.update();
+    REQUIRE(1 == txs.size());
+    REQUIRE(2 == completes.size());
+
+    // Once the server forgets the child, it leaves every address:
+    addressCache.update("a", abcd::TxidSet{});
+    REQUIRE(addressCache.txids().empty());
+    REQUIRE(txCache.missing(childId));
+
+    // A fresh copy has nothing left to wait for:
+    abcd::CacheWriter writer;
+    addressCache.save(writer);
+    abcd::AddressCache loaded(txCache);
+    abcd::CacheReader reader(writer.data());
+    REQUIRE(loaded.load(reader));
+    REQUIRE(2 == loaded.progress().first);
+}
+
+TEST_CASE("Address cache scheduling", "[bitcoin][database]")
+{
+    abcd::BlockCache blockCache("");
+    abcd::TxCache txCache(blockCache);
+    abcd::AddressCache addressCache(txCache);
+    time_t sleep;
+
+    // New addresses are dirty:
+    addressCache.insert("a");
+    addressCache.insert("b");
+    REQUIRE(2 == addressCache.statuses(sleep).size());
+
+    // Checked addresses drop out until their next deadline:
+    addressCache.update("a", abcd::TxidSet{});
+    auto statuses = addressCache.statuses(sleep);
+    REQUIRE(1 == statuses.size());
+    REQUIRE("b" == statuses.front().address);
+    REQUIRE(19 <= sleep);
+    REQUIRE(sleep <= 20);
+
+    // Priority addresses come due sooner:
+    addressCache.update("b", abcd::TxidSet{});
+    addressCache.prioritize("a");
+    REQUIRE(addressCache.statuses(sleep).empty());
+    REQUIRE(3 <= sleep);
+    REQUIRE(sleep <= 4);
+
+    // Dropping the priority puts the old deadline back:
+    addressCache.prioritize("");
+    REQUIRE(addressCache.statuses(sleep).empty());
+    REQUIRE(19 <= sleep);
+
+    // Clearing the cache makes everything dirty again:
+    addressCache.clear();
+    REQUIRE(2 == addressCache.statuses(sleep).size());
+}
+
+TEST_CASE("Address cache batching", "[bitcoin][database]")
+{
+    abcd::BlockCache blockCache("");
+    abcd::TxCache txCache(blockCache);
+    abcd::AddressCache addressCache(txCache);
+
+    std::vector<abcd::TxidSet> batches;
+    addressCache.onTxSet([&batches](const abcd::TxidSet &txids)
+    {
+        batches.push_back(txids);
+    });
+
+    // Several unrelated transactions for one address:
+    std::vector<bc::transaction_type> txs;
+    abcd::TxidSet txids;
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        bc::transaction_type tx{1, i, {}, {{1000, bc::script_type()}}};
+        txs.push_back(tx);
+        txids.insert(bc::encode_hash(bc::hash_transaction(tx)));
+    }
+    addressCache.insert("a");
+    addressCache.update("a", txids);
+    REQUIRE(batches.empty());
+
+    // They arrive together, so the callback fires once:
+    REQUIRE(3 == txCache.insert(txs));
+    addressCache.updateTx(txids);
+    REQUIRE(1 == batches.size());
+    REQUIRE(txids == batches.front());
+
+    // Repeats are ignored:
+    REQUIRE(0 == txCache.insert(txs));
+    addressCache.updateTx(txids);
+    REQUIRE(1 == batches.size());
+}
+
+TEST_CASE("Address cache stratum hashes", "[bitcoin][database]")
+{
+    abcd::BlockCache blockCache("");
+    abcd::TxCache txCache(blockCache);
+    abcd::AddressCache addressCache(txCache);
+
+    bc::transaction_type tx{1, 0, {}, {{1000, bc::script_type()}}};
+    const auto txid = bc::encode_hash(bc::hash_transaction(tx));
+    txCache.insert(tx);
+    txCache.confirmed(txid, 100);
+
+    addressCache.insert("a");
+    addressCache.insert("b");
+    addressCache.update("a", abcd::TxidSet{txid});
+
+    // A server agreeing with our history needs no fetch:
+    std::string hash;
+    REQUIRE(txCache.stratumHash(hash, abcd::TxidSet{txid}));
+    REQUIRE(!addressCache.updateStratumHash("a", hash));
+
+    // Neither does an empty address the server knows nothing about:
+    time_t sleep;
+    REQUIRE(!addressCache.updateStratumHash("b", ""));
+    for (const auto &status: addressCache.statuses(sleep))
+        REQUIRE(!status.dirty);
+    REQUIRE(2 == addressCache.progress().first);
+
+    // A different hash means the history has changed:
+    REQUIRE(addressCache.updateStratumHash("a", "changed"));
+
+    // Asking for a re-check of an address with history still forces a fetch:
+    REQUIRE(!addressCache.updateStratumHash("a", hash));
+    REQUIRE(addressCache.updateStratumHash("a"));
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/Derive.hpp"
+#include "../abcd/util/Parallel.hpp"
+#include "../minilibs/catch/catch.hpp"
+
+TEST_CASE("Batched address derivation", "[bitcoin][derive]")
+{
+    const bc::data_chunk seed(32, 0x42);
+    const bc::hd_private_key parent(seed);
+    abcd::parallelLimitSet(4);
+
+    SECTION("ranges match one-at-a-time derivation")
+    {
+        const auto addresses = abcd::deriveAddresses(parent, 10, 1000);
+        REQUIRE(1000 == addresses.size());
+        for (uint32_t i = 0; i < addresses.size(); ++i)
+            REQUIRE(parent.generate_private_key(10 + i).address().encoded() ==
+                    addresses[i]);
+    }
+
+    SECTION("scattered indices keep their order")
+    {
+        const std::vector<uint32_t> indices{7, 3, 900, 0};
+        const auto addresses = abcd::deriveAddresses(parent, indices);
+        REQUIRE(indices.size() == addresses.size());
+        for (size_t i = 0; i < indices.size(); ++i)
+            REQUIRE(parent.generate_private_key(indices[i]).address().encoded() ==
+                    addresses[i]);
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/http/Http.hpp"
+#include "../minilibs/catch/catch.hpp"
+
+TEST_CASE("HTTP handle pool", "[http]")
+{
+    REQUIRE(abcd::httpInit());
+
+    CURL *first = nullptr;
+    REQUIRE(abcd::httpHandleAcquire(first, abcd::HttpPool::general));
+    REQUIRE(first);
+
+    SECTION("released handles come back")
+    {
+        abcd::httpHandleRelease(first, abcd::HttpPool::general);
+        CURL *second = nullptr;
+        REQUIRE(abcd::httpHandleAcquire(second, abcd::HttpPool::general));
+        REQUIRE(first == second);
+        abcd::httpHandleRelease(second, abcd::HttpPool::general);
+    }
+
+    SECTION("pools don't mix")
+    {
+        abcd::httpHandleRelease(first, abcd::HttpPool::general);
+        CURL *pinned = nullptr;
+        REQUIRE(abcd::httpHandleAcquire(pinned, abcd::HttpPool::pinned));
+        REQUIRE(first != pinned);
+        abcd::httpHandleRelease(pinned, abcd::HttpPool::pinned);
+    }
+
+    SECTION("busy handles are not shared")
+    {
+        CURL *second = nullptr;
+        REQUIRE(abcd::httpHandleAcquire(second, abcd::HttpPool::general));
+        REQUIRE(first != second);
+        abcd::httpHandleRelease(second, abcd::HttpPool::general);
+        abcd::httpHandleRelease(first, abcd::HttpPool::general);
+    }
+}
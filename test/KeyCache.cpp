@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/KeyCache.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <string>
+
+TEST_CASE("Key cache", "[bitcoin][keys]")
+{
+    abcd::KeyCache cache;
+    bc::ec_secret secret;
+
+    SECTION("missing keys")
+    {
+        REQUIRE(!cache.find(secret, "1a"));
+    }
+
+    SECTION("many keys")
+    {
+        // Enough keys to spill onto a second page:
+        const unsigned count = 1000;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            secret.fill(i & 0xff);
+            secret[0] = i >> 8;
+            cache.insert(std::to_string(i), secret);
+        }
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            REQUIRE(cache.find(secret, std::to_string(i)));
+            REQUIRE((i >> 8) == secret[0]);
+            REQUIRE((i & 0xff) == secret[31]);
+        }
+
+        cache.clear();
+        REQUIRE(!cache.find(secret, "0"));
+    }
+}
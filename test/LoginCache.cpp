@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../src/LoginShim.hpp"
+#include "../abcd/Context.hpp"
+#include "../abcd/login/LoginStore.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <stdlib.h>
+#include <unistd.h>
+
+TEST_CASE("Login cache eviction", "[login][cache]")
+{
+    // The users don't need accounts on disk, just a place to look:
+    char dir[] = "/tmp/abc-test-XXXXXX";
+    REQUIRE(mkdtemp(dir));
+    abcd::gContext.reset(new abcd::Context(dir, "", "", "", ""));
+    abcd::cacheLogout();
+
+    const auto start = abcd::cacheStats();
+    std::shared_ptr<abcd::LoginStore> store;
+
+    SECTION("least-recently used")
+    {
+        abcd::cacheLimitsSet(2, std::chrono::seconds(0));
+        REQUIRE(abcd::cacheLoginStore(store, "alice"));
+        REQUIRE(abcd::cacheLoginStore(store, "bob"));
+        REQUIRE(abcd::cacheLoginStore(store, "alice"));
+        REQUIRE(abcd::cacheLoginStore(store, "carol"));
+
+        auto stats = abcd::cacheStats();
+        REQUIRE(2 == stats.sessions);
+        REQUIRE(stats.hits == start.hits + 1);
+        REQUIRE(stats.misses == start.misses + 3);
+        REQUIRE(stats.evictions == start.evictions + 1);
+
+        // Bob was the one to go:
+        REQUIRE(abcd::cacheLoginStore(store, "alice"));
+        REQUIRE(abcd::cacheLoginStore(store, "bob"));
+        stats = abcd::cacheStats();
+        REQUIRE(2 == stats.sessions);
+        REQUIRE(stats.hits == start.hits + 2);
+        REQUIRE(stats.misses == start.misses + 4);
+        REQUIRE(stats.evictions == start.evictions + 2);
+    }
+
+    SECTION("busy users")
+    {
+        // Neither the user in use nor the one being returned can go:
+        abcd::cacheLimitsSet(1, std::chrono::seconds(0));
+        REQUIRE(abcd::cacheLoginStore(store, "alice"));
+        auto alice = store;
+        REQUIRE(abcd::cacheLoginStore(store, "bob"));
+        REQUIRE(2 == abcd::cacheStats().sessions);
+        REQUIRE(store->username() == "bob");
+
+        // Once the first user is free, the next lookup lets it go:
+        alice.reset();
+        REQUIRE(abcd::cacheLoginStore(store, "bob"));
+        const auto stats = abcd::cacheStats();
+        REQUIRE(1 == stats.sessions);
+        REQUIRE(stats.evictions == start.evictions + 1);
+    }
+
+    SECTION("idle")
+    {
+        abcd::cacheLimitsSet(8, std::chrono::seconds(60));
+        REQUIRE(abcd::cacheLoginStore(store, "alice"));
+        REQUIRE(abcd::cacheLoginStore(store, "bob"));
+        REQUIRE(2 == abcd::cacheStats().sessions);
+
+        // Users still in use stay put:
+        const auto later = std::chrono::steady_clock::now() +
+                           std::chrono::seconds(61);
+        abcd::cachePrune(later);
+        REQUIRE(1 == abcd::cacheStats().sessions);
+
+        store.reset();
+        abcd::cachePrune(later);
+        REQUIRE(0 == abcd::cacheStats().sessions);
+        REQUIRE(abcd::cacheLoginStore(store, "bob"));
+
+        const auto stats = abcd::cacheStats();
+        REQUIRE(1 == stats.sessions);
+        REQUIRE(start.hits == stats.hits);
+        REQUIRE(stats.misses == start.misses + 3);
+        REQUIRE(stats.evictions == start.evictions + 2);
+    }
+
+    abcd::cacheLimitsSet(8, std::chrono::seconds(0));
+    abcd::cacheLogout();
+    abcd::gContext.reset();
+    rmdir(dir);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/util/Parallel.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+TEST_CASE("Parallel for loop", "[util][parallel]")
+{
+    abcd::parallelLimitSet(4);
+
+    SECTION("every item runs once")
+    {
+        std::vector<int> hits(1000);
+        abcd::parallelFor(hits.size(), [&hits](size_t i)
+        {
+            ++hits[i];
+        });
+        for (auto hit: hits)
+            REQUIRE(1 == hit);
+    }
+
+    SECTION("nested loops finish")
+    {
+        std::atomic<size_t> total(0);
+        abcd::parallelFor(20, [&total](size_t i)
+        {
+            abcd::parallelFor(20, [&total](size_t j)
+            {
+                ++total;
+            });
+        });
+        REQUIRE(400 == total);
+    }
+
+    SECTION("exceptions stay inside")
+    {
+        std::atomic<size_t> total(0);
+        abcd::parallelFor(10, [&total](size_t i)
+        {
+            ++total;
+            if (i % 2)
+                throw std::runtime_error("oops");
+        });
+        REQUIRE(10 == total);
+    }
+
+    abcd::parallelLimitSet(0);
+}
@@ -7,7 +7,9 @@
 
 #include "../abcd/crypto/Scrypt.hpp"
 #include "../abcd/crypto/Encoding.hpp"
+#include "../abcd/util/Parallel.hpp"
 #include "../minilibs/catch/catch.hpp"
+#include "../minilibs/scrypt/crypto_scrypt.h"
 
 TEST_CASE("Scrypt RFC test vectors", "[crypto][scrypt]")
 {
@@ -63,15 +65,71 @@ TEST_CASE("Scrypt RFC test vectors", "[crypto][scrypt]")
 #endif
     };
 
-    for (auto &test: cases)
+    const crypto_scrypt_backend backends[] =
     {
-        abcd::ScryptSnrp snrp =
+        CRYPTO_SCRYPT_PORTABLE, CRYPTO_SCRYPT_SSE2, CRYPTO_SCRYPT_AVX2
+    };
+    for (auto backend: backends)
+    {
+        if (!crypto_scrypt_backend_supported(backend))
+            continue;
+        INFO(crypto_scrypt_backend_name(backend));
+        REQUIRE(0 == crypto_scrypt_backend_set(backend));
+
+        for (auto &test: cases)
         {
-            abcd::DataChunk(test.salt.begin(), test.salt.end()),
-            test.N, test.r, test.p
-        };
-        abcd::DataChunk out;
-        CHECK(snrp.hash(out, test.password, test.dklen));
-        CHECK(abcd::base16Encode(out) == test.result);
+            abcd::ScryptSnrp snrp =
+            {
+                abcd::DataChunk(test.salt.begin(), test.salt.end()),
+                test.N, test.r, test.p
+            };
+            abcd::DataChunk out;
+            CHECK(snrp.hash(out, test.password, test.dklen));
+            CHECK(abcd::base16Encode(out) == test.result);
+        }
     }
+    crypto_scrypt_backend_set(CRYPTO_SCRYPT_AUTO);
+}
+
+TEST_CASE("Scrypt parallel lanes", "[crypto][scrypt]")
+{
+    const abcd::ScryptSnrp snrp =
+    {
+        abcd::DataChunk(32, 0x55), 1024, 2, 4
+    };
+
+    abcd::parallelLimitSet(1);
+    abcd::DataChunk sequential;
+    REQUIRE(snrp.hash(sequential, std::string("password")));
+
+    abcd::parallelLimitSet(4);
+    abcd::DataChunk parallel;
+    REQUIRE(snrp.hash(parallel, std::string("password")));
+
+    CHECK(sequential == parallel);
+}
+
+TEST_CASE("Scrypt result cache", "[crypto][scrypt]")
+{
+    abcd::ScryptSnrp snrp =
+    {
+        abcd::DataChunk(32, 0x11), 1024, 1, 1
+    };
+    abcd::DataChunk uncached;
+    REQUIRE(snrp.hash(uncached, std::string("password")));
+
+    REQUIRE(abcd::scryptCacheSet(std::chrono::seconds(60)));
+    abcd::DataChunk first, second, other;
+    REQUIRE(snrp.hash(first, std::string("password")));
+    REQUIRE(snrp.hash(second, std::string("password")));
+    CHECK(uncached == first);
+    CHECK(uncached == second);
+
+    // Different parameters must not collide:
+    snrp.n = 2048;
+    REQUIRE(snrp.hash(other, std::string("password")));
+    CHECK(uncached != other);
+
+    abcd::scryptCacheClear();
+    REQUIRE(abcd::scryptCacheSet(std::chrono::seconds(0)));
 }
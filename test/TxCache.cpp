@@ -6,8 +6,10 @@
  */
 
 #include "../abcd/bitcoin/cache/BlockCache.hpp"
+#include "../abcd/bitcoin/cache/CacheFile.hpp"
 #include "../abcd/bitcoin/cache/TxCache.hpp"
 #include "../abcd/bitcoin/Utility.hpp"
+#include "../abcd/crypto/Encoding.hpp"
 #include "../abcd/spend/Outputs.hpp"
 #include "../minilibs/catch/catch.hpp"
 
@@ -209,3 +211,193 @@ TEST_CASE("Transaction database", "[bitcoin][database]")
         REQUIRE(!hasTxid(utxos, test.badSpendId, 0));
     }
 }
+
+TEST_CASE("Transaction database lookups", "[bitcoin][database]")
+{
+    abcd::BlockCache blockCache("");
+    abcd::TxCache txCache(blockCache);
+    abcd::TxCacheTest test(txCache);
+
+    SECTION("missing")
+    {
+        REQUIRE(!txCache.missing(bc::encode_hash(test.confirmedId)));
+        REQUIRE(txCache.missing(bc::encode_hash(test.incomingId)));
+        REQUIRE(txCache.missing(bc::encode_hash(bc::null_hash)));
+        REQUIRE(txCache.missing("not a txid"));
+
+        const auto missing = txCache.missingTxids(abcd::TxidSet
+        {
+            bc::encode_hash(test.confirmedId),
+            bc::encode_hash(test.incomingId),
+            "not a txid"
+        });
+        REQUIRE(2 == missing.size());
+        REQUIRE(missing.count(bc::encode_hash(bc::null_hash)));
+        REQUIRE(missing.count("not a txid"));
+    }
+
+    SECTION("status")
+    {
+        abcd::TxStatus status;
+        REQUIRE(txCache.status(status, bc::encode_hash(test.confirmedId)));
+        REQUIRE(100 == status.height);
+        REQUIRE(!status.isDoubleSpent);
+
+        REQUIRE(txCache.status(status, bc::encode_hash(test.badSpendId)));
+        REQUIRE(0 == status.height);
+        REQUIRE(status.isDoubleSpent);
+        REQUIRE(!status.isReplaceByFee);
+
+        REQUIRE(txCache.status(status, bc::encode_hash(test.irrelevantId)));
+        REQUIRE(status.isReplaceByFee);
+    }
+
+    SECTION("incremental updates")
+    {
+        abcd::TxStatus status;
+        const auto badSpend = bc::encode_hash(test.badSpendId);
+
+        // Confirming a transaction makes its children safe:
+        txCache.confirmed(bc::encode_hash(test.doubleSpendId), 101);
+        REQUIRE(txCache.status(status, badSpend));
+        REQUIRE(!status.isDoubleSpent);
+
+        // Un-confirming it brings the problem back:
+        txCache.confirmed(bc::encode_hash(test.doubleSpendId), 0, 0);
+        REQUIRE(txCache.status(status, badSpend));
+        REQUIRE(status.isDoubleSpent);
+
+        // Dropping the double-spend clears the problem too:
+        const auto later = time(nullptr) + 2 * 60 * 60;
+        REQUIRE(txCache.drop(bc::encode_hash(test.doubleSpendId), later));
+        REQUIRE(txCache.status(status, badSpend));
+        REQUIRE(!status.isDoubleSpent);
+
+        const auto utxos = filterOutputs(txCache.utxos(test.ourAddresses));
+        REQUIRE(hasTxid(utxos, test.badSpendId, 0));
+    }
+
+    SECTION("utxo index")
+    {
+        // Dropping a spend makes its inputs unspent again:
+        const auto later = time(nullptr) + 2 * 60 * 60;
+        REQUIRE(txCache.drop(bc::encode_hash(test.badSpendId), later));
+
+        const auto rawUtxos = txCache.utxos(test.ourAddresses);
+        REQUIRE(5 == rawUtxos.size());
+        const auto utxos = filterOutputs(rawUtxos);
+        REQUIRE(4 == utxos.size());
+        REQUIRE(hasTxid(utxos, test.changeId, 0));
+        REQUIRE(!hasTxid(utxos, test.doubleSpendId, 0));
+        REQUIRE(!hasTxid(utxos, test.badSpendId, 0));
+
+        // Addresses we don't ask about are never returned:
+        REQUIRE(txCache.utxos(abcd::AddressSet()).empty());
+    }
+
+    SECTION("unconfirmed index")
+    {
+        // Everything touches our address, apart from the irrelevant tx:
+        auto addresses = txCache.unconfirmedAddresses();
+        REQUIRE(2 == addresses.size());
+        REQUIRE(addresses.count(*test.ourAddresses.begin()));
+        REQUIRE(txCache.unconfirmedTxids().count(
+                    bc::encode_hash(test.irrelevantId)));
+
+        // Once the irrelevant tx confirms, its address drops out:
+        txCache.confirmed(bc::encode_hash(test.irrelevantId), 102);
+        addresses = txCache.unconfirmedAddresses();
+        REQUIRE(test.ourAddresses == addresses);
+
+        // Un-confirming brings it back:
+        txCache.confirmed(bc::encode_hash(test.irrelevantId), 0, 0);
+        REQUIRE(2 == txCache.unconfirmedAddresses().size());
+
+        // Confirming or dropping everything leaves nothing to check:
+        const auto later = time(nullptr) + 2 * 60 * 60;
+        txCache.confirmed(bc::encode_hash(test.irrelevantId), 102);
+        txCache.confirmed(bc::encode_hash(test.incomingId), 102);
+        txCache.confirmed(bc::encode_hash(test.changeId), 102);
+        REQUIRE(txCache.drop(bc::encode_hash(test.badSpendId), later));
+        REQUIRE(txCache.drop(bc::encode_hash(test.doubleSpendId), later));
+        REQUIRE(txCache.unconfirmedAddresses().empty());
+        REQUIRE(txCache.unconfirmedTxids().empty());
+    }
+
+    SECTION("stratum hash")
+    {
+        const auto confirmed = bc::encode_hash(test.confirmedId);
+        const auto change = bc::encode_hash(test.changeId);
+        const auto badSpend = bc::encode_hash(test.badSpendId);
+
+        // Confirmed first, then unconfirmed, with -1 for unconfirmed parents:
+        std::string hash;
+        REQUIRE(txCache.stratumHash(hash, abcd::TxidSet
+        {
+            badSpend, change, confirmed
+        }));
+        const auto status = confirmed + ":100:" + change + ":0:" +
+                            badSpend + ":-1:";
+        REQUIRE(abcd::base16Encode(bc::sha256_hash(
+                                       bc::to_data_chunk(status))) == hash);
+
+        // Empty histories have a blank hash:
+        REQUIRE(txCache.stratumHash(hash, abcd::TxidSet{}));
+        REQUIRE(hash.empty());
+
+        // We can't say anything about unknown transactions:
+        REQUIRE(!txCache.stratumHash(hash, abcd::TxidSet
+        {
+            bc::encode_hash(bc::null_hash)
+        }));
+    }
+
+    SECTION("binary round trip")
+    {
+        abcd::CacheWriter writer;
+        txCache.save(writer);
+
+        abcd::TxCache loaded(blockCache);
+        abcd::CacheReader reader(writer.data());
+        REQUIRE(loaded.load(reader));
+        REQUIRE(reader.done());
+
+        abcd::TxStatus status;
+        REQUIRE(loaded.status(status, bc::encode_hash(test.confirmedId)));
+        REQUIRE(100 == status.height);
+        REQUIRE(loaded.status(status, bc::encode_hash(test.badSpendId)));
+        REQUIRE(status.isDoubleSpent);
+        REQUIRE(txCache.utxos(test.ourAddresses).size() ==
+                loaded.utxos(test.ourAddresses).size());
+        REQUIRE(txCache.unconfirmedAddresses() ==
+                loaded.unconfirmedAddresses());
+
+        // Truncated files are rejected:
+        const auto &data = writer.data();
+        abcd::CacheReader truncated(abcd::DataSlice(data.data(),
+                                    data.data() + data.size() - 1));
+        abcd::TxCache broken(blockCache);
+        REQUIRE(!broken.load(truncated));
+    }
+
+    SECTION("lazy decoding")
+    {
+        // Info from the raw bytes matches info from a decoded transaction:
+        const auto txid = bc::encode_hash(test.badSpendId);
+        bc::transaction_type tx;
+        REQUIRE(txCache.get(tx, txid));
+        abcd::TxInfo info, decoded;
+        REQUIRE(txCache.info(info, txid));
+        REQUIRE(txCache.info(decoded, tx));
+        REQUIRE(bc::encode_hash(abcd::makeNtxid(tx)) == info.ntxid);
+        REQUIRE(decoded.ntxid == info.ntxid);
+        REQUIRE(decoded.fee == info.fee);
+        REQUIRE(decoded.ios.size() == info.ios.size());
+
+        // Turning off the decoded list changes nothing else:
+        txCache.decodedLimitSet(0);
+        bc::transaction_type again;
+        REQUIRE(txCache.get(again, txid));
+        REQUIRE(test.badSpendId == bc::hash_transaction(again));
+    }
+}